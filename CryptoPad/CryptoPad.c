@@ -26,19 +26,10 @@
 
 #include "mZipAES.h"
 #include "resource.h"
+#include "TextUtils.h"
 
 extern void AskPassword(BOOL bForceOpen);
 
-void memrev(unsigned char* m, unsigned int l) {
-	unsigned char* t = m;
-	unsigned char* b = m + l - 1;
-	while (b > t) {
-		unsigned char c = *t;
-		*t = *b; *b = c;
-		t++; b--;
-	}
-}
-
 #define APP_TITLE   _T("CryptoPad")
 
 enum Encodings {
@@ -49,134 +40,6 @@ enum Encodings {
 	ENC_UTF16BE
 };
 
-enum Eol_Markers
-{
-	EOL_NONE,   // None
-	EOL_CR,		// Mac
-	EOL_LF,		// Unix
-	EOL_CRLF,	// DOS
-	EOL_MIXED	// Unbalanced (to be fixed)
-};
-
-// Scans a NULL terminated TCHAR buffer and determines the line ending 
-int DetectEOL(TCHAR* Buf, UINT* cCR, UINT* cLF, UINT* cCRLF)
-{
-	TCHAR* p = Buf;
-	TCHAR* q = NULL;
-	UINT cr = 0, lf = 0, crlf = 0;
-
-	while (*p)
-	{
-		if (*p == _T('\r'))
-		{
-			cr++;
-			q = p;
-		}
-		else if (*p == _T('\n'))
-		{
-			lf++;
-			if (q + 1 == p)
-			{
-				crlf++;
-				cr--;
-				lf--;
-			}
-		}
-		p++;
-	}
-
-	*cCR = cr;
-	*cLF = lf;
-	*cCRLF = crlf;
-
-	if (!cr && !lf && !crlf)
-		return EOL_NONE;
-	else if (!cr && !lf)
-		return EOL_CRLF;
-	else if (!lf && !crlf)
-		return EOL_CR;
-	else if (!cr && !crlf)
-		return EOL_LF;
-	else
-		return EOL_MIXED;
-}
-
-// Converts EOL characters in a NULL-terminated TCHAR buffer,
-// copying the result in a user allocated buffer. If uiDstSize
-// or DstBuf is NULL, returns the required buffer size.
-int ConvertEOL(
-	TCHAR* SrcBuf, UINT uiSrcSize, UINT uiSrcEol,
-	TCHAR* DstBuf, UINT uiDstSize, UINT uiDstEol,
-	UINT cCR, UINT cLF, UINT cCRLF)
-{
-	UINT uiSize = uiSrcSize;
-	TCHAR *p, *q=NULL;
-
-	if (uiSrcEol == uiDstEol)
-		return -1;
-
-	if (uiDstEol != EOL_CR && uiDstEol != EOL_LF && uiDstEol != EOL_CRLF)
-		return -1;
-
-	if (uiDstEol == EOL_CRLF)
-		if (uiSrcEol == EOL_LF)
-			uiSize += (cLF * sizeof(TCHAR));
-		else if (uiSrcEol == EOL_CR)
-			uiSize += (cCR * sizeof(TCHAR));
-		else
-			uiSize += (sizeof(TCHAR) * (cCR+cLF));
-	else
-		uiSize -= ((cCRLF/2) * sizeof(TCHAR));
-
-	if (!uiDstSize || !DstBuf)
-		return uiSize;
-
-	if (uiDstSize < uiSize)
-		return -1;
-
-	p = DstBuf;
-
-	while (*SrcBuf)
-	{
-		if (*SrcBuf == _T('\r'))
-			if (uiDstEol == EOL_CRLF)
-			{
-				*p++ = _T('\r');
-				*p++ = _T('\n');
-				q = SrcBuf;
-			}
-			else // EOL_LF
-			{
-				if (uiDstEol == EOL_LF)
-					*p++ = _T('\n');
-				else
-					*p++ = *SrcBuf;
-			}
-		else if (*SrcBuf == _T('\n'))
-			if (uiDstEol == EOL_CRLF)
-			{
-				if (q + 1 != SrcBuf)
-				{
-					*p++ = _T('\r');
-					*p++ = _T('\n');
-				}
-			}
-			else // EOL_CR
-			{
-				if (uiSrcEol != EOL_CRLF)
-					*p++ = _T('\r');
-			}
-		else // copy normal TCHAR
-			*p++ = *SrcBuf;
-		SrcBuf++;
-	}
-
-	*p = _T('\0');
-
-	return 0;
-}
-
-
 // Global variables
 TCHAR		szAppName[] = APP_TITLE;
 HWND		hwndMain = NULL;
@@ -190,11 +53,14 @@ TCHAR *szEditBuffer, *szEditBufferBase;
 UINT uiFileEncoding = ENC_UTF8_BOM; // Default output encoding
 UINT uiFileEOL = EOL_CRLF; // Default output line ending
 char* document_password; // NULL ended ASCII password
+MZAE_PREKEY* document_prekey; // keys for the next save, derived in background
+MZAE_ARENA* document_arena; // locked scratch memory of loads and saves, wiped after each
 
 
+// Memory is not zeroed: callers set what they read
 LPVOID Malloc(SIZE_T dwBytes)
 {
-	LPVOID p = HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, dwBytes);
+	LPVOID p = HeapAlloc(GetProcessHeap(), 0, dwBytes);
 
 	if (! p)
 	{
@@ -212,6 +78,15 @@ BOOL Free(LPVOID lpMem)
 	return HeapFree(GetProcessHeap(), 0, lpMem);
 }
 
+// (Re)starts deriving the keys for the next save with the current password
+void PrepareKeys()
+{
+	MZAE_prekey_free(document_prekey);
+	document_prekey = NULL;
+	if (document_password && document_password[0])
+		MZAE_prekey_init(&document_prekey, document_password);
+}
+
 
 void FlushMenus()
 {
@@ -254,9 +129,10 @@ void FlushMenus()
 
 int LoadFile()
 {
-	DWORD dwInSize, dwOutSize, dwRead, dwEncoding = ENC_UNKNOWN;
+	DWORD dwInSize, dwOutSize, dwRead, dwRead2, dwEncoding = ENC_UNKNOWN;
 	UINT cCR, cLF, cCRLF;
 	char *lpBuffer, *dst;
+	MZAE_OPTIONS opts = {0};
 	LPTSTR p = NULL;
 	HANDLE hFile = CreateFile(szFileName, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, 0, 0);
 
@@ -272,11 +148,22 @@ int LoadFile()
 	lpBuffer = Malloc(dwInSize + sizeof(TCHAR));
 	if (!lpBuffer)
 		return -1;
-
-	ReadFile(hFile, lpBuffer, dwInSize, &dwRead, 0);
+	*(TCHAR*)(lpBuffer + dwInSize) = 0; // NULL terminates a plain text
+
+	// Reads the ZIP header first: keys are derived from its salt while the
+	// rest of the file is read
+	dwRead = dwRead2 = 0;
+	if (dwInSize > 63)
+		ReadFile(hFile, lpBuffer, 63, &dwRead, 0);
+	if (dwRead == 63 && *((DWORD*)lpBuffer) == 0x04034B50 && lpBuffer[42] > 0 && lpBuffer[42] < 4 &&
+		document_password && document_password[0])
+		MZAE_kdf_start(&opts.kdf, document_password, lpBuffer + 45, 4 + 4 * lpBuffer[42]);
+	ReadFile(hFile, lpBuffer + dwRead, dwInSize - dwRead, &dwRead2, 0);
+	dwRead += dwRead2;
 	CloseHandle(hFile);
 	if (dwRead != dwInSize)
 	{
+		MZAE_kdf_join(opts.kdf, NULL, 0, NULL);
 		LoadString(GetModuleHandle(0), IDS_ERDFILE, (LPWSTR) s0, sizeof(s0) / sizeof(TCHAR));
 		LoadString(GetModuleHandle(0), IDS_ERROR, (LPWSTR) s1, sizeof(s1) / sizeof(TCHAR));
 		MessageBox(hwndEdit, s0, s1, MB_OK | MB_ICONSTOP);
@@ -294,13 +181,23 @@ int LoadFile()
 		{
 			dst = Malloc(dwOutSize+sizeof(TCHAR));
 			if (!dst)
+			{
+				MZAE_kdf_join(opts.kdf, NULL, 0, NULL);
 				return -1;
+			}
+			*(TCHAR*)(dst + dwOutSize) = 0;
+		}
+		else
+		{
+			MZAE_kdf_join(opts.kdf, NULL, 0, NULL);
+			opts.kdf = NULL;
 		}
 
-		dwRead = MiniZipAERead(lpBuffer, dwInSize, &dst, (unsigned long*)&dwOutSize, document_password);
-	
-		if (*(lpBuffer+dwInSize-1) == 0x52) // if V2 doc format
-			memrev(dst, dwOutSize);
+		// Consumes the keys derivation started above; a V2 document is
+		// reversed as it is extracted
+		opts.arena = document_arena;
+		opts.reverse = *(lpBuffer+dwInSize-1) == 0x52;
+		dwRead = MiniZipAEReadEx(lpBuffer, dwInSize, &dst, (unsigned long*)&dwOutSize, document_password, &opts);
 
 		if (dwRead == MZAE_ERR_SUCCESS)
 		{
@@ -332,7 +229,10 @@ int LoadFile()
 		}
 	}
 	else
+	{
 		*document_password = 0; // resets password, or saved plain text will be encrypted
+		PrepareKeys();
+	}
 
 	// If plain text document loaded
 	// dwInSize will represent the NULL terminated buffer length
@@ -491,8 +391,8 @@ BOOL SaveFile(int size)
 	if (document_password && document_password[0])
 	{
 		DWORD dwOutSize = 0;
+		MZAE_OPTIONS opts = {0};
 
-		memrev(p, size); // reverses source buffer (V2 document format)
 		// calc and alloca reqd buf size
 		err = MiniZipAEWrite(p, size, &dst, (unsigned long*)&dwOutSize, document_password);
 	
@@ -500,15 +400,15 @@ BOOL SaveFile(int size)
 		{
 			dst = Malloc(dwOutSize);
 			if (!dst)
-			{
-				memrev(p, size);
 				return FALSE;
-			}
 		}
 		else goto aeerr;
 	
-		err = MiniZipAEWrite(p, size, &dst, (unsigned long*)&dwOutSize, document_password);
-		memrev(p, size);
+		// The source buffer is compressed reversed (V2 document format)
+		opts.prekey = document_prekey;
+		opts.arena = document_arena;
+		opts.reverse = 1;
+		err = MiniZipAEWriteEx(p, size, &dst, (unsigned long*)&dwOutSize, document_password, &opts);
 		if (err != MZAE_ERR_SUCCESS)
 		{
 			Free(dst);
@@ -682,11 +582,24 @@ LRESULT CALLBACK WndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam)
 {
 	static int width, height;
 	HFONT hFont;
+	SIZE_T wsmin, wsmax;
 
 	switch (msg)
 	{
 	case WM_CREATE:
 		document_password = Malloc(128);
+		if (document_password)
+			*document_password = 0;
+		// Locked pages count against the working set minimum (200 KB by
+		// default), which is raised by the arena size first
+		if (GetProcessWorkingSetSize(GetCurrentProcess(), &wsmin, &wsmax))
+			SetProcessWorkingSetSize(GetCurrentProcess(), wsmin + MZAE_ARENA_SIZE, wsmax + MZAE_ARENA_SIZE);
+		// If it still cannot be locked, scratch memory is only wiped
+		if (MZAE_arena_init(&document_arena, 0, MZAE_ARENA_LOCK))
+		{
+			OutputDebugString(_T("CryptoPad: scratch arena not locked in memory\n"));
+			MZAE_arena_init(&document_arena, 0, 0);
+		}
 		hwndEdit = CreateWindowEx(0,
 			_T("EDIT"), NULL,
 			WS_VSCROLL | WS_CHILD | WS_VISIBLE |
@@ -722,6 +635,8 @@ LRESULT CALLBACK WndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam)
 		return 0;
 
 	case WM_DESTROY:
+		MZAE_prekey_free(document_prekey);
+		MZAE_arena_free(document_arena);
 		PostQuitMessage(0);
 		return 0;
 
@@ -761,6 +676,7 @@ LRESULT CALLBACK WndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam)
 				uiFileEncoding = ENC_UTF8_BOM;
 				uiFileEOL = EOL_CRLF;
 				document_password[0] = (char)0;
+				PrepareKeys();
 				szFileName[0] = (TCHAR)0;
 				szFileTitle[0] = (TCHAR)0;
 				LoadString(GetModuleHandle(0), IDS_UNTITLED, (LPWSTR)s0, sizeof(s0) / sizeof(TCHAR));
@@ -846,6 +762,7 @@ LRESULT CALLBACK WndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam)
 
 		case ID_FILE_RESETPASSWORD:
 			document_password[0] = (char) NULL;
+			PrepareKeys();
 			break;
 
         case IDM_EDUNDO:
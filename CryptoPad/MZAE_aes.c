@@ -0,0 +1,246 @@
+/*
+ *  Copyright (C) 2016-2023  maxpat78 <https://github.com/maxpat78>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+	AES encryption (FIPS-197) without external libraries.
+
+	The portable kernel looks up a single 1 KB table, rotated for each
+	column; its timing depends on the data, so it is the last resort on
+	processors without the AES instructions. The AES-NI kernel runs eight
+	blocks at once, to hide the latency of AESENC. Both share the key
+	schedule computed here.
+*/
+#include <mZipAES.h>
+#include <MZAE_backend.h>
+#include <MZAE_cpu.h>
+#include <MZAE_thread.h>
+#include <string.h>
+
+#define GETBE32(p) ((unsigned int)(p)[0] << 24 | (unsigned int)(p)[1] << 16 | (unsigned int)(p)[2] << 8 | (p)[3])
+#define PUTBE32(p, v) ((p)[0] = (unsigned char)((v) >> 24), (p)[1] = (unsigned char)((v) >> 16), \
+	(p)[2] = (unsigned char)((v) >> 8), (p)[3] = (unsigned char)(v))
+#define ROR(x, n) ((x) >> (n) | (x) << (32 - (n)))
+
+
+
+static const unsigned char mzae_sbox[256] = {
+	0x63, 0x7C, 0x77, 0x7B, 0xF2, 0x6B, 0x6F, 0xC5, 0x30, 0x01, 0x67, 0x2B, 0xFE, 0xD7, 0xAB, 0x76,
+	0xCA, 0x82, 0xC9, 0x7D, 0xFA, 0x59, 0x47, 0xF0, 0xAD, 0xD4, 0xA2, 0xAF, 0x9C, 0xA4, 0x72, 0xC0,
+	0xB7, 0xFD, 0x93, 0x26, 0x36, 0x3F, 0xF7, 0xCC, 0x34, 0xA5, 0xE5, 0xF1, 0x71, 0xD8, 0x31, 0x15,
+	0x04, 0xC7, 0x23, 0xC3, 0x18, 0x96, 0x05, 0x9A, 0x07, 0x12, 0x80, 0xE2, 0xEB, 0x27, 0xB2, 0x75,
+	0x09, 0x83, 0x2C, 0x1A, 0x1B, 0x6E, 0x5A, 0xA0, 0x52, 0x3B, 0xD6, 0xB3, 0x29, 0xE3, 0x2F, 0x84,
+	0x53, 0xD1, 0x00, 0xED, 0x20, 0xFC, 0xB1, 0x5B, 0x6A, 0xCB, 0xBE, 0x39, 0x4A, 0x4C, 0x58, 0xCF,
+	0xD0, 0xEF, 0xAA, 0xFB, 0x43, 0x4D, 0x33, 0x85, 0x45, 0xF9, 0x02, 0x7F, 0x50, 0x3C, 0x9F, 0xA8,
+	0x51, 0xA3, 0x40, 0x8F, 0x92, 0x9D, 0x38, 0xF5, 0xBC, 0xB6, 0xDA, 0x21, 0x10, 0xFF, 0xF3, 0xD2,
+	0xCD, 0x0C, 0x13, 0xEC, 0x5F, 0x97, 0x44, 0x17, 0xC4, 0xA7, 0x7E, 0x3D, 0x64, 0x5D, 0x19, 0x73,
+	0x60, 0x81, 0x4F, 0xDC, 0x22, 0x2A, 0x90, 0x88, 0x46, 0xEE, 0xB8, 0x14, 0xDE, 0x5E, 0x0B, 0xDB,
+	0xE0, 0x32, 0x3A, 0x0A, 0x49, 0x06, 0x24, 0x5C, 0xC2, 0xD3, 0xAC, 0x62, 0x91, 0x95, 0xE4, 0x79,
+	0xE7, 0xC8, 0x37, 0x6D, 0x8D, 0xD5, 0x4E, 0xA9, 0x6C, 0x56, 0xF4, 0xEA, 0x65, 0x7A, 0xAE, 0x08,
+	0xBA, 0x78, 0x25, 0x2E, 0x1C, 0xA6, 0xB4, 0xC6, 0xE8, 0xDD, 0x74, 0x1F, 0x4B, 0xBD, 0x8B, 0x8A,
+	0x70, 0x3E, 0xB5, 0x66, 0x48, 0x03, 0xF6, 0x0E, 0x61, 0x35, 0x57, 0xB9, 0x86, 0xC1, 0x1D, 0x9E,
+	0xE1, 0xF8, 0x98, 0x11, 0x69, 0xD9, 0x8E, 0x94, 0x9B, 0x1E, 0x87, 0xE9, 0xCE, 0x55, 0x28, 0xDF,
+	0x8C, 0xA1, 0x89, 0x0D, 0xBF, 0xE6, 0x42, 0x68, 0x41, 0x99, 0x2D, 0x0F, 0xB0, 0x54, 0xBB, 0x16
+};
+
+// SubBytes and MixColumns of a byte, as the column {2s, s, s, 3s}
+static unsigned int mzae_te[256];
+
+static MZAE_ONCE mzae_aes_once = MZAE_ONCE_INIT;
+
+static void mzae_aes_tables(void)
+{
+	unsigned int i, s, s2;
+
+	for (i = 0; i < 256; i++)
+	{
+		s = mzae_sbox[i];
+		s2 = (s << 1) ^ (s & 0x80 ? 0x11B : 0);
+		mzae_te[i] = s2 << 24 | s << 16 | s << 8 | (s2 ^ s);
+	}
+}
+
+
+
+// Key schedule, as big endian words and as bytes
+struct mzae_aes {
+	unsigned int rk[60];
+	unsigned char rkb[240];
+	int rounds;
+};
+
+#define SUBWORD(t) ((unsigned int) mzae_sbox[(t) >> 24] << 24 | (unsigned int) mzae_sbox[((t) >> 16) & 0xFF] << 16 | \
+	(unsigned int) mzae_sbox[((t) >> 8) & 0xFF] << 8 | mzae_sbox[(t) & 0xFF])
+
+static int mzae_aes_init(void* aes, char* key, unsigned int keylen)
+{
+	struct mzae_aes* a = (struct mzae_aes*) aes;
+	const unsigned char* k = (const unsigned char*) key;
+	unsigned int nk = keylen / 4, i, t, rcon = 1;
+
+	if (keylen != 16 && keylen != 24 && keylen != 32)
+		return -1;
+
+	MZAE_once(&mzae_aes_once, mzae_aes_tables);
+
+	a->rounds = nk + 6;
+	for (i = 0; i < nk; i++)
+		a->rk[i] = GETBE32(k + 4*i);
+
+	for (; i < 4 * (unsigned int)(a->rounds + 1); i++)
+	{
+		t = a->rk[i-1];
+		if (i % nk == 0)
+		{
+			t = SUBWORD(t << 8 | t >> 24) ^ rcon << 24;
+			rcon = (rcon << 1) ^ (rcon & 0x80 ? 0x11B : 0);
+		}
+		else if (nk > 6 && i % nk == 4)
+			t = SUBWORD(t);
+		a->rk[i] = a->rk[i-nk] ^ t;
+	}
+
+	for (i = 0; i < 4 * (unsigned int)(a->rounds + 1); i++)
+		PUTBE32(a->rkb + 4*i, a->rk[i]);
+
+	return 0;
+}
+
+static int mzae_aes_copy(void* dst, void* src)
+{
+	memcpy(dst, src, sizeof(struct mzae_aes));
+	return 0;
+}
+
+static void mzae_aes_clear(void* aes)
+{
+	memset(aes, 0, sizeof(struct mzae_aes));
+}
+
+
+
+#define TE(a, b, c, d) (mzae_te[(a) >> 24] ^ ROR(mzae_te[((b) >> 16) & 0xFF], 8) ^ \
+	ROR(mzae_te[((c) >> 8) & 0xFF], 16) ^ ROR(mzae_te[(d) & 0xFF], 24))
+#define SB(a, b, c, d) ((unsigned int) mzae_sbox[(a) >> 24] << 24 | (unsigned int) mzae_sbox[((b) >> 16) & 0xFF] << 16 | \
+	(unsigned int) mzae_sbox[((c) >> 8) & 0xFF] << 8 | mzae_sbox[(d) & 0xFF])
+
+static void mzae_aes_blocks_c(void* aes, const unsigned char* src, unsigned char* dst, unsigned int n)
+{
+	const struct mzae_aes* a = (const struct mzae_aes*) aes;
+	const unsigned int* rk;
+	unsigned int s0, s1, s2, s3, t0, t1, t2, t3;
+	int r;
+
+	for (; n; n--, src += 16, dst += 16)
+	{
+		rk = a->rk;
+		s0 = GETBE32(src) ^ rk[0];
+		s1 = GETBE32(src + 4) ^ rk[1];
+		s2 = GETBE32(src + 8) ^ rk[2];
+		s3 = GETBE32(src + 12) ^ rk[3];
+
+		for (r = 1; r < a->rounds; r++)
+		{
+			rk += 4;
+			t0 = TE(s0, s1, s2, s3) ^ rk[0];
+			t1 = TE(s1, s2, s3, s0) ^ rk[1];
+			t2 = TE(s2, s3, s0, s1) ^ rk[2];
+			t3 = TE(s3, s0, s1, s2) ^ rk[3];
+			s0 = t0; s1 = t1; s2 = t2; s3 = t3;
+		}
+
+		rk += 4;
+		t0 = SB(s0, s1, s2, s3) ^ rk[0];
+		t1 = SB(s1, s2, s3, s0) ^ rk[1];
+		t2 = SB(s2, s3, s0, s1) ^ rk[2];
+		t3 = SB(s3, s0, s1, s2) ^ rk[3];
+		PUTBE32(dst, t0);
+		PUTBE32(dst + 4, t1);
+		PUTBE32(dst + 8, t2);
+		PUTBE32(dst + 12, t3);
+	}
+}
+
+const MZAE_AES_OPS MZAE_aes_c = {
+	sizeof(struct mzae_aes), NULL, mzae_aes_init, mzae_aes_copy, mzae_aes_blocks_c, mzae_aes_clear
+};
+
+
+
+#ifdef MZAE_X86
+// Blocks encrypted together: AESENC has a latency of several cycles, but
+// a new one can start every cycle
+#define MZAE_AES_LANES 8
+
+#define AESENC8(k) \
+	b0 = _mm_aesenc_si128(b0, k); b1 = _mm_aesenc_si128(b1, k); \
+	b2 = _mm_aesenc_si128(b2, k); b3 = _mm_aesenc_si128(b3, k); \
+	b4 = _mm_aesenc_si128(b4, k); b5 = _mm_aesenc_si128(b5, k); \
+	b6 = _mm_aesenc_si128(b6, k); b7 = _mm_aesenc_si128(b7, k);
+
+#define LOAD(i) _mm_xor_si128(_mm_loadu_si128((const __m128i*) src + (i)), k[0])
+#define STORE(i, b) _mm_storeu_si128((__m128i*) dst + (i), _mm_aesenclast_si128(b, k[rounds]))
+
+MZAE_TARGET("aes,sse2")
+static void mzae_aes_blocks_ni(void* aes, const unsigned char* src, unsigned char* dst, unsigned int n)
+{
+	const struct mzae_aes* a = (const struct mzae_aes*) aes;
+	__m128i k[15], b0, b1, b2, b3, b4, b5, b6, b7;
+	int r, rounds = a->rounds;
+
+	for (r = 0; r <= rounds; r++)
+		k[r] = _mm_loadu_si128((const __m128i*) (a->rkb + 16*r));
+
+	for (; n >= MZAE_AES_LANES; n -= MZAE_AES_LANES, src += 16*MZAE_AES_LANES, dst += 16*MZAE_AES_LANES)
+	{
+		b0 = LOAD(0); b1 = LOAD(1); b2 = LOAD(2); b3 = LOAD(3);
+		b4 = LOAD(4); b5 = LOAD(5); b6 = LOAD(6); b7 = LOAD(7);
+		for (r = 1; r < rounds; r++)
+		{
+			AESENC8(k[r])
+		}
+		STORE(0, b0); STORE(1, b1); STORE(2, b2); STORE(3, b3);
+		STORE(4, b4); STORE(5, b5); STORE(6, b6); STORE(7, b7);
+	}
+
+	for (; n; n--, src += 16, dst += 16)
+	{
+		b0 = LOAD(0);
+		for (r = 1; r < rounds; r++)
+			b0 = _mm_aesenc_si128(b0, k[r]);
+		STORE(0, b0);
+	}
+}
+
+static int mzae_aes_ni_usable(void)
+{
+	return (MZAE_cpu_features() & MZAE_CPU_AESNI) != 0;
+}
+
+const MZAE_AES_OPS MZAE_aes_ni = {
+	sizeof(struct mzae_aes), mzae_aes_ni_usable, mzae_aes_init, mzae_aes_copy, mzae_aes_blocks_ni, mzae_aes_clear
+};
+#else
+static int mzae_aes_ni_usable(void)
+{
+	return 0;
+}
+
+const MZAE_AES_OPS MZAE_aes_ni = {
+	sizeof(struct mzae_aes), mzae_aes_ni_usable, mzae_aes_init, mzae_aes_copy, mzae_aes_blocks_c, mzae_aes_clear
+};
+#endif
@@ -0,0 +1,307 @@
+/*
+ *  Copyright (C) 2016-2023  maxpat78 <https://github.com/maxpat78>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+	Scratch memory: pluggable allocator and per call arenas
+*/
+#include <MZAE_alloc.h>
+#include <MZAE_thread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+// Arena blocks start on a cache line
+#define MZAE_ALIGN 64
+
+#define MZAE_BLOCK_COUNTED	1
+#define MZAE_BLOCK_ARENA	2
+
+// Each allocation carries its size and origin in a header, which keeps the
+// payload aligned
+union mzae_block {
+	struct {
+		size_t size;
+		unsigned int flags;
+	} h;
+	long double align;
+	void* p;
+};
+
+struct mzae_arena {
+	char* base;
+	size_t size, used;
+	int locked;
+};
+
+static void* mzae_default_alloc(void* opaque, size_t size)
+{
+	return malloc(size);
+}
+
+static void mzae_default_release(void* opaque, void* p)
+{
+	free(p);
+}
+
+static void* (*mzae_alloc)(void* opaque, size_t size) = mzae_default_alloc;
+static void (*mzae_release)(void* opaque, void* p) = mzae_default_release;
+static void* mzae_alloc_opaque;
+
+// Statistics and arena of the call running in each thread
+static MZAE_TLS MZAE_SCOPE mzae_scope;
+
+// Wipes memory even if it is not read afterwards
+static void* (* volatile mzae_wipe)(void*, int, size_t) = memset;
+
+
+
+void MZAE_allocator(void* (*alloc)(void* opaque, size_t size), void (*release)(void* opaque, void* p), void* opaque)
+{
+	if (!alloc || !release)
+	{
+		alloc = mzae_default_alloc;
+		release = mzae_default_release;
+		opaque = NULL;
+	}
+	mzae_alloc = alloc;
+	mzae_release = release;
+	mzae_alloc_opaque = opaque;
+}
+
+
+
+int MZAE_arena_init(MZAE_ARENA** arena, unsigned long size, int flags)
+{
+	MZAE_ARENA* a;
+	size_t page;
+
+	if (!arena)
+		return MZAE_ERR_PARAMS;
+
+	if (!size)
+		size = MZAE_ARENA_SIZE;
+
+	a = (MZAE_ARENA*) calloc(1, sizeof(MZAE_ARENA));
+	if (!a)
+		return MZAE_ERR_NOMEM;
+
+#ifdef _WIN32
+	{
+		SYSTEM_INFO si;
+		GetSystemInfo(&si);
+		page = si.dwPageSize;
+	}
+	// Large pages need the "Lock pages in memory" privilege, and are locked
+	if ((flags & MZAE_ARENA_HUGE) && GetLargePageMinimum())
+	{
+		page = GetLargePageMinimum();
+		a->size = (size + page - 1) / page * page;
+		a->base = (char*) VirtualAlloc(NULL, a->size, MEM_COMMIT | MEM_RESERVE | MEM_LARGE_PAGES, PAGE_READWRITE);
+		if (a->base)
+			flags &= ~MZAE_ARENA_LOCK;
+	}
+	if (!a->base)
+	{
+		a->size = (size + page - 1) / page * page;
+		a->base = (char*) VirtualAlloc(NULL, a->size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+	}
+	if (a->base && (flags & MZAE_ARENA_LOCK))
+	{
+		if (!VirtualLock(a->base, a->size))
+		{
+			VirtualFree(a->base, 0, MEM_RELEASE);
+			a->base = NULL;
+		}
+		else
+			a->locked = 1;
+	}
+#else
+	page = (size_t) sysconf(_SC_PAGESIZE);
+#ifdef MAP_HUGETLB
+	// Explicit huge pages are there only if the administrator reserved them
+	if (flags & MZAE_ARENA_HUGE)
+	{
+		a->size = (size + (2 << 20) - 1) & ~(size_t)((2 << 20) - 1);
+		a->base = (char*) mmap(NULL, a->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (a->base == (char*) MAP_FAILED)
+			a->base = NULL;
+	}
+#endif
+	if (!a->base)
+	{
+		a->size = (size + page - 1) / page * page;
+		a->base = (char*) mmap(NULL, a->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (a->base == (char*) MAP_FAILED)
+			a->base = NULL;
+#ifdef MADV_HUGEPAGE
+		// Otherwise transparent huge pages, where enabled
+		if (a->base && (flags & MZAE_ARENA_HUGE))
+			madvise(a->base, a->size, MADV_HUGEPAGE);
+#endif
+	}
+	if (a->base && (flags & MZAE_ARENA_LOCK))
+	{
+		if (mlock(a->base, a->size))
+		{
+			munmap(a->base, a->size);
+			a->base = NULL;
+		}
+		else
+			a->locked = 1;
+	}
+#endif
+
+	if (!a->base)
+	{
+		free(a);
+		return MZAE_ERR_NOMEM;
+	}
+
+	*arena = a;
+
+	return MZAE_ERR_SUCCESS;
+}
+
+
+
+void MZAE_arena_free(MZAE_ARENA* arena)
+{
+	if (!arena)
+		return;
+
+	mzae_wipe(arena->base, 0, arena->used);
+#ifdef _WIN32
+	if (arena->locked)
+		VirtualUnlock(arena->base, arena->size);
+	VirtualFree(arena->base, 0, MEM_RELEASE);
+#else
+	if (arena->locked)
+		munlock(arena->base, arena->size);
+	munmap(arena->base, arena->size);
+#endif
+	free(arena);
+}
+
+
+
+void MZAE_scope_enter(MZAE_STATS* stats, MZAE_ARENA* arena, MZAE_SCOPE* saved)
+{
+	*saved = mzae_scope;
+	mzae_scope.stats = stats;
+	mzae_scope.arena = arena;
+}
+
+
+
+void MZAE_scope_leave(MZAE_SCOPE* saved)
+{
+	MZAE_ARENA* a = mzae_scope.arena;
+
+	// Everything allocated in the call is released: the arena is wiped once
+	if (a && a != saved->arena)
+	{
+		mzae_wipe(a->base, 0, a->used);
+		a->used = 0;
+	}
+	mzae_scope = *saved;
+}
+
+
+
+void* MZAE_malloc(size_t size)
+{
+	MZAE_STATS* s = mzae_scope.stats;
+	MZAE_ARENA* a = mzae_scope.arena;
+	union mzae_block* b = NULL;
+	size_t off;
+
+	if (size > (size_t) -1 - MZAE_ALIGN - sizeof(union mzae_block))
+		return NULL;
+
+	// Served by the arena while it has room, by the allocator afterwards
+	if (a)
+	{
+		off = (a->used + sizeof(union mzae_block) + MZAE_ALIGN - 1) & ~(size_t)(MZAE_ALIGN - 1);
+		if (off <= a->size && size <= a->size - off)
+		{
+			b = (union mzae_block*)(a->base + off) - 1;
+			b->h.flags = MZAE_BLOCK_ARENA;
+			a->used = off + size;
+		}
+	}
+	if (!b)
+	{
+		b = (union mzae_block*) mzae_alloc(mzae_alloc_opaque, sizeof(union mzae_block) + size);
+		if (!b)
+			return NULL;
+		b->h.flags = 0;
+	}
+
+	b->h.size = size;
+	if (s)
+	{
+		b->h.flags |= MZAE_BLOCK_COUNTED;
+		s->allocs++;
+		s->scratch += size;
+		if (s->scratch > s->peak_scratch)
+			s->peak_scratch = s->scratch;
+	}
+
+	return b + 1;
+}
+
+
+
+void* MZAE_calloc(size_t n, size_t size)
+{
+	void* p;
+
+	if (size && n > (size_t) -1 / size)
+		return NULL;
+
+	p = MZAE_malloc(n * size);
+	if (p)
+		memset(p, 0, n * size);
+
+	return p;
+}
+
+
+
+void MZAE_free(void* p)
+{
+	MZAE_STATS* s = mzae_scope.stats;
+	union mzae_block* b;
+
+	if (!p)
+		return;
+
+	b = (union mzae_block*) p - 1;
+	if ((b->h.flags & MZAE_BLOCK_COUNTED) && s && s->scratch >= b->h.size)
+		s->scratch -= b->h.size;
+
+	// Arena blocks are recycled all together, when the call ends
+	if (!(b->h.flags & MZAE_BLOCK_ARENA))
+		mzae_release(mzae_alloc_opaque, b);
+}
@@ -0,0 +1,67 @@
+/*
+ *  Copyright (C) 2016-2023  maxpat78 <https://github.com/maxpat78>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+   MZAE_alloc.h
+
+   Scratch memory of the MZAE functions: the objects they allocate internally
+   come from the allocator set with MZAE_allocator or, during a call given an
+   arena, from the arena, and are counted by the statistics being collected.
+*/
+
+#if !defined(__MZAE_ALLOC__)
+#define __MZAE_ALLOC__
+
+#include <mZipAES.h>
+#include <stddef.h>
+
+# ifdef  __cplusplus
+extern "C" {
+# endif
+
+// Where the scratch allocations of a thread go
+typedef struct {
+	MZAE_STATS* stats;
+	MZAE_ARENA* arena;
+} MZAE_SCOPE;
+
+
+/*
+	Makes the scratch allocations of the calling thread count in stats and
+	come from arena (both may be NULL), until MZAE_scope_leave restores the
+	former scope saved here. Leaving an arena wipes and recycles it.
+*/
+void MZAE_scope_enter(MZAE_STATS* stats, MZAE_ARENA* arena, MZAE_SCOPE* saved);
+void MZAE_scope_leave(MZAE_SCOPE* saved);
+
+
+/*
+	Allocate and release the library objects (codecs, contexts, jobs).
+	Objects outliving the call that creates them must be allocated out of
+	any scope. Buffers handed to the caller, who frees them with free(),
+	come from malloc instead.
+*/
+void* MZAE_malloc(size_t size);
+void* MZAE_calloc(size_t n, size_t size);
+void MZAE_free(void* p);
+
+# ifdef  __cplusplus
+}
+# endif
+
+#endif // __MZAE_ALLOC__
@@ -0,0 +1,668 @@
+/*
+ *  Copyright (C) 2016-2023  maxpat78 <https://github.com/maxpat78>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+	Salt, keys derivation, AES-CTR and HMAC on top of the backend selected
+	at run time. Unless one is chosen with MZAE_backend, the first use times
+	each available backend on a short sample and keeps the fastest.
+
+	Without OpenSSL (MZAE_NO_OPENSSL defined, MZAE_openssl.c left out) the
+	library depends on the operating system only.
+*/
+
+#include <mZipAES.h>
+#include <MZAE_backend.h>
+#include <MZAE_thread.h>
+#include <MZAE_alloc.h>
+#include <MZAE_stats.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <bcrypt.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+
+#ifdef BYTE_ORDER_1234
+void betole64(unsigned long long *x) {
+*x = (*x & 0x00000000FFFFFFFF) << 32 | (*x & 0xFFFFFFFF00000000) >> 32;
+*x = (*x & 0x0000FFFF0000FFFF) << 16 | (*x & 0xFFFF0000FFFF0000) >> 16;
+*x = (*x & 0x00FF00FF00FF00FF) << 8  | (*x & 0xFF00FF00FF00FF00) >> 8;
+}
+#endif
+
+
+
+// Random salt from the operating system
+static int mzae_os_salt(char* salt, int saltlen)
+{
+#ifdef _WIN32
+	if (BCryptGenRandom(NULL, (PUCHAR) salt, saltlen, BCRYPT_USE_SYSTEM_PREFERRED_RNG) < 0)
+		return 2;
+#else
+	int fd, n;
+
+	fd = open("/dev/urandom", O_RDONLY);
+	if (fd < 0)
+		return 2;
+	while (saltlen > 0)
+	{
+		n = read(fd, salt, saltlen);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		salt += n;
+		saltlen -= n;
+	}
+	close(fd);
+	if (saltlen)
+		return 2;
+#endif
+
+	return 0;
+}
+
+
+
+static const MZAE_BACKEND mzae_backend_c = {
+	"c", mzae_os_salt, MZAE_pbkdf2_sha1, &MZAE_aes_c, &MZAE_hmac_builtin
+};
+
+static const MZAE_BACKEND mzae_backend_aesni = {
+	"aesni", mzae_os_salt, MZAE_pbkdf2_sha1, &MZAE_aes_ni, &MZAE_hmac_builtin
+};
+
+#ifndef MZAE_NO_OPENSSL
+static const MZAE_BACKEND mzae_backend_openssl = {
+	"openssl", MZAE_openssl_salt, MZAE_pbkdf2_sha1, &MZAE_aes_openssl, &MZAE_hmac_openssl
+};
+#endif
+
+// Indexed by MZAE_BACKEND_*, NULL if not built in
+static const MZAE_BACKEND* mzae_backends[MZAE_BACKENDS] = {
+	NULL,
+	&mzae_backend_c,
+	&mzae_backend_aesni,
+#ifndef MZAE_NO_OPENSSL
+	&mzae_backend_openssl,
+#else
+	NULL,
+#endif
+};
+
+static int mzae_backend_pref = MZAE_BACKEND_AUTO;
+static int mzae_backend_fastest = MZAE_BACKEND_C;
+static MZAE_ONCE mzae_backend_once = MZAE_ONCE_INIT;
+
+// Backends able to run here: probing may trap to the hypervisor, so it is
+// done once and not at each context initialization
+static int mzae_backend_ok[MZAE_BACKENDS];
+static MZAE_ONCE mzae_backend_probe_once = MZAE_ONCE_INIT;
+
+// Bytes encrypted and authenticated to time a backend, and times it is done
+#define MZAE_BACKEND_SAMPLE (32 << 10)
+#define MZAE_BACKEND_ROUNDS 4
+
+
+
+static void mzae_backend_probe(void)
+{
+	const MZAE_BACKEND* be;
+	int i;
+
+	for (i = 0; i < MZAE_BACKENDS; i++)
+	{
+		be = mzae_backends[i];
+		mzae_backend_ok[i] = be && (!be->aes->usable || be->aes->usable());
+	}
+}
+
+static int mzae_backend_usable(int backend)
+{
+	MZAE_once(&mzae_backend_probe_once, mzae_backend_probe);
+
+	return mzae_backend_ok[backend];
+}
+
+
+
+// Best time, in nanoseconds, of a backend encrypting and authenticating the
+// sample, or zero if it failed
+static unsigned long long mzae_backend_time(const MZAE_BACKEND* be, unsigned char* buf)
+{
+	char key[32];
+	void *aes, *hmac;
+	unsigned long long t, best = 0;
+	int i;
+
+	memset(key, 0x5A, sizeof(key));
+	aes = MZAE_malloc(be->aes->size);
+	hmac = MZAE_malloc(be->hmac->size);
+
+	if (aes && hmac && !be->aes->init(aes, key, 32))
+	{
+		if (!be->hmac->init(hmac, key, 32))
+		{
+			for (i = 0; i < MZAE_BACKEND_ROUNDS; i++)
+			{
+				t = MZAE_now();
+				be->aes->blocks(aes, buf, buf, MZAE_BACKEND_SAMPLE / 16);
+				be->hmac->update(hmac, (char*) buf, MZAE_BACKEND_SAMPLE);
+				t = MZAE_now() - t;
+				if (!best || t < best)
+					best = t ? t : 1;
+			}
+			be->hmac->final(hmac, NULL);
+		}
+		be->aes->clear(aes);
+	}
+
+	MZAE_free(hmac);
+	MZAE_free(aes);
+
+	return best;
+}
+
+
+
+// Picks the fastest backend on this processor. The portable C one looks up
+// tables indexed by key and data, which leaks them through cache timing: it
+// is kept only if no other backend can run
+static void mzae_backend_pick(void)
+{
+	MZAE_SCOPE scope;
+	unsigned char* buf;
+	unsigned long long t, best = 0;
+	int i;
+
+	// Runs once for the whole process, out of the caller's scope
+	MZAE_scope_enter(NULL, NULL, &scope);
+
+	buf = (unsigned char*) MZAE_calloc(1, MZAE_BACKEND_SAMPLE);
+	for (i = MZAE_BACKEND_C + 1; buf && i < MZAE_BACKENDS; i++)
+	{
+		if (!mzae_backend_usable(i))
+			continue;
+		t = mzae_backend_time(mzae_backends[i], buf);
+		if (t && (!best || t < best))
+		{
+			best = t;
+			mzae_backend_fastest = i;
+		}
+	}
+	MZAE_free(buf);
+
+	MZAE_scope_leave(&scope);
+}
+
+
+
+int MZAE_backend(int backend)
+{
+	if (backend >= MZAE_BACKEND_AUTO && backend < MZAE_BACKENDS)
+		mzae_backend_pref = backend;
+
+	backend = mzae_backend_pref;
+
+	if (backend == MZAE_BACKEND_AUTO || !mzae_backend_usable(backend))
+	{
+		MZAE_once(&mzae_backend_once, mzae_backend_pick);
+		backend = mzae_backend_fastest;
+	}
+
+	return backend;
+}
+
+
+
+const char* MZAE_backend_name(int backend)
+{
+	if (backend == MZAE_BACKEND_AUTO)
+		return "auto";
+	if (backend < 0 || backend >= MZAE_BACKENDS || !mzae_backends[backend])
+		return NULL;
+
+	return mzae_backends[backend]->name;
+}
+
+
+
+const MZAE_BACKEND* MZAE_backend_get(void)
+{
+	return mzae_backends[MZAE_backend(-1)];
+}
+
+
+
+// Replaces the random generator, for reproducible benchmarks and tests
+static int (*mzae_salt_hook)(char* salt, int saltlen);
+
+
+
+void MZAE_salt_hook(int (*hook)(char* salt, int saltlen))
+{
+	mzae_salt_hook = hook;
+}
+
+
+
+int MZAE_gen_salt(char* salt, int saltlen)
+{
+	if (saltlen != 8 && saltlen != 12 && saltlen != 16)
+		return 1;
+
+	if (mzae_salt_hook)
+		return mzae_salt_hook(salt, saltlen);
+
+	return MZAE_backend_get()->salt(salt, saltlen);
+}
+
+
+
+int MZAE_derive_keys_into(char* password, char* salt, int saltlen, char* keys)
+{
+	if (saltlen != 8 && saltlen != 12 && saltlen != 16)
+		return 1;
+
+	if (MZAE_backend_get()->kdf(password, strlen(password), salt, saltlen, 1000, keys, 4*saltlen+2))
+		return 3;
+
+	return 0;
+}
+
+
+
+int MZAE_derive_keys(char* password, char* salt, int saltlen, char** aes_key, char** hmac_key, char** vv)
+{
+	int keylen = 2*saltlen, ret;
+	char *kdfbuf;
+
+	if (saltlen != 8 && saltlen != 12 && saltlen != 16)
+		return 1;
+
+	kdfbuf = (char*) malloc(2*keylen+2);
+	if (! kdfbuf)
+		return 2;
+
+	if ((ret = MZAE_derive_keys_into(password, salt, saltlen, kdfbuf)))
+	{
+		free(kdfbuf);
+		return ret;
+	}
+
+	*aes_key = kdfbuf;
+	*hmac_key = kdfbuf+keylen;
+	*vv = kdfbuf+2*keylen;
+
+	return 0;
+}
+
+
+
+// Counter blocks encrypted by a single call: enough to keep the AES units
+// busy with interleaved blocks
+#define MZAE_CTR_BLOCKS 32
+
+// Followed by the key schedule of the backend
+struct mzae_ctr {
+	const MZAE_AES_OPS* aes;
+	unsigned long long counter;
+	unsigned long long ctr_counter_le[2*MZAE_CTR_BLOCKS];
+	unsigned long long ctr_encrypted_counter[2*MZAE_CTR_BLOCKS];
+	unsigned int used, avail; // keystream bytes consumed and available
+};
+
+#define MZAE_CTR_SCHEDULE(c) ((void*) ((c) + 1))
+
+
+
+static MZAE_CTR* mzae_ctr_alloc(const MZAE_AES_OPS* aes)
+{
+	MZAE_CTR* c;
+
+	c = (MZAE_CTR*) MZAE_malloc(sizeof(MZAE_CTR) + aes->size);
+	if (!c)
+		return NULL;
+
+	c->aes = aes;
+	c->counter = 0;
+	c->used = c->avail = 0;
+
+	return c;
+}
+
+
+
+int MZAE_ctr_init(MZAE_CTR** ctx, char* key, unsigned int keylen)
+{
+	const MZAE_AES_OPS* aes = MZAE_backend_get()->aes;
+	MZAE_CTR* c;
+
+	if (keylen != 16 && keylen != 24 && keylen != 32)
+		return -1;
+
+	c = mzae_ctr_alloc(aes);
+	if (!c)
+		return 2;
+
+	if (aes->init(MZAE_CTR_SCHEDULE(c), key, keylen))
+	{
+		MZAE_free(c);
+		return 1;
+	}
+
+	*ctx = c;
+
+	return 0;
+}
+
+
+
+// Encrypts the next n (little endian) counter values into the keystream
+static void mzae_ctr_next(MZAE_CTR* c, unsigned int n)
+{
+	unsigned int i;
+
+	for (i = 0; i < n; i++)
+	{
+		c->ctr_counter_le[2*i] = ++c->counter;
+#ifdef BYTE_ORDER_1234
+		betole64(&c->ctr_counter_le[2*i]);
+#endif
+		c->ctr_counter_le[2*i+1] = 0;
+	}
+
+	c->aes->blocks(MZAE_CTR_SCHEDULE(c), (unsigned char*) c->ctr_counter_le, (unsigned char*) c->ctr_encrypted_counter, n);
+	c->used = 0;
+	c->avail = 16*n;
+}
+
+
+
+// Processes a buffer starting at a keystream block boundary
+static void mzae_ctr_blocks(MZAE_CTR* ctx, char* src, unsigned int srclen, char* dst)
+{
+	const char* p = (const char*) ctx->ctr_encrypted_counter;
+	const unsigned long long* q = ctx->ctr_encrypted_counter;
+	unsigned long long x;
+	unsigned int i, n;
+
+	while (srclen >= 16) {
+		n = srclen / 16;
+		if (n > MZAE_CTR_BLOCKS)
+			n = MZAE_CTR_BLOCKS;
+		mzae_ctr_next(ctx, n);
+		// Buffers may be unaligned: memcpy compiles to plain 8 byte moves
+		for (i = 0; i < 2*n; i++) {
+			memcpy(&x, src, sizeof(x));
+			x ^= q[i];
+			memcpy(dst, &x, sizeof(x));
+			dst+=sizeof(long long);
+			src+=sizeof(long long);
+		}
+		ctx->used = 16*n;
+		srclen -= 16*n;
+	}
+
+	if (srclen) {
+		mzae_ctr_next(ctx, 1);
+		while (srclen--)
+			*dst++ = *src++ ^ p[ctx->used++];
+	}
+}
+
+
+
+// Parallel CTR settings, see MZAE_ctr_threads
+static unsigned int mzae_ctr_threshold = 4 << 20;
+static unsigned int mzae_ctr_maxthreads = 0;
+
+// Smallest slice worth a thread
+#define MZAE_CTR_SLICE (256 << 10)
+
+void MZAE_ctr_threads(unsigned int threshold, unsigned int threads)
+{
+	mzae_ctr_threshold = threshold;
+	mzae_ctr_maxthreads = threads;
+}
+
+
+
+// A slice of whole blocks, with its own copy of the context and counter
+struct mzae_ctr_slice {
+	MZAE_CTR* ctr;
+	char *src, *dst;
+	unsigned int len;
+	MZAE_THREAD thread;
+};
+
+static void mzae_ctr_worker(void* arg)
+{
+	struct mzae_ctr_slice* s = (struct mzae_ctr_slice*) arg;
+	mzae_ctr_blocks(s->ctr, s->src, s->len, s->dst);
+}
+
+// Hands the leading whole blocks of a long buffer to other threads, and
+// returns how many bytes they processed
+static unsigned int mzae_ctr_parallel(MZAE_CTR* ctx, char* src, unsigned int srclen, char* dst)
+{
+	struct mzae_ctr_slice* slices;
+	unsigned int i, n, started, slice, done = 0;
+
+	n = mzae_ctr_maxthreads ? mzae_ctr_maxthreads : MZAE_ncpu();
+	if (n > srclen / MZAE_CTR_SLICE)
+		n = srclen / MZAE_CTR_SLICE;
+	if (n < 2)
+		return 0;
+
+	slices = (struct mzae_ctr_slice*) MZAE_calloc(n - 1, sizeof(struct mzae_ctr_slice));
+	if (!slices)
+		return 0;
+
+	// n-1 workers take aligned slices, this thread the remainder
+	slice = (srclen / n) & ~15;
+
+	for (i = 0; i < n - 1; i++)
+	{
+		struct mzae_ctr_slice* s = &slices[i];
+
+		s->ctr = mzae_ctr_alloc(ctx->aes);
+		if (!s->ctr)
+			break;
+		if (ctx->aes->copy(MZAE_CTR_SCHEDULE(s->ctr), MZAE_CTR_SCHEDULE(ctx)))
+		{
+			MZAE_free(s->ctr);
+			s->ctr = NULL;
+			break;
+		}
+		s->ctr->counter = ctx->counter + done / 16;
+		s->src = src + done;
+		s->dst = dst + done;
+		s->len = slice;
+		if (MZAE_thread_start(&s->thread, mzae_ctr_worker, s))
+			break;
+		done += slice;
+	}
+
+	started = i;
+	ctx->counter += done / 16;
+
+	for (i = 0; i < started; i++)
+		MZAE_thread_join(slices[i].thread);
+	for (i = 0; i < n - 1; i++)
+		MZAE_ctr_free(slices[i].ctr);
+	memset(slices, 0, (n - 1) * sizeof(struct mzae_ctr_slice));
+	MZAE_free(slices);
+
+	return done;
+}
+
+
+
+int MZAE_ctr_update(MZAE_CTR* ctx, char* src, unsigned int srclen, char* dst)
+{
+	const char* p = (const char*) ctx->ctr_encrypted_counter;
+	unsigned int n;
+
+	// Consumes the keystream left by a previous partial batch
+	while (srclen && ctx->used < ctx->avail) {
+		*dst++ = *src++ ^ p[ctx->used++];
+		srclen--;
+	}
+
+	// Keystream blocks are independent: long buffers are split among threads
+	if (srclen >= mzae_ctr_threshold && mzae_ctr_threshold) {
+		n = mzae_ctr_parallel(ctx, src, srclen, dst);
+		src += n;
+		dst += n;
+		srclen -= n;
+	}
+
+	mzae_ctr_blocks(ctx, src, srclen, dst);
+
+	return 0;
+}
+
+
+
+void MZAE_ctr_free(MZAE_CTR* ctx)
+{
+	if (!ctx)
+		return;
+	ctx->aes->clear(MZAE_CTR_SCHEDULE(ctx));
+	memset(ctx, 0, sizeof(MZAE_CTR));
+	MZAE_free(ctx);
+}
+
+
+
+void MZAE_ctr_reset(MZAE_CTR* ctx)
+{
+	ctx->counter = 0;
+	ctx->used = ctx->avail = 0;
+}
+
+
+
+int MZAE_ctr_crypt_into(char* key, unsigned int keylen, char* src, unsigned int srclen, char* dst)
+{
+	MZAE_CTR* ctx;
+	int ret;
+
+	if (!srclen)
+		return -1;
+
+	if ((ret = MZAE_ctr_init(&ctx, key, keylen)))
+		return ret;
+
+	MZAE_ctr_update(ctx, src, srclen, dst);
+	MZAE_ctr_free(ctx);
+
+	return 0;
+}
+
+
+
+int MZAE_ctr_crypt(char* key, unsigned int keylen, char* src, unsigned int srclen, char** dst)
+{
+	int ret;
+
+	if (!srclen)
+		return -1;
+
+	*dst = (char*) malloc(srclen);
+	if (! *dst)
+		return 2;
+
+	if ((ret = MZAE_ctr_crypt_into(key, keylen, src, srclen, *dst)))
+	{
+		free(*dst);
+		*dst = NULL;
+	}
+
+	return ret;
+}
+
+
+
+// Followed by the state of the backend
+struct mzae_hmac {
+	const MZAE_HMAC_OPS* ops;
+};
+
+#define MZAE_HMAC_STATE(h) ((void*) ((h) + 1))
+
+
+
+int MZAE_hmac_init(MZAE_HMAC** ctx, char* key, unsigned int keylen)
+{
+	const MZAE_HMAC_OPS* ops = MZAE_backend_get()->hmac;
+	MZAE_HMAC* h;
+
+	if (!keylen)
+		return -1;
+
+	h = (MZAE_HMAC*) MZAE_malloc(sizeof(MZAE_HMAC) + ops->size);
+	if (!h)
+		return 2;
+
+	h->ops = ops;
+	if (ops->init(MZAE_HMAC_STATE(h), key, keylen))
+	{
+		MZAE_free(h);
+		return 1;
+	}
+	*ctx = h;
+
+	return 0;
+}
+
+
+
+int MZAE_hmac_update(MZAE_HMAC* ctx, char* src, unsigned int srclen)
+{
+	ctx->ops->update(MZAE_HMAC_STATE(ctx), src, srclen);
+
+	return 0;
+}
+
+
+
+int MZAE_hmac_reset(MZAE_HMAC* ctx)
+{
+	ctx->ops->reset(MZAE_HMAC_STATE(ctx));
+
+	return 0;
+}
+
+
+
+int MZAE_hmac_final(MZAE_HMAC* ctx, char* hmac)
+{
+	ctx->ops->final(MZAE_HMAC_STATE(ctx), hmac);
+	ctx->ops = NULL;
+	MZAE_free(ctx);
+
+	return 0;
+}
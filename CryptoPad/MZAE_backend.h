@@ -0,0 +1,91 @@
+/*
+ *  Copyright (C) 2016-2023  maxpat78 <https://github.com/maxpat78>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+   MZAE_backend.h
+
+   Cryptographic backends: the primitives behind MZAE_gen_salt,
+   MZAE_derive_keys, MZAE_ctr_* and MZAE_hmac_*, selected at run time with
+   MZAE_backend. Each backend combines a random source, a PBKDF2, an AES
+   block cipher and an HMAC-SHA1; the generic CTR mode and the object
+   bookkeeping are in MZAE_backend.c.
+*/
+
+#if !defined(__MZAE_BACKEND__)
+#define __MZAE_BACKEND__
+
+#include <mZipAES.h>
+#include <stddef.h>
+
+# ifdef  __cplusplus
+extern "C" {
+# endif
+
+// AES encryption of whole blocks, with a key schedule of size bytes
+typedef struct {
+	size_t size;
+	int (*usable)(void); // NULL if always usable
+	int (*init)(void* aes, char* key, unsigned int keylen);
+	int (*copy)(void* dst, void* src); // for another thread
+	void (*blocks)(void* aes, const unsigned char* src, unsigned char* dst, unsigned int blocks);
+	void (*clear)(void* aes); // releases and wipes
+} MZAE_AES_OPS;
+
+// Streaming HMAC-SHA1, with a state of size bytes
+typedef struct {
+	size_t size;
+	int (*init)(void* hmac, char* key, unsigned int keylen);
+	void (*update)(void* hmac, char* src, unsigned int srclen);
+	void (*reset)(void* hmac);
+	void (*final)(void* hmac, char* digest); // digest may be NULL; wipes
+} MZAE_HMAC_OPS;
+
+typedef struct {
+	const char* name;
+	int (*salt)(char* salt, int saltlen);
+	int (*kdf)(char* password, unsigned int pwlen, char* salt, unsigned int saltlen, unsigned int iterations, char* key, unsigned int keylen);
+	const MZAE_AES_OPS* aes;
+	const MZAE_HMAC_OPS* hmac;
+} MZAE_BACKEND;
+
+
+/*
+	Returns the backend in use, selecting it at the first call.
+*/
+const MZAE_BACKEND* MZAE_backend_get(void);
+
+
+// Portable AES (MZAE_aes.c), and the same with the AES-NI instructions
+extern const MZAE_AES_OPS MZAE_aes_c;
+extern const MZAE_AES_OPS MZAE_aes_ni;
+
+// HMAC-SHA1 on the built-in SHA-1 kernels (MZAE_sha1.c)
+extern const MZAE_HMAC_OPS MZAE_hmac_builtin;
+
+#ifndef MZAE_NO_OPENSSL
+// OpenSSL random generator, AES and HMAC (MZAE_openssl.c)
+int MZAE_openssl_salt(char* salt, int saltlen);
+extern const MZAE_AES_OPS MZAE_aes_openssl;
+extern const MZAE_HMAC_OPS MZAE_hmac_openssl;
+#endif
+
+# ifdef  __cplusplus
+}
+# endif
+
+#endif // __MZAE_BACKEND__
@@ -0,0 +1,833 @@
+/*
+ *  Copyright (C) 2016-2023  maxpat78 <https://github.com/maxpat78>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+  Throughput benchmark for the MZAE functions and the CryptoPad text helpers.
+
+  It is not part of the CryptoPad application; build it with the library
+  sources, i.e.:
+
+    cc -O2 -I. MZAE_bench.c MZAE_aes.c MZAE_alloc.c MZAE_backend.c MZAE_cpu.c \
+       MZAE_crc32.c MZAE_libdeflate.c MZAE_memrev.c MZAE_minizip.c \
+       MZAE_openssl.c MZAE_prekey.c MZAE_sha1.c MZAE_stats.c MZAE_thread.c \
+       MZAE_zlib.c TextUtils.c -lcrypto -lz -lpthread
+
+  adding -DMZAE_LIBDEFLATE and -ldeflate to compare the libdeflate codec.
+
+  Usage: MZAE_bench [options]
+
+    -s sizes        document sizes, i.e. 1K,64K,1M,16M (the default); K, M
+                    and G suffixes allowed, up to 1G
+    -c contents     prose, logs, random, base64 and/or mixed (prose with
+                    pasted base64 and binary blocks) (default: all)
+    -S stages       stages to run (default: all, see below)
+    -f format       text (default), csv or json (one object per line)
+    -d seed         deterministic salts, derived from seed, so that archives
+                    are identical across runs and can be compared
+    -t seconds      minimum time spent on each measurement (default 0.5)
+    -a size         serve the scratch memory of write and read from an arena
+                    of that size (i.e. 1M)
+    -C codec        Deflate codec: zlib or libdeflate (default: the fastest
+                    built in); compare the two on deflate, inflate, write
+                    (level 8), write-fast (level 1), write-max (level 9) and
+                    read
+    -j threads      threads deflating documents of 1M or more in slices, in
+                    deflate and write* (default: one per processor; 1 runs
+                    the codec alone)
+
+  Stages:
+    crc, deflate, inflate, ctr (with the fastest backend and with each one),
+    hmac (with each SHA-1 kernel and OpenSSL),
+    kdf (MZAE_derive_keys, whatever the size), write and read (the fused
+    MiniZipAEWrite and MiniZipAERead), write-fast and write-max (with the
+    other write profiles), write-deflate (always trying Deflate, with no
+    sampling of the input), entropy (the sampling alone), write-indexed and
+    read-indexed (with sync points every 1M, whose segments are inflated on
+    the -j threads), write-v2 and read-v2 (reversing the document on the
+    way, as CryptoPad does), write-multipass and read-multipass (the former
+    sequence of whole buffer passes, which streams the document through
+    memory once per stage), memrev and memrev-bytes (MZAE_memrev in place,
+    and the former byte loop), detect-eol, convert-eol.
+
+  Each measurement is repeated for at least the minimum time; the best round
+  is reported, with the output size and its CRC-32 where there is an output
+  (the CRC of archives is only stable with -d).
+*/
+#include <mZipAES.h>
+#include <TextUtils.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+
+#ifdef _WIN32
+#include <windows.h>
+static double now(void)
+{
+	LARGE_INTEGER f, c;
+	QueryPerformanceFrequency(&f);
+	QueryPerformanceCounter(&c);
+	return (double) c.QuadPart / f.QuadPart;
+}
+#else
+#include <time.h>
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+#endif
+
+static char* password = "kazookazaa";
+
+// Fixed AES and HMAC key for the single stage benchmarks
+static char key[32] = "0123456789ABCDEF0123456789ABCDE";
+
+static enum { FMT_TEXT, FMT_CSV, FMT_JSON } format;
+static double min_time = 0.5;
+static unsigned long salt_seed, salt_base; // with -d, every round restarts from salt_base
+static MZAE_OPTIONS options; // of the fused write and read
+
+
+
+// Fills a buffer with pseudo random words, compressing like prose
+static void gen_prose(char* buf, unsigned long len)
+{
+	unsigned long i = 0, seed = 12345, w, n;
+
+	while (i < len)
+	{
+		// Skewed choice among 4096 words of 2-9 letters
+		seed = (seed * 1103515245 + 12345) & 0xFFFFFFFF;
+		w = ((seed >> 8) & 0xFFF) * ((seed >> 20) & 0xFFF) >> 12;
+		n = 2 + w % 8;
+		while (n-- && i < len)
+		{
+			w = w * 31 + 7;
+			buf[i++] = 'a' + (char)((w >> 4) % 26);
+		}
+		if (i < len)
+			buf[i++] = (seed >> 28) == 0 ? '\n' : ' ';
+	}
+}
+
+
+
+// Fills a buffer with CR-LF ended log lines, highly repetitive
+static void gen_logs(char* buf, unsigned long len)
+{
+	static const char* levels[] = {"INFO", "INFO", "INFO", "DEBUG", "WARN", "ERROR"};
+	static const char* verbs[] = {"GET", "POST", "PUT", "DELETE"};
+	unsigned long i = 0, seed = 54321, t = 1700000000;
+	char line[160];
+	int n;
+
+	while (i < len)
+	{
+		seed = (seed * 1103515245 + 12345) & 0xFFFFFFFF;
+		t += (seed >> 16) % 3;
+		n = sprintf(line, "%lu.%03lu %-5s [worker-%lu] %s /api/v1/notes/%lu status=%d took %lu ms\r\n",
+			t, (seed >> 8) % 1000, levels[(seed >> 12) % 6], (seed >> 20) % 16,
+			verbs[(seed >> 24) % 4], (seed >> 4) % 100000, (seed >> 28) ? 200 : 404, (seed >> 6) % 500);
+		if ((unsigned long) n > len - i)
+			n = (int)(len - i);
+		memcpy(buf + i, line, n);
+		i += n;
+	}
+}
+
+
+
+// Fills a buffer with incompressible bytes
+static void gen_random(char* buf, unsigned long len)
+{
+	unsigned long long x = 88172645463325252ULL;
+	unsigned long i;
+
+	for (i = 0; i < len; i++)
+	{
+		x ^= x << 13;
+		x ^= x >> 7;
+		x ^= x << 17;
+		buf[i] = (char)(x >> 32);
+	}
+}
+
+
+
+// Fills a buffer with random bytes in base64, 76 characters per line
+static void gen_base64(char* buf, unsigned long len)
+{
+	static const char digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	unsigned long long x = 2463534242ULL;
+	unsigned long i;
+
+	for (i = 0; i < len; i++)
+	{
+		x ^= x << 13;
+		x ^= x >> 7;
+		x ^= x << 17;
+		buf[i] = i % 78 == 76 ? '\r' : i % 78 == 77 ? '\n' : digits[(x >> 32) & 63];
+	}
+}
+
+
+
+// Fills a buffer with prose, interleaved with pasted base64 and binary
+// blocks, taking a quarter each
+static void gen_mixed(char* buf, unsigned long len)
+{
+	unsigned long i, n;
+
+	gen_prose(buf, len);
+	for (i = 0; i < len; i += 4*16384)
+	{
+		n = len - i < 16384 ? len - i : 16384;
+		gen_base64(buf + i, n);
+		if (len - i > 2*16384)
+			gen_random(buf + i + 2*16384, len - i - 2*16384 < 16384 ? len - i - 2*16384 : 16384);
+	}
+}
+
+
+
+static int bench_salt(char* salt, int saltlen)
+{
+	int i;
+
+	for (i = 0; i < saltlen; i++)
+	{
+		salt_seed = (salt_seed * 1103515245 + 12345) & 0xFFFFFFFF;
+		salt[i] = (char)(salt_seed >> 16);
+	}
+
+	return 0;
+}
+
+
+
+// The document and the buffers shared by all stages
+struct bench {
+	const char* content;
+	char *src, *zip, *out, *z;
+	char *wzip; // written by the write stages, in any profile
+	char *izip; // with a sync point index
+	unsigned long len, ziplen, wziplen, iziplen, zlen;
+	TCHAR *text, *eol; // src as a NULL terminated TCHAR string, and converted
+	unsigned int textsize, eolsize, cCR, cLF, cCRLF, srceol;
+	unsigned long outlen, outcrc; // last round output
+};
+
+
+
+static int st_crc(struct bench* b)
+{
+	b->outcrc = MZAE_crc(0, b->src, b->len);
+	return 0;
+}
+
+
+
+static int st_deflate(struct bench* b)
+{
+	char* z;
+	unsigned int zlen;
+
+	if (MZAE_deflate(b->src, b->len, &z, &zlen))
+		return 1;
+	b->outlen = zlen;
+	b->outcrc = MZAE_crc(0, z, zlen);
+	free(z);
+
+	return 0;
+}
+
+
+
+static int st_inflate(struct bench* b)
+{
+	return MZAE_inflate(b->z, b->zlen, b->out, b->len);
+}
+
+
+
+static int st_ctr(struct bench* b)
+{
+	if (MZAE_ctr_crypt_into(key, 32, b->src, b->len, b->out))
+		return 1;
+	b->outlen = b->len;
+
+	return 0;
+}
+
+
+
+static int st_hmac(struct bench* b)
+{
+	char* hmac;
+
+	if (MZAE_hmac_sha1_80(key, 32, b->src, b->len, &hmac))
+		return 1;
+	b->outlen = 10;
+	b->outcrc = MZAE_crc(0, hmac, 10);
+
+	return 0;
+}
+
+
+
+static int st_hmac_openssl(struct bench* b)
+{
+	unsigned char digest[20];
+	unsigned int dlen;
+
+	if (!HMAC(EVP_sha1(), key, 32, (unsigned char*) b->src, b->len, digest, &dlen))
+		return 1;
+	b->outlen = 10;
+	b->outcrc = MZAE_crc(0, (char*) digest, 10);
+
+	return 0;
+}
+
+
+
+static int st_kdf(struct bench* b)
+{
+	char salt[16], *aes_key, *hmac_key, *vv;
+
+	memset(salt, 0x5A, 16);
+	if (MZAE_derive_keys(password, salt, 16, &aes_key, &hmac_key, &vv))
+		return 1;
+	b->outlen = 66;
+	b->outcrc = MZAE_crc(0, aes_key, 66);
+	free(aes_key);
+
+	return 0;
+}
+
+
+
+static int st_write(struct bench* b)
+{
+	unsigned long n = b->wziplen;
+
+	if (MiniZipAEWriteEx(b->src, b->len, &b->wzip, &n, password, &options))
+		return 1;
+	b->outlen = n;
+	b->outcrc = MZAE_crc(0, b->wzip, n);
+
+	return 0;
+}
+
+
+
+static int st_entropy(struct bench* b)
+{
+	// Reported in thousandths of bit per byte, as the output CRC
+	b->outcrc = (unsigned long)(MZAE_entropy(b->src, b->len) * 1000);
+
+	return 0;
+}
+
+
+
+static int st_read(struct bench* b)
+{
+	unsigned long n = b->len;
+
+	if (MiniZipAEReadEx(b->zip, b->ziplen, &b->out, &n, password, &options))
+		return 1;
+	b->outlen = n;
+
+	return 0;
+}
+
+
+
+static int st_read_indexed(struct bench* b)
+{
+	unsigned long n = b->len;
+
+	if (MiniZipAEReadEx(b->izip, b->iziplen, &b->out, &n, password, &options))
+		return 1;
+	b->outlen = n;
+
+	return 0;
+}
+
+
+
+// The write path before the fused engine: one pass over memory per stage
+static int st_write_multipass(struct bench* b)
+{
+	char salt[16];
+	char *aes_key, *hmac_key, *vv, *z, *c, *digest;
+	unsigned int zlen;
+	unsigned long crc;
+
+	if (MZAE_gen_salt(salt, 16) || MZAE_derive_keys(password, salt, 16, &aes_key, &hmac_key, &vv))
+		return 1;
+	crc = MZAE_crc(0, b->src, b->len);
+	if (MZAE_deflate(b->src, b->len, &z, &zlen))
+		return 1;
+	if (MZAE_ctr_crypt(aes_key, 32, z, zlen, &c))
+		return 1;
+	if (MZAE_hmac_sha1_80(hmac_key, 32, c, zlen, &digest))
+		return 1;
+	memcpy(b->out + 63, c, zlen);
+	memcpy(b->out + 63 + zlen, digest, 10);
+	memcpy(b->out + 14, &crc, 4);
+	free(z);
+	free(c);
+	free(aes_key);
+
+	return 0;
+}
+
+
+
+// The read path before the fused engine
+static int st_read_multipass(struct bench* b)
+{
+	char *aes_key, *hmac_key, *vv, *p, *digest, *src = b->zip;
+	unsigned int compSize = *((unsigned int*)(src + 18)) - 28;
+
+	// Only Deflated archives (Stored ones are skipped)
+	if (src[43] != 8)
+		return -1;
+	if (MZAE_derive_keys(password, src + 45, 16, &aes_key, &hmac_key, &vv))
+		return 1;
+	if (MZAE_hmac_sha1_80(hmac_key, 32, src + 63, compSize, &digest) || memcmp(digest, src + 63 + compSize, 10))
+		return 1;
+	if (MZAE_ctr_crypt(aes_key, 32, src + 63, compSize, &p))
+		return 1;
+	if (MZAE_inflate(p, compSize, b->out, b->len))
+		return 1;
+	if (src[38] == 1 && MZAE_crc(0, b->out, b->len) != *((unsigned int*)(src + 14)))
+		return 1;
+	free(p);
+	free(aes_key);
+
+	return 0;
+}
+
+
+
+static int st_memrev(struct bench* b)
+{
+	MZAE_memrev(b->src, b->src, b->len);
+	return 0;
+}
+
+
+
+// The reversal before MZAE_memrev, a byte at a time
+static int st_memrev_bytes(struct bench* b)
+{
+	unsigned char* t = (unsigned char*) b->src;
+	unsigned char* e = t + b->len - 1;
+	unsigned char c;
+
+	while (e > t)
+	{
+		c = *t;
+		*t++ = *e;
+		*e-- = c;
+	}
+
+	return 0;
+}
+
+
+
+static int st_detect_eol(struct bench* b)
+{
+	UINT cr, lf, crlf;
+
+	b->outcrc = DetectEOL(b->text, &cr, &lf, &crlf);
+	return 0;
+}
+
+
+
+static int st_convert_eol(struct bench* b)
+{
+	if (!b->eol)
+		return -1;
+	if (ConvertEOL(b->text, b->textsize, b->srceol, b->eol, b->eolsize, EOL_CRLF, b->cCR, b->cLF, b->cCRLF))
+		return 1;
+	b->outlen = b->eolsize;
+
+	return 0;
+}
+
+
+
+// kdf does not depend on the document; text stages need its TCHAR copy;
+// hmac ones select a SHA-1 kernel first, ctr ones a backend, write ones a
+// profile, a method or sync points, v2 ones reverse the document
+enum { NEED_DOC, NEED_TEXT, NEED_ONCE };
+
+// Sync points of the indexed stages
+#define BENCH_SYNC (1UL << 20)
+
+static struct stage {
+	const char* name;
+	int (*run)(struct bench*);
+	int need, kernel, backend, profile, method;
+	unsigned long sync;
+	int reverse;
+} stages[] = {
+	{"crc", st_crc, NEED_DOC, 0},
+	{"deflate", st_deflate, NEED_DOC, 0},
+	{"inflate", st_inflate, NEED_DOC, 0},
+	{"ctr", st_ctr, NEED_DOC, 0},
+	{"ctr-c", st_ctr, NEED_DOC, 0, MZAE_BACKEND_C},
+	{"ctr-aesni", st_ctr, NEED_DOC, 0, MZAE_BACKEND_AESNI},
+	{"ctr-openssl", st_ctr, NEED_DOC, 0, MZAE_BACKEND_OPENSSL},
+	{"hmac-c", st_hmac, NEED_DOC, MZAE_SHA1_C},
+	{"hmac-ssse3", st_hmac, NEED_DOC, MZAE_SHA1_SSSE3},
+	{"hmac-shani", st_hmac, NEED_DOC, MZAE_SHA1_SHANI},
+	{"hmac-openssl", st_hmac_openssl, NEED_DOC, 0},
+	{"kdf", st_kdf, NEED_ONCE, 0},
+	{"write", st_write, NEED_DOC, 0},
+	{"write-fast", st_write, NEED_DOC, 0, 0, MZAE_PROFILE_FAST},
+	{"write-max", st_write, NEED_DOC, 0, 0, MZAE_PROFILE_MAX},
+	{"write-deflate", st_write, NEED_DOC, 0, 0, 0, MZAE_METHOD_DEFLATE},
+	{"entropy", st_entropy, NEED_DOC, 0},
+	{"read", st_read, NEED_DOC, 0},
+	{"write-indexed", st_write, NEED_DOC, 0, 0, 0, 0, BENCH_SYNC},
+	{"read-indexed", st_read_indexed, NEED_DOC, 0},
+	{"write-v2", st_write, NEED_DOC, 0, 0, 0, 0, 0, 1},
+	{"read-v2", st_read, NEED_DOC, 0, 0, 0, 0, 0, 1},
+	{"write-multipass", st_write_multipass, NEED_DOC, 0},
+	{"read-multipass", st_read_multipass, NEED_DOC, 0},
+	{"memrev", st_memrev, NEED_DOC, 0},
+	{"memrev-bytes", st_memrev_bytes, NEED_DOC, 0},
+	{"detect-eol", st_detect_eol, NEED_TEXT, 0},
+	{"convert-eol", st_convert_eol, NEED_TEXT, 0},
+};
+
+#define NSTAGES (sizeof(stages) / sizeof(stages[0]))
+
+// Text helpers take 32-bit sizes and twice the memory
+#define TEXT_MAX (256UL << 20)
+
+
+
+static void report(struct stage* s, struct bench* b, int rounds, double best)
+{
+	unsigned long len = s->need == NEED_ONCE ? 0 : b->len;
+	double mbs = len && best > 0 ? len / best / 1048576 : 0;
+	const char* content = s->need == NEED_ONCE ? "-" : b->content;
+
+	switch (format)
+	{
+	case FMT_CSV:
+		printf("%s,%s,%lu,%d,%.9f,%.2f,%lu,%08lx\n", s->name, content, len, rounds, best, mbs, b->outlen, b->outcrc);
+		break;
+	case FMT_JSON:
+		printf("{\"stage\":\"%s\",\"content\":\"%s\",\"bytes\":%lu,\"rounds\":%d,\"seconds\":%.9f,"
+			"\"mb_s\":%.2f,\"out_bytes\":%lu,\"out_crc\":\"%08lx\"}\n",
+			s->name, content, len, rounds, best, mbs, b->outlen, b->outcrc);
+		break;
+	default:
+		if (s->need == NEED_ONCE)
+			printf("%-16s %-7s %11s %9.3f ms/op\n", s->name, content, "-", best * 1e3);
+		else
+			printf("%-16s %-7s %11lu %9.1f MB/s\n", s->name, content, len, mbs);
+	}
+	fflush(stdout);
+}
+
+
+
+// Repeats a stage for at least min_time, and keeps its best round
+static int measure(struct stage* s, struct bench* b)
+{
+	double t, start = now(), best = 0;
+	int rounds = 0, ret;
+
+	if (s->kernel && MZAE_sha1_kernel(s->kernel) != s->kernel)
+		return 0;
+	if (s->backend && MZAE_backend(s->backend) != s->backend)
+	{
+		MZAE_backend(MZAE_BACKEND_AUTO);
+		return 0;
+	}
+
+	options.profile = s->profile;
+	options.method = s->method;
+	options.sync = s->sync;
+	options.reverse = s->reverse;
+	b->outlen = b->outcrc = 0;
+	do {
+		salt_seed = salt_base;
+		t = now();
+		ret = s->run(b);
+		t = now() - t;
+		if (ret)
+			break;
+		if (!rounds++ || t < best)
+			best = t;
+	} while (now() - start < min_time);
+
+	if (s->kernel)
+		MZAE_sha1_kernel(MZAE_SHA1_AUTO);
+	if (s->backend)
+		MZAE_backend(MZAE_BACKEND_AUTO);
+	options.profile = MZAE_PROFILE_BALANCED;
+	options.method = MZAE_METHOD_AUTO;
+	options.sync = 0;
+	options.reverse = 0;
+
+	if (ret > 0)
+	{
+		fprintf(stderr, "%s failed on %s, %lu bytes\n", s->name, b->content, b->len);
+		return 1;
+	}
+	if (!ret)
+		report(s, b, rounds, best);
+
+	return 0;
+}
+
+
+
+// Prepares the compressed data, the archive and the text copies of a document
+static int prepare(struct bench* b, int text)
+{
+	MZAE_OPTIONS indexed = {0};
+	unsigned long i, n = 0;
+	unsigned int zlen;
+
+	if (MZAE_deflate(b->src, b->len, &b->z, &zlen))
+		return 1;
+	b->zlen = zlen;
+
+	// Random data grow when deflated
+	b->out = (char*) malloc((b->len > zlen ? b->len : zlen) + 200);
+	b->zip = (char*) malloc(b->len + 200);
+	if (!b->out || !b->zip)
+		return 1;
+
+	if (MiniZipAEWrite(b->src, b->len, &b->zip, &n, password))
+		return 1;
+	b->ziplen = n;
+	if (MiniZipAEWrite(b->src, b->len, &b->zip, &b->ziplen, password))
+		return 1;
+
+	// The index makes room for itself in the upper bound
+	indexed.sync = BENCH_SYNC;
+	n = 0;
+	if (MiniZipAEWriteEx(b->src, b->len, &b->izip, &n, password, &indexed))
+		return 1;
+	b->izip = (char*) malloc(n);
+	b->wzip = (char*) malloc(n);
+	if (!b->izip || !b->wzip)
+		return 1;
+	b->iziplen = b->wziplen = n;
+	if (MiniZipAEWriteEx(b->src, b->len, &b->izip, &b->iziplen, password, &indexed))
+		return 1;
+
+	if (!text || b->len >= TEXT_MAX)
+		return 0;
+
+	// NUL bytes would end the string early
+	b->textsize = (unsigned int)((b->len + 1) * sizeof(TCHAR));
+	b->text = (TCHAR*) malloc(b->textsize);
+	if (!b->text)
+		return 1;
+	for (i = 0; i < b->len; i++)
+		b->text[i] = b->src[i] ? (unsigned char) b->src[i] : ' ';
+	b->text[i] = 0;
+
+	b->srceol = DetectEOL(b->text, &b->cCR, &b->cLF, &b->cCRLF);
+	if (b->srceol != EOL_CRLF && b->srceol != EOL_NONE)
+	{
+		b->eolsize = ConvertEOL(b->text, b->textsize, b->srceol, NULL, 0, EOL_CRLF, b->cCR, b->cLF, b->cCRLF);
+		b->eol = (TCHAR*) malloc(b->eolsize);
+		if (!b->eol)
+			return 1;
+	}
+
+	return 0;
+}
+
+
+
+static void release(struct bench* b)
+{
+	free(b->out);
+	free(b->zip);
+	free(b->wzip);
+	free(b->izip);
+	free(b->z);
+	free(b->text);
+	free(b->eol);
+	b->out = b->zip = b->wzip = b->izip = b->z = NULL;
+	b->text = b->eol = NULL;
+}
+
+
+
+static unsigned long parse_size(char* s, char** end)
+{
+	unsigned long n = strtoul(s, end, 10);
+
+	switch (**end)
+	{
+	case 'G': case 'g': n <<= 10;
+	case 'M': case 'm': n <<= 10;
+	case 'K': case 'k': n <<= 10;
+		(*end)++;
+	}
+
+	return n;
+}
+
+
+
+// Tells whether name is in a comma separated list (a NULL list has all)
+static int listed(const char* list, const char* name)
+{
+	size_t n = strlen(name);
+	const char* p;
+
+	if (!list)
+		return 1;
+	for (p = list; (p = strstr(p, name)); p += n)
+		if ((p == list || p[-1] == ',') && (p[n] == ',' || !p[n]))
+			return 1;
+
+	return 0;
+}
+
+
+
+int main(int argc, char** argv)
+{
+	static struct { const char* name; void (*gen)(char*, unsigned long); } contents[] = {
+		{"prose", gen_prose}, {"logs", gen_logs}, {"random", gen_random},
+		{"base64", gen_base64}, {"mixed", gen_mixed}
+	};
+	char *size_list = "1K,64K,1M,16M", *content_list = NULL, *stage_list = NULL, *p;
+	int selected[NSTAGES], text = 0, c, i, ret = 0;
+	struct bench b;
+
+	for (i = 1; i < argc; i++)
+	{
+		if (argv[i][0] != '-' || !argv[i][1] || argv[i][2] || i + 1 == argc || !strchr("scSdtfaCj", argv[i][1]))
+		{
+			fprintf(stderr, "Usage: MZAE_bench [-s sizes] [-c contents] [-S stages] [-f text|csv|json] [-d seed] [-t seconds] [-a size] [-C codec] [-j threads]\n");
+			return 2;
+		}
+		switch (argv[i][1])
+		{
+		case 's': size_list = argv[++i]; break;
+		case 'c': content_list = argv[++i]; break;
+		case 'S': stage_list = argv[++i]; break;
+		case 'd': salt_base = strtoul(argv[++i], NULL, 10); MZAE_salt_hook(bench_salt); break;
+		case 't': min_time = atof(argv[++i]); break;
+		case 'j':
+			c = atoi(argv[++i]);
+			MZAE_deflate_threads(c == 1 ? 0 : 1 << 20, c);
+			break;
+		case 'C':
+			for (c = MZAE_CODEC_ZLIB; c < MZAE_CODECS; c++)
+				if (MZAE_codec_name(c) && !strcmp(argv[i + 1], MZAE_codec_name(c)))
+					break;
+			if (c == MZAE_CODECS)
+			{
+				fprintf(stderr, "Codec not built in: %s\n", argv[i + 1]);
+				return 2;
+			}
+			MZAE_codec(c);
+			i++;
+			break;
+		case 'a':
+			if (MZAE_arena_init(&options.arena, parse_size(argv[++i], &p), 0))
+			{
+				fprintf(stderr, "Can't create the arena\n");
+				return 1;
+			}
+			break;
+		case 'f':
+			i++;
+			format = !strcmp(argv[i], "csv") ? FMT_CSV : !strcmp(argv[i], "json") ? FMT_JSON : FMT_TEXT;
+			break;
+		}
+	}
+
+	// "hmac" selects all its variants
+	for (i = 0; i < (int) NSTAGES; i++)
+	{
+		selected[i] = listed(stage_list, stages[i].name) ||
+			(!strncmp(stages[i].name, "hmac-", 5) && listed(stage_list, "hmac"));
+		if (selected[i] && stages[i].need == NEED_TEXT)
+			text = 1;
+	}
+
+	if (format == FMT_CSV)
+		printf("stage,content,bytes,rounds,seconds,mb_s,out_bytes,out_crc\n");
+
+	memset(&b, 0, sizeof(b));
+	for (i = 0; i < (int) NSTAGES; i++)
+		if (selected[i] && stages[i].need == NEED_ONCE)
+			ret |= measure(&stages[i], &b);
+
+	for (c = 0; c < (int)(sizeof(contents) / sizeof(contents[0])); c++)
+	{
+		if (!listed(content_list, contents[c].name))
+			continue;
+		b.content = contents[c].name;
+
+		for (p = size_list; *p; p += *p == ',')
+		{
+			b.len = parse_size(p, &p);
+			if (!b.len || b.len > (1UL << 30) || (*p && *p != ','))
+			{
+				fprintf(stderr, "Bad size: from 1 byte to 1G\n");
+				return 2;
+			}
+
+			b.src = (char*) malloc(b.len);
+			if (!b.src)
+				return 1;
+			contents[c].gen(b.src, b.len);
+			if (prepare(&b, text))
+			{
+				fprintf(stderr, "Can't prepare %s, %lu bytes\n", b.content, b.len);
+				return 1;
+			}
+
+			for (i = 0; i < (int) NSTAGES; i++)
+				if (selected[i] && stages[i].need != NEED_ONCE && (stages[i].need != NEED_TEXT || b.text))
+					ret |= measure(&stages[i], &b);
+
+			release(&b);
+			free(b.src);
+		}
+	}
+
+	MZAE_arena_free(options.arena);
+
+	return ret;
+}
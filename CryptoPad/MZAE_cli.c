@@ -0,0 +1,663 @@
+/*
+ *  Copyright (C) 2016-2023  maxpat78 <https://github.com/maxpat78>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+  mzae: encrypts, decrypts, verifies and re-keys CryptoPad documents in bulk.
+
+  It is not part of the CryptoPad application, and targets Linux and other
+  POSIX systems; build it with the library sources, i.e.:
+
+    cc -O2 -I. -o mzae MZAE_cli.c MZAE_aes.c MZAE_alloc.c MZAE_backend.c \
+       MZAE_cpu.c MZAE_crc32.c MZAE_libdeflate.c MZAE_memrev.c MZAE_minizip.c \
+       MZAE_openssl.c MZAE_prekey.c MZAE_sha1.c MZAE_stats.c MZAE_thread.c \
+       MZAE_zlib.c -lcrypto -lz -lpthread
+
+  (add -DMZAE_LIBDEFLATE and -ldeflate for the faster libdeflate codec).
+
+  Usage: mzae [options] encrypt|decrypt|verify|rekey path...
+
+    -p password     password (default: $MZAE_PASSWORD)
+    -n password     new password for rekey (default: $MZAE_NEWPASSWORD)
+    -j threads      files processed at once (default: one per processor)
+    -o dir          writes results into dir, mirroring the source tree,
+                    instead of replacing the sources
+    -P profile      write profile: balanced (the default), fast or max
+    -I size         indexes sync points every size MB, so that large
+                    documents are inflated on all processors (default: 0,
+                    no index)
+    -q              prints the totals only
+
+  Directories are walked recursively. Every file is processed in memory and
+  replaces the source atomically, keeping its permissions; files already in
+  the requested state (i.e. encrypted ones, for encrypt) are skipped.
+
+  Encrypted documents are written in V2 format, like CryptoPad does; both V1
+  and V2 are read. Plaintext is treated as bytes: CryptoPad detects its
+  encoding when opening.
+
+  A single "-" path streams standard input to standard output. encrypt and
+  verify then run in constant memory (encrypt emits a V1 document, with a
+  data descriptor); decrypt and rekey hold the document, so that no
+  unauthenticated plaintext is ever output.
+
+  Exits with 0 if all files succeeded, 1 if any failed, 2 on bad usage.
+*/
+#define _XOPEN_SOURCE 700
+#include <mZipAES.h>
+#include <MZAE_thread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+enum { OP_ENCRYPT, OP_DECRYPT, OP_VERIFY, OP_REKEY };
+
+static const char* op_names[] = {"encrypt", "decrypt", "verify", "rekey"};
+static const char* op_done[] = {"encrypted", "decrypted", "verified", "re-keyed"};
+
+// Options
+static int op = -1;
+static char *password, *new_password, *out_dir;
+static int quiet, profile;
+static unsigned long sync_size;
+
+// A file to process, and where its result goes
+struct job {
+	char* path;
+	char* dest; // NULL to replace path
+};
+
+static struct job* jobs;
+static unsigned long njobs, maxjobs;
+
+// Walk state: root being walked, and the length of its prefix to drop
+static const char* walk_root;
+static size_t walk_root_len;
+
+// Shared among workers, updated atomically
+static unsigned long next_job;
+static unsigned long long total_in, total_out;
+static unsigned long done_files, skipped_files, failed_files;
+
+struct worker {
+	MZAE_THREAD thread;
+	MZAE_PREKEY* prekey; // keys for the next document encrypted
+	MZAE_ARENA* arena; // scratch memory of its documents, or NULL
+};
+
+
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+
+// Same test as CryptoPad: encrypted documents are ZIP archives
+static int is_document(char* buf, unsigned long len)
+{
+	return len > 4 && !memcmp(buf, "PK\3\4", 4);
+}
+
+
+
+static int add_job(const char* path, const char* dest)
+{
+	if (njobs == maxjobs)
+	{
+		struct job* j;
+		maxjobs = maxjobs ? maxjobs * 2 : 256;
+		j = (struct job*) realloc(jobs, maxjobs * sizeof(struct job));
+		if (!j)
+			return 1;
+		jobs = j;
+	}
+
+	jobs[njobs].path = strdup(path);
+	jobs[njobs].dest = dest ? strdup(dest) : NULL;
+	if (!jobs[njobs].path || (dest && !jobs[njobs].dest))
+		return 1;
+	njobs++;
+
+	return 0;
+}
+
+
+
+// Mirrors path, found under walk_root, into out_dir
+static int walk_add(const char* path)
+{
+	const char* rel = path + walk_root_len;
+	char* dest;
+	int ret;
+
+	if (!out_dir)
+		return add_job(path, NULL);
+
+	while (*rel == '/')
+		rel++;
+	dest = (char*) malloc(strlen(out_dir) + strlen(rel) + 2);
+	if (!dest)
+		return 1;
+	sprintf(dest, "%s/%s", out_dir, rel);
+	ret = add_job(path, dest);
+	free(dest);
+
+	return ret;
+}
+
+
+
+static int walk_entry(const char* path, const struct stat* st, int type, struct FTW* ftw)
+{
+	if (type == FTW_F && S_ISREG(st->st_mode))
+		return walk_add(path) ? -1 : 0;
+	if (type == FTW_DNR || type == FTW_NS)
+		fprintf(stderr, "%s: can't access\n", path);
+
+	return 0;
+}
+
+
+
+// Queues a file, or all files below a directory
+static int collect(const char* arg)
+{
+	struct stat st;
+	const char* base;
+
+	if (stat(arg, &st))
+	{
+		fprintf(stderr, "%s: %s\n", arg, strerror(errno));
+		return 1;
+	}
+
+	if (!S_ISDIR(st.st_mode))
+	{
+		// A single file goes straight into out_dir
+		base = strrchr(arg, '/');
+		walk_root = arg;
+		walk_root_len = base ? (size_t)(base - arg) : 0;
+		return walk_add(arg);
+	}
+
+	walk_root = arg;
+	walk_root_len = strlen(arg);
+
+	return nftw(arg, walk_entry, 32, FTW_PHYS) ? 1 : 0;
+}
+
+
+
+static int read_file(const char* path, char** buf, unsigned long* len, mode_t* mode)
+{
+	struct stat st;
+	unsigned long n = 0;
+	ssize_t r;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return MZAE_ERR_IO;
+	if (fstat(fd, &st) || !(*buf = (char*) malloc(st.st_size + 1)))
+	{
+		close(fd);
+		return MZAE_ERR_IO;
+	}
+
+	while (n < (unsigned long) st.st_size && (r = read(fd, *buf + n, st.st_size - n)) > 0)
+		n += r;
+	close(fd);
+	if (n != (unsigned long) st.st_size)
+	{
+		free(*buf);
+		return MZAE_ERR_IO;
+	}
+
+	*len = n;
+	*mode = st.st_mode & 07777;
+
+	return MZAE_ERR_SUCCESS;
+}
+
+
+
+// Creates the parent directories of path
+static void make_parents(char* path)
+{
+	char* p;
+
+	for (p = strchr(path + 1, '/'); p; p = strchr(p + 1, '/'))
+	{
+		*p = 0;
+		mkdir(path, 0777);
+		*p = '/';
+	}
+}
+
+
+
+// Writes through a temporary file, then renames it over path
+static int write_file(char* path, char* buf, unsigned long len, mode_t mode)
+{
+	char* tmp = (char*) malloc(strlen(path) + 32);
+	int fd, ret;
+
+	if (!tmp)
+		return MZAE_ERR_NOMEM;
+
+	make_parents(path);
+	sprintf(tmp, "%s.mzae%ld~", path, (long) getpid());
+
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	ret = fd < 0 || MZAE_fd_sink((void*)(intptr_t) fd, buf, len) || fchmod(fd, mode);
+	if (fd >= 0 && close(fd))
+		ret = 1;
+	if (!ret && rename(tmp, path))
+		ret = 1;
+	if (ret)
+		unlink(tmp);
+	free(tmp);
+
+	return ret ? MZAE_ERR_IO : MZAE_ERR_SUCCESS;
+}
+
+
+
+// Extracts a document, undoing the V2 reversal
+static int decrypt(struct worker* w, char* src, unsigned long len, char** dst, unsigned long* dstlen, char* pw)
+{
+	MZAE_OPTIONS opts = {0};
+	int ret;
+
+	*dstlen = 0;
+	if ((ret = MiniZipAERead(src, len, dst, dstlen, pw)))
+		return ret;
+	if (!(*dst = (char*) malloc(*dstlen + 1)))
+		return MZAE_ERR_NOMEM;
+	opts.arena = w->arena;
+	opts.reverse = src[len - 1] == 'R';
+	if ((ret = MiniZipAEReadEx(src, len, dst, dstlen, pw, &opts)))
+		free(*dst);
+
+	return ret;
+}
+
+
+
+// Makes a V2 document, of the source reversed
+static int encrypt(struct worker* w, char* src, unsigned long len, char** dst, unsigned long* dstlen, char* pw)
+{
+	MZAE_OPTIONS opts = {0};
+	int ret;
+
+	opts.prekey = w->prekey;
+	opts.arena = w->arena;
+	opts.profile = profile;
+	opts.sync = sync_size;
+	opts.reverse = 1;
+
+	*dstlen = 0;
+	if ((ret = MiniZipAEWriteEx(src, len, dst, dstlen, pw, &opts)))
+		return ret;
+	if (!(*dst = (char*) malloc(*dstlen)))
+		return MZAE_ERR_NOMEM;
+
+	if ((ret = MiniZipAEWriteEx(src, len, dst, dstlen, pw, &opts)))
+		free(*dst);
+
+	return ret;
+}
+
+
+
+// Applies the operation to a buffer. Returns -1 to skip it
+static int process(struct worker* w, char* src, unsigned long len, char** dst, unsigned long* dstlen)
+{
+	char* plain;
+	unsigned long plainlen;
+	int ret;
+
+	*dst = NULL;
+	*dstlen = 0;
+
+	if (op == OP_ENCRYPT)
+	{
+		if (!len || is_document(src, len))
+			return -1;
+		return encrypt(w, src, len, dst, dstlen, password);
+	}
+
+	if (!is_document(src, len))
+		return -1;
+
+	if ((ret = decrypt(w, src, len, &plain, &plainlen, password)))
+		return ret;
+
+	if (op == OP_VERIFY)
+	{
+		*dstlen = plainlen;
+		free(plain);
+		return MZAE_ERR_SUCCESS;
+	}
+	if (op == OP_DECRYPT)
+	{
+		*dst = plain;
+		*dstlen = plainlen;
+		return MZAE_ERR_SUCCESS;
+	}
+
+	ret = plainlen ? encrypt(w, plain, plainlen, dst, dstlen, new_password) : MZAE_ERR_PARAMS;
+	memset(plain, 0, plainlen);
+	free(plain);
+
+	return ret;
+}
+
+
+
+static void process_job(struct worker* w, struct job* j)
+{
+	char *src, *dst;
+	unsigned long len, dstlen;
+	mode_t mode;
+	double t = now();
+	int ret;
+
+	ret = read_file(j->path, &src, &len, &mode);
+	if (!ret)
+	{
+		ret = process(w, src, len, &dst, &dstlen);
+		if (!ret && dst)
+			ret = write_file(j->dest ? j->dest : j->path, dst, dstlen, mode);
+		// Skipped files are copied too, so that the output tree is complete
+		else if (ret < 0 && j->dest && write_file(j->dest, src, len, mode))
+			ret = MZAE_ERR_IO;
+		if (dst)
+		{
+			memset(dst, 0, dstlen);
+			free(dst);
+		}
+		free(src);
+	}
+	t = now() - t;
+
+	if (ret > 0)
+	{
+		__sync_fetch_and_add(&failed_files, 1);
+		fprintf(stderr, "%s: %s\n", j->path, MZAE_errmsg(ret));
+		return;
+	}
+
+	if (ret < 0)
+	{
+		__sync_fetch_and_add(&skipped_files, 1);
+		if (!quiet)
+			printf("%s: skipped\n", j->path);
+		return;
+	}
+
+	__sync_fetch_and_add(&done_files, 1);
+	__sync_fetch_and_add(&total_in, (unsigned long long) len);
+	__sync_fetch_and_add(&total_out, (unsigned long long) dstlen);
+	if (!quiet)
+		printf("%s: %s, %lu -> %lu bytes, %.1f ms, %.1f MB/s\n", j->path, op_done[op],
+			len, dstlen, t * 1e3, t > 0 ? len / t / 1048576 : 0.0);
+}
+
+
+
+static void worker_proc(void* arg)
+{
+	struct worker* w = (struct worker*) arg;
+	unsigned long i;
+
+	while ((i = __sync_fetch_and_add(&next_job, 1)) < njobs)
+		process_job(w, &jobs[i]);
+}
+
+
+
+// Counts the verified bytes
+static int null_sink(void* opaque, char* buf, unsigned int len)
+{
+	*(unsigned long*) opaque += len;
+	return 0;
+}
+
+
+
+// Reads the whole standard input
+static int read_stdin(char** buf, unsigned long* len)
+{
+	unsigned long max = MZAE_CHUNK;
+	ssize_t r;
+	char* p;
+
+	*len = 0;
+	if (!(*buf = (char*) malloc(max)))
+		return MZAE_ERR_NOMEM;
+
+	while ((r = read(0, *buf + *len, max - *len)) > 0)
+	{
+		*len += r;
+		if (*len == max)
+		{
+			if (!(p = (char*) realloc(*buf, max *= 2)))
+			{
+				free(*buf);
+				return MZAE_ERR_NOMEM;
+			}
+			*buf = p;
+		}
+	}
+	if (r < 0)
+	{
+		free(*buf);
+		return MZAE_ERR_IO;
+	}
+
+	return MZAE_ERR_SUCCESS;
+}
+
+
+
+// Processes standard input into standard output
+static int stream(void)
+{
+	struct worker w = {0};
+	char buf[MZAE_CHUNK], *src, *dst;
+	unsigned long len = 0, dstlen = 0;
+	MZAE_WRITER* writer;
+	MZAE_READER* reader;
+	double t = now();
+	ssize_t n;
+	int ret;
+
+	if (op == OP_ENCRYPT)
+	{
+		if (!(ret = MZAE_writer_init(&writer, password, MZAE_fd_sink, (void*)(intptr_t) 1)))
+		{
+			while (!ret && (n = read(0, buf, sizeof(buf))) > 0)
+			{
+				ret = MZAE_writer_update(writer, buf, n);
+				len += n;
+			}
+			if (!ret && n < 0)
+				ret = MZAE_ERR_IO;
+			if (ret)
+				MZAE_writer_free(writer);
+			else
+				ret = MZAE_writer_final(writer);
+		}
+	}
+	else if (op == OP_VERIFY)
+	{
+		if (!(ret = MZAE_reader_init(&reader, password, null_sink, &len)))
+		{
+			if ((ret = MZAE_reader_fd(reader, 0)))
+				MZAE_reader_free(reader);
+			else
+				ret = MZAE_reader_final(reader);
+		}
+	}
+	else if (!(ret = read_stdin(&src, &len)))
+	{
+		ret = process(&w, src, len, &dst, &dstlen);
+		if (ret < 0)
+			ret = MZAE_ERR_BADZIP;
+		if (!ret && MZAE_fd_sink((void*)(intptr_t) 1, dst, dstlen))
+			ret = MZAE_ERR_IO;
+		len = dstlen;
+		if (dst)
+		{
+			memset(dst, 0, dstlen);
+			free(dst);
+		}
+		free(src);
+	}
+
+	t = now() - t;
+	if (ret)
+		fprintf(stderr, "-: %s\n", MZAE_errmsg(ret));
+	else if (!quiet)
+		fprintf(stderr, "-: %s, %lu bytes, %.1f ms\n", op_done[op], len, t * 1e3);
+
+	return ret ? 1 : 0;
+}
+
+
+
+static void usage(void)
+{
+	fprintf(stderr, "Usage: mzae [-p password] [-n new password] [-j threads] [-o dir] [-P profile] [-I size] [-q]\n"
+		"            encrypt|decrypt|verify|rekey path...\n"
+		"A single \"-\" path streams standard input to standard output.\n");
+	exit(2);
+}
+
+
+
+int main(int argc, char** argv)
+{
+	struct worker* workers;
+	unsigned long threads = 0, i;
+	double t;
+	int c, ret = 0;
+
+	while ((c = getopt(argc, argv, "p:n:j:o:P:I:q")) != -1)
+		switch (c)
+		{
+		case 'p': password = optarg; break;
+		case 'n': new_password = optarg; break;
+		case 'j': threads = strtoul(optarg, NULL, 10); break;
+		case 'o': out_dir = optarg; break;
+		case 'P':
+			for (profile = 0; profile < MZAE_PROFILES; profile++)
+				if (!strcmp(optarg, MZAE_profile_name(profile)))
+					break;
+			if (profile == MZAE_PROFILES)
+				usage();
+			break;
+		case 'I': sync_size = strtoul(optarg, NULL, 10) << 20; break;
+		case 'q': quiet = 1; break;
+		default: usage();
+		}
+
+	if (optind + 1 >= argc)
+		usage();
+	for (i = 0; i < 4; i++)
+		if (!strcmp(argv[optind], op_names[i]))
+			op = (int) i;
+	if (op < 0)
+		usage();
+	optind++;
+
+	if (!password)
+		password = getenv("MZAE_PASSWORD");
+	if (!new_password)
+		new_password = getenv("MZAE_NEWPASSWORD");
+	if (!password || !password[0] || (op == OP_REKEY && (!new_password || !new_password[0])))
+	{
+		fprintf(stderr, "mzae: %s\n", MZAE_errmsg(MZAE_ERR_NOPW));
+		return 2;
+	}
+
+	if (!strcmp(argv[optind], "-"))
+	{
+		if (optind + 1 != argc)
+			usage();
+		return stream();
+	}
+
+	t = now();
+	for (; optind < argc; optind++)
+		if (collect(argv[optind]))
+			ret = 1;
+
+	if (!threads)
+		threads = MZAE_ncpu();
+	if (threads > njobs)
+		threads = njobs ? njobs : 1;
+
+	workers = (struct worker*) calloc(threads, sizeof(struct worker));
+	if (!workers)
+		return 1;
+
+	// The calling thread is a worker too
+	for (i = 0; i < threads; i++)
+	{
+		MZAE_arena_init(&workers[i].arena, 0, 0);
+		if (op == OP_ENCRYPT || op == OP_REKEY)
+			MZAE_prekey_init(&workers[i].prekey, op == OP_REKEY ? new_password : password);
+		if (i && MZAE_thread_start(&workers[i].thread, worker_proc, &workers[i]))
+			workers[i].thread = NULL;
+	}
+	worker_proc(&workers[0]);
+	for (i = 0; i < threads; i++)
+	{
+		if (workers[i].thread)
+			MZAE_thread_join(workers[i].thread);
+		MZAE_prekey_free(workers[i].prekey);
+		MZAE_arena_free(workers[i].arena);
+	}
+	free(workers);
+
+	t = now() - t;
+	printf("%lu files %s, %lu skipped, %lu failed; %.1f MB in %.2f s, %.1f MB/s, %lu threads\n",
+		done_files, op_done[op], skipped_files, failed_files, total_in / 1048576.0, t,
+		t > 0 ? total_in / t / 1048576 : 0.0, threads);
+
+	for (i = 0; i < njobs; i++)
+	{
+		free(jobs[i].path);
+		free(jobs[i].dest);
+	}
+	free(jobs);
+
+	return ret || failed_files ? 1 : 0;
+}
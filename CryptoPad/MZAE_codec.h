@@ -0,0 +1,102 @@
+/*
+ *  Copyright (C) 2016-2023  maxpat78 <https://github.com/maxpat78>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+   MZAE_codec.h
+
+   Whole buffer Deflate codecs, selected at run time with MZAE_codec: the
+   engines behind MZAE_deflate and MZAE_inflate, and behind MiniZipAEWrite
+   and MiniZipAERead when a codec faster than Zlib is built in. The
+   streaming functions (MZAE_deflate_init...) always use Zlib.
+*/
+
+#if !defined(__MZAE_CODEC__)
+#define __MZAE_CODEC__
+
+#include <mZipAES.h>
+#include <stddef.h>
+
+# ifdef  __cplusplus
+extern "C" {
+# endif
+
+// Raw Deflate (RFC 1951) of whole buffers
+typedef struct {
+	const char* name;
+	size_t (*bound)(int level, size_t srclen); // largest output, or 0
+	// Fails if the output takes more than *dstlen bytes, else sets it
+	int (*deflate)(int level, char* src, size_t srclen, char* dst, size_t* dstlen);
+	// Fails unless src holds exactly one stream of exactly dstlen bytes
+	int (*inflate)(char* src, size_t srclen, char* dst, size_t dstlen);
+} MZAE_CODEC;
+
+
+/*
+	Returns the codec in use.
+*/
+const MZAE_CODEC* MZAE_codec_get(void);
+
+
+/*
+	Returns how many threads should deflate or inflate len bytes, as tuned
+	by MZAE_deflate_threads: 1 if not worth it.
+*/
+unsigned int MZAE_codec_threads(size_t len);
+
+
+/*
+	Deflates with Zlib in slices, on up to threads threads (the calling one
+	included), into a single raw Deflate stream. Fails like the codecs'
+	deflate.
+
+	span		0 makes one slice per thread, primed with the 32 KB preceding
+				it; else slices of span bytes are deflated independently, so
+				that each can be inflated alone
+	crc			if not NULL, updated with the CRC-32 of src, computated by
+				slice and combined
+	index		if not NULL, receives the offset in dst of each slice after
+				the first
+*/
+int MZAE_deflate_parallel(int level, int strategy, unsigned int threads, size_t span, char* src, size_t srclen, char* dst, size_t* dstlen, unsigned long* crc, unsigned long* index);
+
+
+/*
+	Inflates with Zlib n independent slices of a raw Deflate stream, on up
+	to threads threads, into dst. Fails unless each slice holds exactly its
+	data, ending between blocks, and the last one ends the stream.
+
+	index		offsets in src and in dst of each slice after the first,
+				in pairs
+	crc			if not NULL, receives the CRC-32 of dst
+*/
+int MZAE_inflate_parallel(unsigned int threads, unsigned int n, unsigned long* index, char* src, size_t srclen, char* dst, size_t dstlen, unsigned long* crc);
+
+
+// Zlib (MZAE_zlib.c)
+extern const MZAE_CODEC MZAE_codec_zlib;
+
+#ifdef MZAE_LIBDEFLATE
+// libdeflate (MZAE_libdeflate.c)
+extern const MZAE_CODEC MZAE_codec_libdeflate;
+#endif
+
+# ifdef  __cplusplus
+}
+# endif
+
+#endif // __MZAE_CODEC__
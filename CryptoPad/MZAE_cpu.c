@@ -0,0 +1,90 @@
+/*
+ *  Copyright (C) 2016-2023  maxpat78 <https://github.com/maxpat78>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+	Processor features, from CPUID
+*/
+#include <MZAE_cpu.h>
+#include <MZAE_thread.h>
+
+#ifdef MZAE_X86
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+
+
+static MZAE_ONCE mzae_cpu_once = MZAE_ONCE_INIT;
+
+static unsigned int mzae_cpu_flags;
+
+
+
+#ifdef MZAE_X86
+static void mzae_cpuid(unsigned int leaf, unsigned int r[4])
+{
+#ifdef _MSC_VER
+	__cpuidex((int*) r, leaf, 0);
+#else
+	__cpuid_count(leaf, 0, r[0], r[1], r[2], r[3]);
+#endif
+}
+#endif
+
+
+
+static void mzae_cpu_probe(void)
+{
+#ifdef MZAE_X86
+	unsigned int r[4] = {0}, leaves;
+
+	mzae_cpuid(0, r);
+	leaves = r[0];
+
+	if (leaves >= 1)
+	{
+		mzae_cpuid(1, r);
+		if (r[2] & (1 << 9))
+			mzae_cpu_flags |= MZAE_CPU_SSSE3;
+		if (r[2] & (1 << 19))
+			mzae_cpu_flags |= MZAE_CPU_SSE41;
+		if (r[2] & (1 << 1))
+			mzae_cpu_flags |= MZAE_CPU_PCLMUL;
+		if (r[2] & (1 << 25))
+			mzae_cpu_flags |= MZAE_CPU_AESNI;
+	}
+	if (leaves >= 7)
+	{
+		mzae_cpuid(7, r);
+		if (r[1] & (1 << 29))
+			mzae_cpu_flags |= MZAE_CPU_SHA;
+	}
+#endif
+}
+
+
+
+unsigned int MZAE_cpu_features(void)
+{
+	MZAE_once(&mzae_cpu_once, mzae_cpu_probe);
+
+	return mzae_cpu_flags;
+}
@@ -0,0 +1,62 @@
+/*
+ *  Copyright (C) 2016-2023  maxpat78 <https://github.com/maxpat78>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+   MZAE_cpu.h
+
+   Processor features for the kernels picked at run time, and the attribute
+   compiling a single function for an instruction set.
+*/
+
+#if !defined(__MZAE_CPU__)
+#define __MZAE_CPU__
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define MZAE_X86
+#include <immintrin.h>
+#endif
+
+// Lets GCC and Clang compile a function for instructions not enabled globally
+#ifdef __GNUC__
+#define MZAE_TARGET(x) __attribute__((target(x)))
+#else
+#define MZAE_TARGET(x)
+#endif
+
+# ifdef  __cplusplus
+extern "C" {
+# endif
+
+#define MZAE_CPU_SSSE3		0x01
+#define MZAE_CPU_SSE41		0x02
+#define MZAE_CPU_SHA		0x04
+#define MZAE_CPU_PCLMUL		0x08
+#define MZAE_CPU_AESNI		0x10
+
+
+/*
+	Returns the MZAE_CPU_* features of the processor, or zero if it is not
+	an x86. CPUID may trap to the hypervisor, so it is asked once.
+*/
+unsigned int MZAE_cpu_features(void);
+
+# ifdef  __cplusplus
+}
+# endif
+
+#endif // __MZAE_CPU__
@@ -0,0 +1,254 @@
+/*
+ *  Copyright (C) 2016-2023  maxpat78 <https://github.com/maxpat78>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+	ZIP CRC-32 (reflected polynomial 0xEDB88320).
+
+	Long buffers are folded 64 bytes at a time with carry-less multiplication
+	(PCLMULQDQ) when the processor has it, as described in Intel's "Fast CRC
+	Computation for Generic Polynomials Using PCLMULQDQ Instruction"; the rest
+	is processed 16 bytes at a time with table lookups (slice-by-16).
+*/
+#include <mZipAES.h>
+#include <MZAE_cpu.h>
+#include <MZAE_thread.h>
+#include <stddef.h>
+
+#define POLY 0xEDB88320
+
+// Words are read little endian, whatever the host
+#define GETLE32(p) ((unsigned int)(p)[0] | (unsigned int)(p)[1] << 8 | (unsigned int)(p)[2] << 16 | (unsigned int)(p)[3] << 24)
+
+// Shortest buffer worth folding
+#define MZAE_CRC_FOLD 64
+
+static MZAE_ONCE mzae_crc_once = MZAE_ONCE_INIT;
+
+// T[k][b] is the CRC of byte b followed by k zero bytes
+static unsigned int mzae_crc_table[16][256];
+
+// x^(2^n) modulo the polynomial, to combine CRCs
+static unsigned int mzae_crc_x2n[32];
+
+static int mzae_crc_clmul_ok;
+
+
+
+// Multiplies two polynomials modulo the CRC one (bit 31 is x^0)
+static unsigned int mzae_crc_mult(unsigned int a, unsigned int b)
+{
+	unsigned int m = 1U << 31, p = 0;
+
+	for (;;)
+	{
+		if (a & m)
+		{
+			p ^= b;
+			if ((a & (m - 1)) == 0)
+				break;
+		}
+		m >>= 1;
+		b = b & 1 ? (b >> 1) ^ POLY : b >> 1;
+	}
+
+	return p;
+}
+
+
+
+static void mzae_crc_init(void)
+{
+	unsigned int c, i, k;
+
+	for (i = 0; i < 256; i++)
+	{
+		c = i;
+		for (k = 0; k < 8; k++)
+			c = c & 1 ? (c >> 1) ^ POLY : c >> 1;
+		mzae_crc_table[0][i] = c;
+	}
+	for (k = 1; k < 16; k++)
+		for (i = 0; i < 256; i++)
+		{
+			c = mzae_crc_table[k-1][i];
+			mzae_crc_table[k][i] = (c >> 8) ^ mzae_crc_table[0][c & 0xFF];
+		}
+
+	c = 1U << 30; // x^1
+	for (k = 0; k < 32; k++)
+	{
+		mzae_crc_x2n[k] = c;
+		c = mzae_crc_mult(c, c);
+	}
+
+#ifdef MZAE_X86
+	// PCLMULQDQ and SSE4.1
+	c = MZAE_CPU_PCLMUL | MZAE_CPU_SSE41;
+	mzae_crc_clmul_ok = (MZAE_cpu_features() & c) == c;
+#endif
+}
+
+
+
+// Updates a pre-conditioned CRC 16 bytes at a time
+static unsigned int mzae_crc_slice16(unsigned int crc, const unsigned char* p, size_t n)
+{
+	unsigned int (*t)[256] = mzae_crc_table;
+	unsigned int a, b, c, d;
+
+	for (; n >= 16; n -= 16, p += 16)
+	{
+		a = crc ^ GETLE32(p);
+		b = GETLE32(p + 4);
+		c = GETLE32(p + 8);
+		d = GETLE32(p + 12);
+		crc = t[15][a & 0xFF] ^ t[14][(a >> 8) & 0xFF] ^ t[13][(a >> 16) & 0xFF] ^ t[12][a >> 24] ^
+			t[11][b & 0xFF] ^ t[10][(b >> 8) & 0xFF] ^ t[9][(b >> 16) & 0xFF] ^ t[8][b >> 24] ^
+			t[7][c & 0xFF] ^ t[6][(c >> 8) & 0xFF] ^ t[5][(c >> 16) & 0xFF] ^ t[4][c >> 24] ^
+			t[3][d & 0xFF] ^ t[2][(d >> 8) & 0xFF] ^ t[1][(d >> 16) & 0xFF] ^ t[0][d >> 24];
+	}
+
+	while (n--)
+		crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xFF];
+
+	return crc;
+}
+
+
+
+#ifdef MZAE_X86
+// Folds n bytes, n being a multiple of 16 and at least MZAE_CRC_FOLD, into a
+// pre-conditioned CRC. Four 128-bit lanes are folded 512 bits ahead, then
+// into one, which is reduced to 32 bits with Barrett's method
+MZAE_TARGET("pclmul,sse4.1")
+static unsigned int mzae_crc_clmul(unsigned int crc, const unsigned char* p, size_t n)
+{
+	const __m128i k1k2 = _mm_set_epi64x(0x01C6E41596LL, 0x0154442BD4LL);
+	const __m128i k3k4 = _mm_set_epi64x(0x00CCAA009ELL, 0x01751997D0LL);
+	const __m128i k5k0 = _mm_set_epi64x(0, 0x0163CD6124LL);
+	const __m128i poly = _mm_set_epi64x(0x01F7011641LL, 0x01DB710641LL);
+	const __m128i mask = _mm_setr_epi32(-1, 0, -1, 0);
+	__m128i x1, x2, x3, x4, x5, x6, x7, x8;
+
+	x1 = _mm_loadu_si128((const __m128i*) p);
+	x2 = _mm_loadu_si128((const __m128i*)(p + 16));
+	x3 = _mm_loadu_si128((const __m128i*)(p + 32));
+	x4 = _mm_loadu_si128((const __m128i*)(p + 48));
+	x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int) crc));
+	p += 64;
+	n -= 64;
+
+	for (; n >= 64; n -= 64, p += 64)
+	{
+		x5 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+		x6 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+		x7 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+		x8 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+
+		x1 = _mm_clmulepi64_si128(x1, k1k2, 0x11);
+		x2 = _mm_clmulepi64_si128(x2, k1k2, 0x11);
+		x3 = _mm_clmulepi64_si128(x3, k1k2, 0x11);
+		x4 = _mm_clmulepi64_si128(x4, k1k2, 0x11);
+
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128((const __m128i*) p));
+		x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128((const __m128i*)(p + 16)));
+		x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128((const __m128i*)(p + 32)));
+		x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128((const __m128i*)(p + 48)));
+	}
+
+	// Four lanes into one, then the remaining 16 bytes blocks
+	x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+	x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+
+	x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+	for (; n >= 16; n -= 16, p += 16)
+	{
+		x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, _mm_loadu_si128((const __m128i*) p)), x5);
+	}
+
+	// 128 to 64 bits
+	x2 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+	x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_and_si128(x1, mask);
+	x1 = _mm_clmulepi64_si128(x1, k5k0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	// Barrett reduction to 32 bits
+	x2 = _mm_and_si128(x1, mask);
+	x2 = _mm_clmulepi64_si128(x2, poly, 0x10);
+	x2 = _mm_and_si128(x2, mask);
+	x2 = _mm_clmulepi64_si128(x2, poly, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	return (unsigned int) _mm_extract_epi32(x1, 1);
+}
+#endif
+
+
+
+unsigned long MZAE_crc(unsigned long crc, char* src, unsigned int srclen)
+{
+	const unsigned char* p = (const unsigned char*) src;
+	unsigned int c = ~(unsigned int) crc;
+	size_t n = srclen;
+
+	if (!src)
+		return 0;
+
+	MZAE_once(&mzae_crc_once, mzae_crc_init);
+
+#ifdef MZAE_X86
+	if (mzae_crc_clmul_ok && n >= MZAE_CRC_FOLD)
+	{
+		c = mzae_crc_clmul(c, p, n & ~(size_t)15);
+		p += n & ~(size_t)15;
+		n &= 15;
+	}
+#endif
+
+	return ~mzae_crc_slice16(c, p, n);
+}
+
+
+
+unsigned long MZAE_crc_combine(unsigned long crc1, unsigned long crc2, unsigned long len2)
+{
+	unsigned int p = 1U << 31; // x^0
+	unsigned int k = 3;
+
+	MZAE_once(&mzae_crc_once, mzae_crc_init);
+
+	// crc1 is shifted by 8*len2 bits, multiplying by x^(2^k) for each bit set
+	for (; len2; len2 >>= 1, k++)
+		if (len2 & 1)
+			p = mzae_crc_mult(mzae_crc_x2n[k & 31], p);
+
+	return mzae_crc_mult(p, (unsigned int) crc1) ^ (unsigned int) crc2;
+}
@@ -0,0 +1,160 @@
+/*
+ *  Copyright (C) 2016-2023  maxpat78 <https://github.com/maxpat78>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+	Codec built on top of libdeflate, compiled in only when MZAE_LIBDEFLATE
+	is defined (and libdeflate linked).
+
+	libdeflate compresses and decompresses whole buffers only, faster than
+	Zlib. Levels are Zlib's, mapped to the libdeflate level compressing text
+	at least as well: i.e. 6 in place of 8, which runs 1.8-4 times faster.
+	Level 1 is left as it is, favouring speed.
+
+	The compressor takes hundreds of KB, so each thread keeps one (for the
+	last level used) and a decompressor, released when the thread
+	terminates. Their memory is not counted in the scratch statistics.
+*/
+
+#ifdef MZAE_LIBDEFLATE
+
+#include <mZipAES.h>
+#include <MZAE_codec.h>
+#include <MZAE_thread.h>
+#include <stdlib.h>
+#include <libdeflate.h>
+
+
+
+// Per thread compressor and decompressor
+struct mzae_libdeflate {
+	struct libdeflate_compressor* c;
+	int level;
+	struct libdeflate_decompressor* d;
+};
+
+static MZAE_KEY mzae_libdeflate_key;
+static int mzae_libdeflate_ok;
+static MZAE_ONCE mzae_libdeflate_once = MZAE_ONCE_INIT;
+
+
+
+static void MZAE_KEY_CALLBACK mzae_libdeflate_free(void* state)
+{
+	struct mzae_libdeflate* s = (struct mzae_libdeflate*) state;
+
+	libdeflate_free_compressor(s->c);
+	libdeflate_free_decompressor(s->d);
+	free(s);
+}
+
+static void mzae_libdeflate_init(void)
+{
+	mzae_libdeflate_ok = !MZAE_key_create(&mzae_libdeflate_key, mzae_libdeflate_free);
+}
+
+// Returns the state of the calling thread, creating it at first use
+static struct mzae_libdeflate* mzae_libdeflate_state(void)
+{
+	struct mzae_libdeflate* s;
+
+	MZAE_once(&mzae_libdeflate_once, mzae_libdeflate_init);
+	if (!mzae_libdeflate_ok)
+		return NULL;
+
+	s = (struct mzae_libdeflate*) MZAE_key_get(mzae_libdeflate_key);
+	if (!s && (s = (struct mzae_libdeflate*) calloc(1, sizeof(struct mzae_libdeflate))))
+		MZAE_key_set(mzae_libdeflate_key, s);
+
+	return s;
+}
+
+// libdeflate levels matching Zlib's 0-9
+static const int mzae_libdeflate_levels[10] = {0, 1, 2, 3, 4, 5, 5, 6, 6, 9};
+
+// Returns a compressor for a Zlib level (-1 selects Zlib's default)
+static struct libdeflate_compressor* mzae_libdeflate_compressor(int level)
+{
+	struct mzae_libdeflate* s = mzae_libdeflate_state();
+
+	if (!s)
+		return NULL;
+
+	level = mzae_libdeflate_levels[level < 0 || level > 9 ? 6 : level];
+
+	if (s->c && s->level != level)
+	{
+		libdeflate_free_compressor(s->c);
+		s->c = NULL;
+	}
+	if (!s->c)
+	{
+		s->c = libdeflate_alloc_compressor(level);
+		s->level = level;
+	}
+
+	return s->c;
+}
+
+
+
+static size_t mzae_libdeflate_bound(int level, size_t srclen)
+{
+	struct libdeflate_compressor* c = mzae_libdeflate_compressor(level);
+
+	return c ? libdeflate_deflate_compress_bound(c, srclen) : 0;
+}
+
+static int mzae_libdeflate_deflate(int level, char* src, size_t srclen, char* dst, size_t* dstlen)
+{
+	struct libdeflate_compressor* c = mzae_libdeflate_compressor(level);
+	size_t n;
+
+	if (!c)
+		return 2;
+
+	// 0 when the output does not fit
+	n = libdeflate_deflate_compress(c, src, srclen, dst, *dstlen);
+	if (!n)
+		return 1;
+	*dstlen = n;
+
+	return 0;
+}
+
+static int mzae_libdeflate_inflate(char* src, size_t srclen, char* dst, size_t dstlen)
+{
+	struct mzae_libdeflate* s = mzae_libdeflate_state();
+	size_t in, out;
+
+	if (!s || (!s->d && !(s->d = libdeflate_alloc_decompressor())))
+		return 1;
+
+	if (libdeflate_deflate_decompress_ex(s->d, src, srclen, dst, dstlen, &in, &out) != LIBDEFLATE_SUCCESS)
+		return 2;
+
+	if (in != srclen || out != dstlen)
+		return 3;
+
+	return 0;
+}
+
+const MZAE_CODEC MZAE_codec_libdeflate = {
+	"libdeflate", mzae_libdeflate_bound, mzae_libdeflate_deflate, mzae_libdeflate_inflate
+};
+
+#endif // MZAE_LIBDEFLATE
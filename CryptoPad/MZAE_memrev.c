@@ -0,0 +1,131 @@
+/*
+ *  Copyright (C) 2016-2023  maxpat78 <https://github.com/maxpat78>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+	Byte reversal, as in V2 documents.
+
+	Blocks are reversed 16 bytes at a time with PSHUFB when the processor has
+	SSSE3, else 8 at a time in a general register; the ends byte by byte.
+	Either is bound by memory bandwidth on long buffers: 32 byte AVX2 blocks
+	gain less than 10% and are not used.
+*/
+#include <mZipAES.h>
+#include <MZAE_cpu.h>
+#include <stddef.h>
+#include <string.h>
+
+
+
+// Reverses the bytes of a 64-bit word
+static unsigned long long mzae_rev64(unsigned long long x)
+{
+	x = (x & 0x00FF00FF00FF00FFULL) << 8 | (x >> 8 & 0x00FF00FF00FF00FFULL);
+	x = (x & 0x0000FFFF0000FFFFULL) << 16 | (x >> 16 & 0x0000FFFF0000FFFFULL);
+
+	return x << 32 | x >> 32;
+}
+
+
+
+// Reverses n bytes of s into d, or in place if they are the same buffer.
+// In place, blocks are swapped between the ends; else the last block of s
+// goes first in d
+static void mzae_memrev_c(unsigned char* d, unsigned char* s, size_t n)
+{
+	unsigned long long x, y;
+	unsigned char c;
+	size_t i;
+
+	if (d == s)
+	{
+		for (; n >= 16; n -= 16, d += 8)
+		{
+			memcpy(&x, d, 8);
+			memcpy(&y, d + n - 8, 8);
+			x = mzae_rev64(x);
+			y = mzae_rev64(y);
+			memcpy(d, &y, 8);
+			memcpy(d + n - 8, &x, 8);
+		}
+		for (; n >= 2; n -= 2, d++)
+		{
+			c = d[0];
+			d[0] = d[n-1];
+			d[n-1] = c;
+		}
+		return;
+	}
+
+	for (; n >= 8; n -= 8, d += 8)
+	{
+		memcpy(&x, s + n - 8, 8);
+		x = mzae_rev64(x);
+		memcpy(d, &x, 8);
+	}
+	for (i = 0; i < n; i++)
+		d[i] = s[n - 1 - i];
+}
+
+
+
+#ifdef MZAE_X86
+MZAE_TARGET("ssse3")
+static void mzae_memrev_ssse3(unsigned char* d, unsigned char* s, size_t n)
+{
+	const __m128i r = _mm_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+	__m128i x, y;
+
+	if (d == s)
+	{
+		for (; n >= 32; n -= 32, d += 16)
+		{
+			x = _mm_loadu_si128((const __m128i*) d);
+			y = _mm_loadu_si128((const __m128i*)(d + n - 16));
+			_mm_storeu_si128((__m128i*) d, _mm_shuffle_epi8(y, r));
+			_mm_storeu_si128((__m128i*)(d + n - 16), _mm_shuffle_epi8(x, r));
+		}
+		mzae_memrev_c(d, d, n);
+		return;
+	}
+
+	for (; n >= 16; n -= 16, d += 16)
+	{
+		x = _mm_loadu_si128((const __m128i*)(s + n - 16));
+		_mm_storeu_si128((__m128i*) d, _mm_shuffle_epi8(x, r));
+	}
+	mzae_memrev_c(d, s, n);
+}
+#endif
+
+
+
+void MZAE_memrev(char* dst, char* src, unsigned long len)
+{
+	unsigned char* d = (unsigned char*) dst;
+	unsigned char* s = (unsigned char*) src;
+
+#ifdef MZAE_X86
+	if (MZAE_cpu_features() & MZAE_CPU_SSSE3)
+	{
+		mzae_memrev_ssse3(d, s, len);
+		return;
+	}
+#endif
+
+	mzae_memrev_c(d, s, len);
+}
@@ -92,6 +92,13 @@
     extra field (variable size)
     file comment (variable size)
 
+  Sync point index (optional, central only, after the AES header):
+    extra field header      2 bytes  (0x5A4D, "MZ")
+    size                    2 bytes  (8 per sync point)
+    for each sync point, where an independent Deflate segment starts:
+    compressed offset       4 bytes  (from the start of the Deflate data)
+    uncompressed offset     4 bytes
+
   End of central dir record:
     end of central dir signature    4 bytes  (0x06054b50)
     number of this disk             2 bytes
@@ -109,139 +116,508 @@
     zipfile comment (variable size)
 */
 #include <mZipAES.h>
+#include <MZAE_alloc.h>
+#include <MZAE_stats.h>
+#include <MZAE_codec.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <stdint.h>
+#include <zlib.h>
+#ifdef _WIN32
+#include <io.h>
+#define read _read
+#define write _write
+#else
+#include <unistd.h>
+#endif
 
 #ifdef BYTE_ORDER_1234
 	// In the ZIP format numbers are Little Endian
 	#define BS16(x) (x & 0xFF00) >> 8 | (x & 0xFF) << 8
 	#define BS32(x) (x & 0xFF000000) >> 24 | ((x & 0xFF0000) >> 16) << 8 | ((x & 0xFF00) >> 8) << 16 | (x & 0xFF) << 24 
+	#define PDW(a, b) *((int*)(p+a)) = BS32(b)
+	#define PW(a, b) *((short*)(p+a)) = BS16(b)
+	#define GDW(a) BS32(*((unsigned int*)(src+a)))
+	#define GW(a) BS16(*((unsigned short*)(src+a)))
+#else
+	#define PDW(a, b) *((int*)(p+a)) = b
+	#define PW(a, b) *((short*)(p+a)) = b
+	#define GDW(a) *((unsigned int*)(src+a))
+	#define GW(a) *((unsigned short*)(src+a))
 #endif
 
+static const unsigned char ucLocalHeader[45] = {
+	0x50, 0x4B, 0x03, 0x04, 0x33, 0x00, 0x01, 0x00,
+	0x63, 0x00, 0x00, 0x00, 0x21, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x04, 0x00, 0x0B, 0x00, 0x64, 0x61,
+	0x74, 0x61, 0x01, 0x99, 0x07, 0x00, 0x01, 0x00,
+	0x41, 0x45, 0x03, 0x08, 0x00 
+};
+static const unsigned char ucCentralHeader[61] = {
+	0x50, 0x4B, 0x01, 0x02, 0x33, 0x00, 0x33, 0x00,
+	0x01, 0x00, 0x63, 0x00, 0x00, 0x00, 0x21, 0x00,
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x00, 0x04, 0x00, 0x0B, 0x00,
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x20, 0x00,
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x64, 0x61,
+	0x74, 0x61, 0x01, 0x99, 0x07, 0x00, 0x01, 0x00,
+	0x41, 0x45, 0x03, 0x08, 0x00 
+};
+static const unsigned char ucEndHeader[23] = {
+	0x50, 0x4B, 0x05, 0x06, 0x00, 0x00, 0x00, 0x00,
+	0x01, 0x00, 0x01, 0x00, 0x3D, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x00, 0x01, 0x00, 0x52 
+};
+
+// Extra field of the sync point index
+#define MZAE_INDEX_ID 0x5A4D
+
+// Write profiles: Deflate level and strategy, AE version
+static const struct {
+	const char* name;
+	int level, strategy, ae;
+} mzae_profiles[MZAE_PROFILES] = {
+	{"balanced", 8, Z_DEFAULT_STRATEGY, 1},
+	{"fast", 1, Z_DEFAULT_STRATEGY, 2},
+	{"max", 9, Z_DEFAULT_STRATEGY, 1}
+};
+
+const char* MZAE_profile_name(int profile)
+{
+	if (profile < 0 || profile >= MZAE_PROFILES)
+		return NULL;
+
+	return mzae_profiles[profile].name;
+}
+
+// Blocks sampled by MZAE_entropy
+#define MZAE_PROBE_BLOCKS	8
+#define MZAE_PROBE_BLOCK	4096
+
+// log2 of x > 0, without the math library
+static double mzae_log2(double x)
+{
+	double y, y2, sum = 0;
+	int e = 0, k;
+
+	while (x >= 2)
+		x /= 2, e++;
+	while (x < 1)
+		x *= 2, e--;
+
+	// ln x = 2 atanh((x-1)/(x+1)), whose series converges fast on [1, 2)
+	y = (x - 1) / (x + 1);
+	y2 = y * y;
+	for (k = 1; k < 24; k += 2, y *= y2)
+		sum += y / k;
+
+	return e + 2 * sum / 0.6931471805599453;
+}
+
+double MZAE_entropy(char* src, unsigned long len)
+{
+	unsigned long hist[256] = {0}, n, i, j, off;
+	unsigned int blocks;
+	double h = 0;
+
+	if (!len)
+		return 0;
+
+	// Short inputs are taken whole, long ones in evenly spaced blocks
+	if (len <= MZAE_PROBE_BLOCKS * MZAE_PROBE_BLOCK)
+		blocks = 1, n = len;
+	else
+		blocks = MZAE_PROBE_BLOCKS, n = MZAE_PROBE_BLOCK;
+
+	for (i = 0; i < blocks; i++)
+	{
+		off = blocks > 1 ? (len - n) / (blocks - 1) * i : 0;
+		for (j = 0; j < n; j++)
+			hist[(unsigned char) src[off + j]]++;
+	}
+
+	// H = log2 N - sum(c log2 c) / N
+	n *= blocks;
+	for (i = 0; i < 256; i++)
+		if (hist[i])
+			h += hist[i] * mzae_log2((double) hist[i]);
+
+	return mzae_log2((double) n) - h / n;
+}
+
+char* MZAE_errmsg(int code)
+{
+	static char* msgs[] = {
+		"success",
+		"bad parameters",
+		"compression error",
+		"can't generate salt",
+		"can't derive keys",
+		"AES error",
+		"HMAC error",
+		"not enough memory",
+		"buffer too small",
+		"not a compatible AES encrypted ZIP archive",
+		"bad password",
+		"bad HMAC, data corrupted",
+		"bad CRC, data corrupted",
+		"no password",
+		"I/O error"
+	};
+
+	if (code < 0 || code >= (int)(sizeof(msgs) / sizeof(msgs[0])))
+		return "unknown error";
+
+	return msgs[code];
+}
+
+// State of the fused encryption & authentication stage
+struct mzae_seal {
+	MZAE_KDF* kdf; // pending derivation of the keys
+	char* salt;
+	int saltlen; // 8, 12 or 16: half the AES key length
+	char keys[MZAE_KEYS_SIZE]; // AES key, HMAC key, verification value
+	MZAE_CTR* ctr;
+	MZAE_HMAC* hmac;
+	int error;
+	char* dst;
+	unsigned long len, max;
+	MZAE_STATS* stats; // or NULL
+};
+
+// Waits for the keys, if still being derived, and prepares AES and HMAC
+static int mzae_seal_keys(struct mzae_seal* s)
+{
+	MZAE_TIMER tm;
+
+	if (s->ctr || s->error)
+		return s->error;
+
+	MZAE_TIMER_START(s->stats, tm);
+	if (s->kdf && MZAE_kdf_join(s->kdf, s->salt, s->saltlen, s->keys))
+		s->error = MZAE_ERR_KDF;
+	s->kdf = NULL;
+	MZAE_TIMER_STOP(s->stats, tm, MZAE_STAGE_KDF, 0);
+
+	if (!s->error && MZAE_ctr_init(&s->ctr, s->keys, 2*s->saltlen))
+		s->error = MZAE_ERR_AES;
+	else if (!s->error && MZAE_hmac_init(&s->hmac, s->keys + 2*s->saltlen, 2*s->saltlen))
+		s->error = MZAE_ERR_HMAC;
+
+	return s->error;
+}
+
+// Encrypts a block straight into the archive and authenticates it while it
+// is still in cache
+static int mzae_seal(void* opaque, char* buf, unsigned int len)
+{
+	struct mzae_seal* s = (struct mzae_seal*) opaque;
+	MZAE_TIMER tm;
+
+	if (mzae_seal_keys(s))
+		return 1;
+
+	if (len > s->max - s->len)
+		return 1;
+
+	MZAE_TIMER_START(s->stats, tm);
+	MZAE_ctr_update(s->ctr, buf, len, s->dst + s->len);
+	MZAE_TIMER_STOP(s->stats, tm, MZAE_STAGE_AES, len);
+
+	MZAE_TIMER_START(s->stats, tm);
+	if (MZAE_hmac_update(s->hmac, s->dst + s->len, len))
+		return 1;
+	MZAE_TIMER_STOP(s->stats, tm, MZAE_STAGE_HMAC, len);
+	s->len += len;
+
+	return 0;
+}
+
+// Returns n bytes of the input from i on: src itself, or those of the
+// reversed document, made in block
+static char* mzae_block(char* src, unsigned long srcLen, unsigned long i, unsigned long n, char* block, MZAE_STATS* stats)
+{
+	MZAE_TIMER tm;
+
+	if (!block)
+		return src + i;
+
+	MZAE_TIMER_START(stats, tm);
+	MZAE_memrev(block, src + srcLen - i - n, n);
+	MZAE_TIMER_STOP(stats, tm, MZAE_STAGE_CODEC, 0);
+
+	return block;
+}
+
+
+
 int MiniZipAEWrite(char* src, unsigned long srcLen, char** dst, unsigned long *dstLen, char* password)
 {
-	char *tmpbuf = NULL;
-	unsigned int buflen, ret, method=8;
+	return MiniZipAEWriteEx(src, srcLen, dst, dstLen, password, NULL);
+}
+
+static int mzae_write(char* src, unsigned long srcLen, char** dst, unsigned long *dstLen, char* password, MZAE_OPTIONS* options, MZAE_STATS* stats)
+{
+	MZAE_DEFLATE* codec = NULL;
+	const MZAE_CODEC* oneshot = NULL;
+	struct mzae_seal seal = {0};
+	unsigned long i, n, buflen, data, over;
+	unsigned long sync = options ? options->sync : 0, points, ixlen, *index = NULL;
+	unsigned int threads = 1;
+	size_t zlen;
+	unsigned int ret = MZAE_ERR_SUCCESS, method=8;
+	int profile = options ? options->profile : MZAE_PROFILE_BALANCED;
+	int strength = options && options->strength ? options->strength : 256;
+	int choice = options ? options->method : MZAE_METHOD_AUTO;
+	int reverse = options ? options->reverse : 0;
+	double entropy = 0;
+	int ae, crcpass;
 	long crc = 0;
 	char salt[16];
-	char* aes_key;
-	char* hmac_key;
-	char* vv;
-	char *ppbuf;
-	char *digest, *p;
-	unsigned char ucLocalHeader[45] = {
-		0x50, 0x4B, 0x03, 0x04, 0x33, 0x00, 0x01, 0x00,
-		0x63, 0x00, 0x00, 0x00, 0x21, 0x00, 0x00, 0x00,
-		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-		0x00, 0x00, 0x04, 0x00, 0x0B, 0x00, 0x64, 0x61,
-		0x74, 0x61, 0x01, 0x99, 0x07, 0x00, 0x01, 0x00,
-		0x41, 0x45, 0x03, 0x08, 0x00 
-	};
-	unsigned char ucCentralHeader[61] = {
-		0x50, 0x4B, 0x01, 0x02, 0x33, 0x00, 0x33, 0x00,
-		0x01, 0x00, 0x63, 0x00, 0x00, 0x00, 0x21, 0x00,
-		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-		0x00, 0x00, 0x00, 0x00, 0x04, 0x00, 0x0B, 0x00,
-		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x20, 0x00,
-		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x64, 0x61,
-		0x74, 0x61, 0x01, 0x99, 0x07, 0x00, 0x01, 0x00,
-		0x41, 0x45, 0x03, 0x08, 0x00 
-	};
-	unsigned char ucEndHeader[23] = {
-		0x50, 0x4B, 0x05, 0x06, 0x00, 0x00, 0x00, 0x00,
-		0x01, 0x00, 0x01, 0x00, 0x3D, 0x00, 0x00, 0x00,
-		0x00, 0x00, 0x00, 0x00, 0x01, 0x00, 0x52 
-	};
+	char *p, *in, *rev = NULL, *block = NULL;
+	MZAE_TIMER tm;
 #ifdef USE_TIME
 	time_t t;
 	struct tm *ptm;
 #endif
 
-	if (!srcLen)
+	if (!srcLen || profile < 0 || profile >= MZAE_PROFILES || choice < MZAE_METHOD_AUTO || choice > MZAE_METHOD_STORE)
 		return MZAE_ERR_PARAMS;
 
-	ret = MZAE_deflate(src, srcLen, &tmpbuf, &buflen);
+	if (strength != 128 && strength != 192 && strength != 256)
+		return MZAE_ERR_PARAMS;
 
-	// Switch from Deflate to Store if error or disadvantage
-	if (ret || buflen >= srcLen)
-	{
-		method = 0;
-		buflen = srcLen;
-	}
+	// ZIP64 is not supported: even Stored, sizes and offsets must fit 32 bits
+	if (srcLen > 0xFFFFFFFFUL - 45 - 28)
+		return MZAE_ERR_PARAMS;
+
+	// Sync points split the input in at most MZAE_SYNC_POINTS segments; the
+	// index takes 8 bytes for each after the first
+	if (sync && sync < MZAE_CHUNK)
+		sync = MZAE_CHUNK;
+	if (sync && srcLen / sync >= MZAE_SYNC_POINTS)
+		sync = srcLen / MZAE_SYNC_POINTS + 1;
+	points = sync ? (srcLen - 1) / sync : 0;
+	ixlen = points ? 4 + 8 * points : 0;
 
+	// Deflate is dropped when it does not win, so the archive never exceeds
+	// the Stored one: there is no need to compress just to know the size
 	if (! *dstLen)
 	{
-		*dstLen = buflen + 45 + 28 + 61 + 23; //(45+28)+61+23
-		if (tmpbuf)
-			free(tmpbuf);
+		*dstLen = srcLen + 45 + 28 + 61 + 23 + ixlen; //(45+28)+61+23
 		return MZAE_ERR_SUCCESS;
 	}
 
 	if (!password || !password[0])
-	{
-		free(tmpbuf);
 		return MZAE_ERR_NOPW;
-	}
 
-	if (! *dst || *dstLen < (buflen + 156))
-	{
-		free(tmpbuf);
+	// Salt is half the key long, the data follow salt and check word
+	seal.saltlen = strength / 16;
+	data = 45 + seal.saltlen + 2;
+	over = data + 10 + 61 + 23 + ixlen;
+
+	if (! *dst || *dstLen < over)
 		return MZAE_ERR_BUFFER;
+
+	// A reversed document is read backwards a block at a time
+	if (reverse && !(block = (char*) MZAE_malloc(MZAE_CHUNK)))
+		return MZAE_ERR_NOMEM;
+
+	// AE-2 stores no CRC, leaving integrity to the HMAC: it is always used
+	// for tiny inputs, and by the profiles which skip the CRC pass
+	ae = srcLen < 20 ? 2 : mzae_profiles[profile].ae;
+	crcpass = ae == 1;
+
+	seal.salt = salt;
+	seal.stats = stats;
+	MZAE_TIMER_START(stats, tm);
+	ret = options && options->prekey && strength == 256 ? MZAE_prekey_take(options->prekey, password, salt, seal.keys) : 1;
+	MZAE_TIMER_STOP(stats, tm, MZAE_STAGE_KDF, 0);
+	if (ret)
+	{
+		ret = MZAE_ERR_SUCCESS;
+		if (MZAE_gen_salt(salt, seal.saltlen))
+			ret = MZAE_ERR_SALT;
+
+		// PBKDF2 runs while the first blocks are deflated
+		else if (MZAE_kdf_start(&seal.kdf, password, salt, seal.saltlen))
+			ret = MZAE_ERR_KDF;
+
+		if (ret)
+		{
+			MZAE_free(block);
+			return ret;
+		}
 	}
 
-	if (MZAE_gen_salt(salt, 16))
+	// Content that looks incompressible is stored without trying Deflate,
+	// which would otherwise run to the end before giving up
+	if (choice == MZAE_METHOD_AUTO && srcLen >= MZAE_PROBE_MIN)
 	{
-		free(tmpbuf);
-		return MZAE_ERR_SALT;
+		MZAE_TIMER_START(stats, tm);
+		entropy = MZAE_entropy(src, srcLen);
+		MZAE_TIMER_STOP(stats, tm, MZAE_STAGE_CODEC, 0);
+		if (entropy >= MZAE_PROBE_BITS)
+			method = 0;
 	}
+	else if (choice == MZAE_METHOD_STORE)
+		method = 0;
 
-	// Encrypts with AES-256 always!
-	if (MZAE_derive_keys(password, salt, 16, &aes_key, &hmac_key, &vv))
+	// Long inputs are deflated by slices on several threads, independent
+	// ones if indexed; else Zlib streams, while a whole buffer codec is
+	// faster even with a pass more
+	if (method)
+		threads = MZAE_codec_threads(srcLen);
+	if (threads == 1 && !points && MZAE_codec(-1) != MZAE_CODEC_ZLIB)
+		oneshot = MZAE_codec_get();
+	else if (threads == 1 && !points && method && MZAE_deflate_init2(&codec, mzae_profiles[profile].level, mzae_profiles[profile].strategy))
+		method = 0;
+	if (stats)
+		stats->skipped = !method;
+
+	seal.dst = *dst + data;
+	seal.max = *dstLen - over;
+	if (seal.max > srcLen - 1)
+		seal.max = srcLen - 1;
+
+	// The whole buffer codec deflates straight into the archive, whose data
+	// are then encrypted in place and authenticated block by block; the
+	// parallel Deflate CRCs each slice itself
+	if (method && (oneshot || threads > 1 || points))
 	{
-		free(tmpbuf);
-		return MZAE_ERR_KDF;
+		// A reversed document is needed whole, hence copied
+		if (reverse)
+		{
+			MZAE_TIMER_START(stats, tm);
+			if ((rev = (char*) MZAE_malloc(srcLen)))
+				MZAE_memrev(rev, src, srcLen);
+			else
+				method = 0;
+			MZAE_TIMER_STOP(stats, tm, MZAE_STAGE_CODEC, 0);
+		}
+		in = rev ? rev : src;
+
+		for (i = 0; method && oneshot && crcpass && i < srcLen; i += n)
+		{
+			n = srcLen - i < MZAE_CHUNK ? srcLen - i : MZAE_CHUNK;
+			MZAE_TIMER_START(stats, tm);
+			crc = MZAE_crc(crc, in + i, n);
+			MZAE_TIMER_STOP(stats, tm, MZAE_STAGE_CRC, n);
+		}
+
+		MZAE_TIMER_START(stats, tm);
+		zlen = seal.max;
+		if (!method || (points && !(index = (unsigned long*) MZAE_malloc(points * sizeof(unsigned long)))))
+			method = 0;
+		else if (oneshot ? oneshot->deflate(mzae_profiles[profile].level, in, srcLen, seal.dst, &zlen)
+			: MZAE_deflate_parallel(mzae_profiles[profile].level, mzae_profiles[profile].strategy, threads,
+				points ? sync : 0, in, srcLen, seal.dst, &zlen, crcpass ? (unsigned long*) &crc : NULL, index))
+			method = 0;
+		MZAE_TIMER_STOP(stats, tm, MZAE_STAGE_CODEC, srcLen);
+
+		if (rev)
+		{
+			memset(rev, 0, srcLen);
+			MZAE_free(rev);
+		}
+
+		for (i = 0; method && i < zlen; i += n)
+		{
+			n = zlen - i < MZAE_CHUNK ? zlen - i : MZAE_CHUNK;
+			if (mzae_seal(&seal, seal.dst + i, n))
+				method = 0;
+		}
 	}
-	
-	if (method == 0)
+
+	// Single traversal: each block is CRC-ed and deflated while hot, and the
+	// compressed output is encrypted into place and authenticated at once
+	for (i = 0; method && codec && i < srcLen; i += n)
 	{
-		free(tmpbuf);
-		tmpbuf = (char*) malloc(buflen);
-		memcpy(tmpbuf, src, srcLen);
+		n = srcLen - i < MZAE_CHUNK ? srcLen - i : MZAE_CHUNK;
+		in = mzae_block(src, srcLen, i, n, block, stats);
+		if (crcpass)
+		{
+			MZAE_TIMER_START(stats, tm);
+			crc = MZAE_crc(crc, in, n);
+			MZAE_TIMER_STOP(stats, tm, MZAE_STAGE_CRC, n);
+		}
+		MZAE_TIMER_START(stats, tm);
+		if (MZAE_deflate_update(codec, in, n, 0, mzae_seal, &seal))
+			method = 0;
+		MZAE_TIMER_STOP(stats, tm, MZAE_STAGE_CODEC, n);
 	}
+	MZAE_TIMER_START(stats, tm);
+	if (method && codec && MZAE_deflate_update(codec, NULL, 0, 1, mzae_seal, &seal))
+		method = 0;
+	MZAE_deflate_free(codec);
+	MZAE_TIMER_STOP(stats, tm, MZAE_STAGE_CODEC, 0);
+
+	ret = mzae_seal_keys(&seal);
 
-	if (MZAE_ctr_crypt(aes_key, 32, tmpbuf, buflen, &ppbuf))
+	// Switch from Deflate to Store if skipped, error or disadvantage
+	if (!ret && method == 0)
 	{
-		free(tmpbuf);
-		return MZAE_ERR_AES;
+		if (*dstLen - over < srcLen)
+			ret = MZAE_ERR_BUFFER;
+
+		// Restarts the keystream and the HMAC over the raw data, which are
+		// encrypted from src straight into the archive
+		MZAE_ctr_reset(seal.ctr);
+		if (!ret && MZAE_hmac_reset(seal.hmac))
+			ret = MZAE_ERR_HMAC;
+
+		seal.len = 0;
+		seal.max = srcLen;
+		crc = 0;
+
+		for (i = 0; !ret && i < srcLen; i += n)
+		{
+			n = srcLen - i < MZAE_CHUNK ? srcLen - i : MZAE_CHUNK;
+			in = mzae_block(src, srcLen, i, n, block, stats);
+			if (crcpass)
+			{
+				MZAE_TIMER_START(stats, tm);
+				crc = MZAE_crc(crc, in, n);
+				MZAE_TIMER_STOP(stats, tm, MZAE_STAGE_CRC, n);
+			}
+			if (mzae_seal(&seal, in, n))
+				ret = seal.error ? seal.error : MZAE_ERR_HMAC;
+		}
 	}
 
-	if (MZAE_hmac_sha1_80(hmac_key, 32, ppbuf, buflen, &digest))
+	if (block)
 	{
-		free(tmpbuf);
-		return MZAE_ERR_HMAC;
+		memset(block, 0, MZAE_CHUNK);
+		MZAE_free(block);
 	}
 
+	buflen = seal.len;
 	p = *dst;
-	memcpy(p, ucLocalHeader, sizeof(ucLocalHeader));
 
-#ifdef BYTE_ORDER_1234
-	#define PDW(a, b) *((int*)(p+a)) = BS32(b)
-	#define PW(a, b) *((short*)(p+a)) = BS16(b)
-#else
-	#define PDW(a, b) *((int*)(p+a)) = b
-	#define PW(a, b) *((short*)(p+a)) = b
-#endif
+	// Copies salt, check word and HMAC around the encrypted data
+	memcpy(p + 45, salt, seal.saltlen);
+	memcpy(p + 45 + seal.saltlen, seal.keys + 4*seal.saltlen, 2);
+
+	memset(seal.keys, 0, MZAE_KEYS_SIZE);
+	MZAE_ctr_free(seal.ctr);
 
-	if (srcLen < 20)
+	MZAE_TIMER_START(stats, tm);
+	if (!ret && MZAE_hmac_final(seal.hmac, p + data + buflen))
+		ret = MZAE_ERR_HMAC;
+	else if (ret && seal.hmac)
+		MZAE_hmac_final(seal.hmac, NULL);
+	MZAE_TIMER_STOP(stats, tm, MZAE_STAGE_HMAC, 0);
+
+	if (ret)
 	{
-		PW(38, 2); // AE-2
-		crc = 0;
-	} 
-	else {
-		crc = MZAE_crc(0, src, srcLen);
+		MZAE_free(index);
+		return ret;
 	}
 
+	memcpy(p, ucLocalHeader, sizeof(ucLocalHeader));
+
 	// Builds the ZIP Local File Header
 #ifdef USE_TIME
 	time(&t);
@@ -250,17 +626,13 @@ int MiniZipAEWrite(char* src, unsigned long srcLen, char** dst, unsigned long *d
 	PW(12, (ptm->tm_year - 80) << 9 | (ptm->tm_mon+1) << 5 | ptm->tm_mday);
 #endif
 	PDW(14, crc);
-	PDW(18, buflen+28);
+	PDW(18, buflen + data - 45 + 10);
 	PDW(22, srcLen);
+	PW(38, ae);
+	p[42] = (char) (strength / 64 - 1);
 	PW(43, method);
 
-	// Copies the raw contents: salt, check word, encrypted data and HMAC
-	memcpy(p + 45, salt, 16);
-	memcpy(p + 61, vv, 2);
-	memcpy(p + 63, ppbuf, buflen);
-	memcpy(p + 63 + buflen, digest, 10);
-
-	p = *dst + 63 + buflen + 10;
+	p = *dst + data + buflen + 10;
 	memcpy(p, ucCentralHeader, sizeof(ucCentralHeader));
 
 	// Builds the ZIP Central File Header
@@ -269,52 +641,174 @@ int MiniZipAEWrite(char* src, unsigned long srcLen, char** dst, unsigned long *d
 	PW(14, (ptm->tm_year - 80) << 9 | (ptm->tm_mon+1) << 5 | ptm->tm_mday);
 #endif
 	PDW(16, crc);
-	PDW(20, buflen + 28);
+	PDW(20, buflen + data - 45 + 10);
 	PDW(24, srcLen);
-	if (srcLen < 20)
-		PW(54, 2); // AE-2
+	PW(54, ae);
+	p[58] = (char) (strength / 64 - 1);
 	PW(59, method);
 
-	p += 61;
+	// The sync point index follows the AES header, if Deflate was kept
+	if (method && points)
+	{
+		PW(30, 11 + ixlen);
+		PW(61, MZAE_INDEX_ID);
+		PW(63, ixlen - 4);
+		for (i = 0; i < points; i++)
+		{
+			PDW(65 + 8*i, index[i]);
+			PDW(69 + 8*i, (i + 1) * sync);
+		}
+	}
+	else
+		ixlen = 0;
+	MZAE_free(index);
+
+	p += 61 + ixlen;
 	memcpy(p, ucEndHeader, sizeof(ucEndHeader));
 	
 	// Builds the End Of Central Dir Record
-	PDW(16, 63 + buflen + 10);
+	PDW(12, 61 + ixlen);
+	PDW(16, data + buflen + 10);
+
+	*dstLen = data + buflen + 10 + 61 + ixlen + 23;
 
-	free(tmpbuf);
-	free(ppbuf);
+	if (stats)
+	{
+		stats->bytes_in = srcLen;
+		stats->bytes_out = *dstLen;
+		stats->ratio = (double) buflen / srcLen;
+		stats->profile = profile;
+		stats->level = method ? mzae_profiles[profile].level : 0;
+		stats->ae = ae;
+		stats->strength = strength;
+		stats->entropy = entropy;
+		stats->threads = method ? threads : 0;
+	}
 	
 	return MZAE_ERR_SUCCESS;
 }
 
+int MiniZipAEWriteEx(char* src, unsigned long srcLen, char** dst, unsigned long *dstLen, char* password, MZAE_OPTIONS* options)
+{
+	MZAE_STATS* stats = options? options->stats : NULL;
+	MZAE_ARENA* arena = options? options->arena : NULL;
+	MZAE_SCOPE scope;
+	int ret;
+
+	if (!stats && !arena)
+		return mzae_write(src, srcLen, dst, dstLen, password, options, NULL);
+
+	if (stats)
+		MZAE_stats_begin(stats);
+	MZAE_scope_enter(stats, arena, &scope);
+	ret = mzae_write(src, srcLen, dst, dstLen, password, options, stats);
+	MZAE_scope_leave(&scope);
+	if (stats)
+		MZAE_stats_end(stats);
+
+	return ret;
+}
+
+// Returns the offset of the (single) Central Directory entry, or -1
+static long mzae_find_central(char* src, unsigned long srcLen)
+{
+	long i, cd;
+
+	// Looks for the End Of Central Dir Record, skipping its comment
+	for (i = srcLen - 22; i >= 0 && srcLen - i < 22 + 65536; i--)
+	{
+		if (GDW(i) != 0x06054B50)
+			continue;
+		cd = GDW(i+16);
+		if (cd < 0 || cd + 46 > i || GDW(cd) != 0x02014B50)
+			return -1;
+		return cd;
+	}
+
+	return -1;
+}
+
+// Returns the sync point index of a Deflated archive, in pairs of offsets
+// (into the Deflate data and into the document), or NULL
+static unsigned long* mzae_find_index(char* src, unsigned long srcLen, unsigned int* points)
+{
+	unsigned long* index;
+	long cd = mzae_find_central(src, srcLen);
+	unsigned long i, end;
+	unsigned int n;
+
+	if (cd < 0 || GW(cd+10) != 99)
+		return NULL;
+
+	// Looks for the index among the extra fields
+	i = cd + 46 + GW(cd+28);
+	end = i + GW(cd+30);
+	if (end > srcLen)
+		return NULL;
+	for (; i + 4 <= end; i += 4 + GW(i+2))
+		if (GW(i) == MZAE_INDEX_ID)
+			break;
+	if (i + 4 > end || i + 4 + GW(i+2) > end || !GW(i+2) || GW(i+2) % 8)
+		return NULL;
+
+	*points = GW(i+2) / 8;
+	index = (unsigned long*) MZAE_malloc(2 * *points * sizeof(unsigned long));
+	for (n = 0; index && n < 2 * *points; n++)
+		index[n] = GDW(i + 4 + 4*n);
+
+	return index;
+}
+
+static void mzae_reader_setup(MZAE_READER* r, char* out, unsigned long* index, unsigned int points, int reverse, MZAE_KDF* kdf, MZAE_STATS* stats);
+
+// A sink copying into a buffer of known size, or reversing from its end
+struct mzae_span {
+	char* buf;
+	unsigned long len, max;
+	int reverse;
+};
+
+static int mzae_span_sink(void* opaque, char* buf, unsigned int len)
+{
+	struct mzae_span* s = (struct mzae_span*) opaque;
+
+	if (len > s->max - s->len)
+		return 1;
+	if (s->reverse)
+		MZAE_memrev(s->buf + s->max - s->len - len, buf, len);
+	else
+		memcpy(s->buf + s->len, buf, len);
+	s->len += len;
+
+	return 0;
+}
+
 int MiniZipAERead(char* src, unsigned long srcLen, char** dst, unsigned long *dstLen, char* password)
 {
-	long crc = 0;
+	return MiniZipAEReadEx(src, srcLen, dst, dstLen, password, NULL);
+}
+
+static int mzae_read(char* src, unsigned long srcLen, char** dst, unsigned long *dstLen, char* password, int reverse, MZAE_KDF** kdf, MZAE_STATS* stats)
+{
+	long info = 14;
 	unsigned long compSize, uncompSize, keyLen;
-	char *salt, *compdata;
-	char* aes_key;
-	char* hmac_key;
-	char* vv;
-	char *digest, *pbuf;
+	struct mzae_span span;
+	MZAE_READER* reader;
+	unsigned long* index;
+	unsigned int points = 0;
+	int ret;
 
 	if (!srcLen)
 		return MZAE_ERR_PARAMS;
 
-#ifdef BYTE_ORDER_1234
-	#define GDW(a) BS32(*((unsigned int*)(src+a)))
-	#define GW(a) BS16(*((unsigned short*)(src+a)))
-#else
-	#define GDW(a) *((unsigned int*)(src+a))
-	#define GW(a) *((unsigned short*)(src+a))
-#endif
-
-	// Some sanity checks to ensure it is a compatible ZIP
-	if (srcLen < 151)
+	// Some sanity checks to ensure it is a compatible ZIP (the smallest one
+	// stores a byte with AES-128)
+	if (srcLen < 45+8+2+1+10+61+23)
 		return MZAE_ERR_BADZIP;
 
 	keyLen = *((char*)(src + 42));
 
-	if (! (0 < keyLen < 4))
+	if (keyLen < 1 || keyLen > 3)
 		return MZAE_ERR_BADZIP;
 
 	// Here a ZIP with item name >4 (field 26) is bad, too
@@ -322,8 +816,20 @@ int MiniZipAERead(char* src, unsigned long srcLen, char** dst, unsigned long *ds
 		GW(28) != 11 || GW(34) != 0x9901 || GW(38) > 2 || GW(40) != 0x4541)
 		return MZAE_ERR_BADZIP;
 
-	compSize = GDW(18)-(12+(4+keyLen*4)); // size & offset depend on salt size!
-	uncompSize = GDW(22);
+	// A streamed archive has CRC and sizes in the Central Directory only
+	if (GW(6) & 8)
+	{
+		info = mzae_find_central(src, srcLen);
+		if (info < 0)
+			return MZAE_ERR_BADZIP;
+		info += 16;
+	}
+
+	compSize = GDW(info+4)-(12+(4+keyLen*4)); // size & offset depend on salt size!
+	uncompSize = GDW(info+8);
+
+	if (compSize > srcLen || 45+(4+keyLen*4)+2+compSize+10 > srcLen)
+		return MZAE_ERR_BADZIP;
 
 	if (! *dstLen)
 	{
@@ -337,80 +843,1620 @@ int MiniZipAERead(char* src, unsigned long srcLen, char** dst, unsigned long *ds
 	if (!password || !password[0])
 		return MZAE_ERR_NOPW;
 
-	salt = src + 45;
-	compdata = src+(45+(4+keyLen*4)+2);
-	
-	// Here we regenerate the AES key, the HMAC key and the 16-bit verification value
-	if (MZAE_derive_keys(password, salt, 4+keyLen*4, &aes_key, &hmac_key, &vv))
-		return MZAE_ERR_KDF;
-	
-	// Compares the 16-bit verification values
-	if (GW(45+(4+keyLen*4)) != *((unsigned short*)vv))
-		return MZAE_ERR_BADVV;
+	// Decrypts, authenticates, inflates and checks the CRC block by block
+	// in a single traversal, with the streaming reader
+	span.buf = *dst;
+	span.len = 0;
+	span.max = uncompSize;
+	span.reverse = reverse;
 
-	// Compares the HMACs
-	if (MZAE_hmac_sha1_80(hmac_key, 8*(keyLen+1), compdata, compSize, &digest))
-		return MZAE_ERR_HMAC;
-	if (memcmp(digest, compdata+compSize, 10))
-		return MZAE_ERR_BADHMAC;
+	if ((ret = MZAE_reader_init(&reader, password, mzae_span_sink, &span)))
+		return ret;
 
-	// Decrypts into a temporary buffer
-	if (MZAE_ctr_crypt(aes_key, 8*(keyLen+1), compdata, compSize, &pbuf))
-		return MZAE_ERR_AES;
-	
-	// Inflates if method <> zero
-	if (GW(43) != 0) {
-		if (MZAE_inflate(pbuf, compSize, *dst, uncompSize))
-			return MZAE_ERR_CODEC;
+	// The declared size was checked against *dstLen
+	index = mzae_find_index(src, srcLen, &points);
+	mzae_reader_setup(reader, *dst, index, points, reverse, *kdf, stats);
+	*kdf = NULL;
+
+	if ((ret = MZAE_reader_update(reader, src, srcLen)))
+		MZAE_reader_free(reader);
+	else
+		ret = MZAE_reader_final(reader);
+
+	// More data than declared
+	if (ret == MZAE_ERR_IO)
+		ret = MZAE_ERR_CODEC;
+
+	// Unauthenticated plaintext must not survive a failure
+	if (ret)
+		memset(*dst, 0, uncompSize);
+	else if (stats)
+	{
+		stats->bytes_in = srcLen;
+		stats->bytes_out = uncompSize;
+		stats->ratio = uncompSize ? (double) compSize / uncompSize : 1;
 	}
+
+	return ret;
+}
+
+int MiniZipAEReadEx(char* src, unsigned long srcLen, char** dst, unsigned long *dstLen, char* password, MZAE_OPTIONS* options)
+{
+	MZAE_KDF* kdf = (options && *dstLen)? options->kdf : NULL;
+	MZAE_STATS* stats = options? options->stats : NULL;
+	MZAE_ARENA* arena = options? options->arena : NULL;
+	int reverse = options? options->reverse : 0;
+	MZAE_SCOPE scope;
+	int ret;
+
+	if (!stats && !arena)
+		ret = mzae_read(src, srcLen, dst, dstLen, password, reverse, &kdf, NULL);
 	else
-		memcpy(*dst, pbuf, compSize);
+	{
+		if (stats)
+			MZAE_stats_begin(stats);
+		MZAE_scope_enter(stats, arena, &scope);
+		ret = mzae_read(src, srcLen, dst, dstLen, password, reverse, &kdf, stats);
+		MZAE_scope_leave(&scope);
+		if (stats)
+			MZAE_stats_end(stats);
+	}
+
+	// The job was not handed to the reader
+	if (kdf)
+		MZAE_kdf_join(kdf, NULL, 0, NULL);
+
+	return ret;
+}
 
-	// AE-1 encryption only
-	if (GW(38) == 1) {
-		crc = MZAE_crc(0, *dst, uncompSize);
 
-		// Compares the CRCs on uncompressed data
-		if (crc != GDW(14))
-			return MZAE_ERR_BADCRC;
+
+int MZAE_fd_sink(void* opaque, char* buf, unsigned int len)
+{
+	int fd = (int)(intptr_t) opaque;
+	int n;
+
+	while (len)
+	{
+		n = write(fd, buf, len);
+		if (n <= 0)
+			return 1;
+		buf += n;
+		len -= n;
 	}
 
-	free(pbuf);
+	return 0;
+}
 
-	return MZAE_ERR_SUCCESS;
+
+
+struct mzae_writer {
+	MZAE_SINK sink;
+	void* opaque;
+	MZAE_DEFLATE* codec;
+	MZAE_CTR* ctr;
+	MZAE_HMAC* hmac;
+	unsigned long crc;
+	unsigned long compSize;
+	unsigned long uncompSize;
+	unsigned short dostime, dosdate;
+	int error;
+	int ae;
+	unsigned int headLen;
+	char head[20];
+	char header[63];
+};
+
+
+
+// Encrypts and authenticates a piece of Deflate output, then forwards it
+static int mzae_writer_sink(void* opaque, char* buf, unsigned int len)
+{
+	MZAE_WRITER* w = (MZAE_WRITER*) opaque;
+
+	// ZIP64 is not supported: the central directory offset, the largest
+	// field, must fit 32 bits
+	if (len > 0xFFFFFFFFUL - 89 - w->compSize)
+	{
+		w->error = MZAE_ERR_PARAMS;
+		return 1;
+	}
+	w->compSize += len;
+
+	MZAE_ctr_update(w->ctr, buf, len, buf);
+	if (MZAE_hmac_update(w->hmac, buf, len))
+		return 1;
+
+	return w->sink(w->opaque, buf, len);
 }
 
 
 
-#ifdef MAIN
-#include <stdio.h>
-void main()
+int MZAE_writer_init(MZAE_WRITER** writer, char* password, MZAE_SINK sink, void* opaque)
 {
-#ifdef MAIN_SAVES
-	FILE *f = fopen("test.zip", "wb");
+	MZAE_WRITER* w;
+	char salt[16];
+	char keys[MZAE_KEYS_SIZE];
+	char *p;
+	int ret = MZAE_ERR_SUCCESS;
+#ifdef USE_TIME
+	time_t t;
+	struct tm *ptm;
 #endif
-	char *s = "Questo testo  la sorgente da comprimere e cifrare con MiniZipAEWrite, per poi verificarne l'uguaglianza con il prodotto di MiniZipAERead!";
-	char *out1, *out2;
-	long len1=0, len2=0, r;
-	r = MiniZipAEWrite(s, strlen(s), &out1, &len1, "kazookazaa");
-	printf("MiniZipAEWrite returned %d: %s (requires %d bytes buffer)\n", r, MZAE_errmsg(r), len1);
-	out1 = (char*) malloc(len1);
-	r = MiniZipAEWrite(s, strlen(s), &out1, &len1, "kazookazaa");
-	printf("MiniZipAEWrite returned %d: %s\n", r, MZAE_errmsg(r));
 
-	r = MiniZipAERead(out1, len1, &out2, &len2, "kazookazaa");
-	printf("MiniZipAERead returned %d: %s (requires %d bytes buffer)\n", r, MZAE_errmsg(r), len2);
-	out2 = (char*) malloc(len2);
-	r = MiniZipAERead(out1, len1, &out2, &len2, "kazookazaa");
-	printf("MiniZipAERead returned %d: %s\n", r, MZAE_errmsg(r));
+	if (!writer || !sink)
+		return MZAE_ERR_PARAMS;
 
-	if (len2 != strlen(s) || memcmp(s, out2, len2) != 0)
-		printf("SELF TEST FAILED!");
-	else
-		printf("SELF TEST PASSED!");
-#ifdef MAIN_SAVES
-	fwrite(out1, 1, len1, f);
-	fclose(f);
-#endif
+	if (!password || !password[0])
+		return MZAE_ERR_NOPW;
+
+	w = (MZAE_WRITER*) MZAE_calloc(1, sizeof(MZAE_WRITER));
+	if (!w)
+		return MZAE_ERR_NOMEM;
+
+	w->sink = sink;
+	w->opaque = opaque;
+
+	if (MZAE_gen_salt(salt, 16))
+	{
+		MZAE_free(w);
+		return MZAE_ERR_SALT;
+	}
+
+	// Encrypts with AES-256 always!
+	if (MZAE_derive_keys_into(password, salt, 16, keys))
+	{
+		MZAE_free(w);
+		return MZAE_ERR_KDF;
+	}
+
+	if (MZAE_ctr_init(&w->ctr, keys, 32))
+		ret = MZAE_ERR_AES;
+	else if (MZAE_hmac_init(&w->hmac, keys + 32, 32))
+		ret = MZAE_ERR_HMAC;
+	else if (MZAE_deflate_init(&w->codec))
+		ret = MZAE_ERR_CODEC;
+
+	p = w->header;
+	memcpy(p, ucLocalHeader, sizeof(ucLocalHeader));
+	memcpy(p + 45, salt, 16);
+	memcpy(p + 61, keys + 64, 2);
+
+	memset(keys, 0, MZAE_KEYS_SIZE);
+
+	if (ret)
+	{
+		MZAE_writer_free(w);
+		return ret;
+	}
+
+	// Builds the ZIP Local File Header: CRC and sizes go in the data descriptor
+#ifdef USE_TIME
+	time(&t);
+	ptm = localtime(&t);
+	w->dostime = ptm->tm_hour << 11 | ptm->tm_min << 5 | (ptm->tm_sec / 2);
+	w->dosdate = (ptm->tm_year - 80) << 9 | (ptm->tm_mon+1) << 5 | ptm->tm_mday;
+	PW(10, w->dostime);
+	PW(12, w->dosdate);
+#endif
+	PW(6, 9);
+
+	*writer = w;
+
+	return MZAE_ERR_SUCCESS;
+}
+
+
+
+// Emits the local header with the AE version, then the data held back
+static int mzae_writer_start(MZAE_WRITER* w, int ae)
+{
+	char* p = w->header;
+
+	w->ae = ae;
+	PW(38, ae);
+	if (w->sink(w->opaque, w->header, 63))
+		return MZAE_ERR_IO;
+
+	if (w->headLen && MZAE_deflate_update(w->codec, w->head, w->headLen, 0, mzae_writer_sink, w))
+		return w->error ? w->error : MZAE_ERR_CODEC;
+
+	return MZAE_ERR_SUCCESS;
+}
+
+
+
+int MZAE_writer_update(MZAE_WRITER* writer, char* src, unsigned int srclen)
+{
+	unsigned int n;
+	int ret;
+
+	if (!writer)
+		return MZAE_ERR_PARAMS;
+
+	if (!srclen)
+		return MZAE_ERR_SUCCESS;
+
+	// ZIP64 is not supported
+	if (srclen > 0xFFFFFFFFUL - writer->uncompSize)
+		return MZAE_ERR_PARAMS;
+
+	writer->uncompSize += srclen;
+	writer->crc = MZAE_crc(writer->crc, src, srclen);
+
+	// The AE version is known once 20 bytes have come
+	if (!writer->ae)
+	{
+		n = 20 - writer->headLen < srclen ? 20 - writer->headLen : srclen;
+		memcpy(writer->head + writer->headLen, src, n);
+		writer->headLen += n;
+		src += n;
+		srclen -= n;
+		if (writer->headLen < 20)
+			return MZAE_ERR_SUCCESS;
+		if ((ret = mzae_writer_start(writer, 1)))
+			return ret;
+		if (!srclen)
+			return MZAE_ERR_SUCCESS;
+	}
+
+	if (MZAE_deflate_update(writer->codec, src, srclen, 0, mzae_writer_sink, writer))
+		return writer->error ? writer->error : MZAE_ERR_CODEC;
+
+	return MZAE_ERR_SUCCESS;
+}
+
+
+
+int MZAE_writer_final(MZAE_WRITER* writer)
+{
+	MZAE_WRITER* w = writer;
+	char *p, trailer[10 + 16 + 61 + 22];
+	int ret;
+
+	if (!w)
+		return MZAE_ERR_PARAMS;
+
+	// AE-2 for a stream under 20 bytes, whose CRC could give it away
+	if (!w->ae && (ret = mzae_writer_start(w, 2)))
+	{
+		MZAE_writer_free(w);
+		return ret;
+	}
+	if (w->ae == 2)
+		w->crc = 0;
+
+	if (MZAE_deflate_update(w->codec, NULL, 0, 1, mzae_writer_sink, w))
+	{
+		ret = w->error ? w->error : MZAE_ERR_CODEC;
+		MZAE_writer_free(w);
+		return ret;
+	}
+
+	ret = MZAE_hmac_final(w->hmac, trailer);
+	w->hmac = NULL;
+	if (ret)
+	{
+		MZAE_writer_free(w);
+		return MZAE_ERR_HMAC;
+	}
+
+	// Builds the Data Descriptor
+	p = trailer + 10;
+	PDW(0, 0x08074B50);
+	PDW(4, w->crc);
+	PDW(8, w->compSize + 28);
+	PDW(12, w->uncompSize);
+
+	// Builds the ZIP Central File Header
+	p += 16;
+	memcpy(p, ucCentralHeader, sizeof(ucCentralHeader));
+#ifdef USE_TIME
+	PW(12, w->dostime);
+	PW(14, w->dosdate);
+#endif
+	PW(8, 9);
+	PDW(16, w->crc);
+	PDW(20, w->compSize + 28);
+	PDW(24, w->uncompSize);
+	PW(54, w->ae);
+
+	// Builds the End Of Central Dir Record, without comment
+	p += 61;
+	memcpy(p, ucEndHeader, 22);
+	PDW(16, 63 + w->compSize + 10 + 16);
+	PW(20, 0);
+
+	ret = w->sink(w->opaque, trailer, sizeof(trailer));
+	MZAE_writer_free(w);
+
+	return ret? MZAE_ERR_IO : MZAE_ERR_SUCCESS;
+}
+
+
+
+void MZAE_writer_free(MZAE_WRITER* writer)
+{
+	if (!writer)
+		return;
+
+	MZAE_deflate_free(writer->codec);
+	MZAE_ctr_free(writer->ctr);
+	if (writer->hmac)
+		MZAE_hmac_final(writer->hmac, NULL);
+	memset(writer->head, 0, sizeof(writer->head));
+	MZAE_free(writer);
+}
+
+
+
+enum { MZAE_RS_HEADER, MZAE_RS_DATA, MZAE_RS_TRAILER, MZAE_RS_DONE };
+
+struct mzae_reader {
+	MZAE_SINK sink;
+	void* opaque;
+	char* password;
+	MZAE_CTR* ctr;
+	MZAE_HMAC* hmac;
+	MZAE_INFLATE* codec;
+	MZAE_KDF* kdf; // keys being derived
+	int state, error;
+	unsigned int flags, version, method, keylen;
+	char salt[16], vv[2];
+	unsigned long crc, compSize, uncompSize; // as recorded in the archive
+	unsigned long crcOut, compIn, uncompOut; // as found
+	unsigned int have, need; // bytes collected in buf, and required
+	char* out; // if set, Stored data are decrypted here instead of the sink
+	const MZAE_CODEC* oneshot; // if set, inflates whole Deflated data into out
+	unsigned long* index; // if set, inflates its segments on several threads
+	unsigned int points; // entries (pairs) in index
+	int reverse; // if set, out receives the data byte reversed
+	char* comp; // whole Deflated data, decrypted
+	MZAE_STATS* stats; // or NULL
+	char buf[512];
+	char window[MZAE_CHUNK];
+};
+
+
+
+// Lets Stored data skip the sink, decrypting them straight into out, as
+// well as Deflated ones with a whole buffer codec or a sync point index
+// (which the reader owns), reversing them if asked; gives the keys
+// derivation started by the caller and the statistics to fill in
+static void mzae_reader_setup(MZAE_READER* r, char* out, unsigned long* index, unsigned int points, int reverse, MZAE_KDF* kdf, MZAE_STATS* stats)
+{
+	r->out = out;
+	if (MZAE_codec(-1) != MZAE_CODEC_ZLIB)
+		r->oneshot = MZAE_codec_get();
+	r->index = index;
+	r->points = index ? points : 0;
+	r->reverse = reverse;
+	r->kdf = kdf;
+	r->stats = stats;
+}
+
+
+
+// Checks the extracted data before forwarding it
+static int mzae_reader_sink(void* opaque, char* buf, unsigned int len)
+{
+	MZAE_READER* r = (MZAE_READER*) opaque;
+	MZAE_TIMER tm;
+
+	r->uncompOut += len;
+	if (r->version == 1)
+	{
+		MZAE_TIMER_START(r->stats, tm);
+		r->crcOut = MZAE_crc(r->crcOut, buf, len);
+		MZAE_TIMER_STOP(r->stats, tm, MZAE_STAGE_CRC, len);
+	}
+
+	return r->sink(r->opaque, buf, len);
+}
+
+
+
+// Parses the Local File Header, salt and verification value in 3 steps
+static int mzae_reader_header(MZAE_READER* r)
+{
+	char* src = r->buf;
+	unsigned int i, saltlen;
+
+	if (r->need == 30)
+	{
+		if (GDW(0) != 0x04034B50 || GW(8) != 99)
+			return MZAE_ERR_BADZIP;
+		r->need = 30 + GW(26) + GW(28);
+		if (r->need + 18 > sizeof(r->buf))
+			return MZAE_ERR_BADZIP;
+		r->flags = GW(6);
+		r->crc = GDW(14);
+		r->compSize = GDW(18);
+		r->uncompSize = GDW(22);
+		if (r->have < r->need)
+			return MZAE_ERR_SUCCESS;
+	}
+
+	if (!r->keylen)
+	{
+		// Looks for the AES extra field
+		for (i = 30 + GW(26); i + 11 <= r->need; i += 4 + GW(i+2))
+			if (GW(i) == 0x9901)
+				break;
+		if (i + 11 > r->need || GW(i+4) < 1 || GW(i+4) > 2 || GW(i+6) != 0x4541 ||
+			src[i+8] < 1 || src[i+8] > 3)
+			return MZAE_ERR_BADZIP;
+		r->version = GW(i+4);
+		r->keylen = 8*(src[i+8]+1);
+		r->method = GW(i+9);
+		if (r->method != 0 && r->method != 8)
+			return MZAE_ERR_BADZIP;
+		// Without sizes, only a Deflate stream can tell where data end
+		if ((r->flags & 8) && r->method != 8)
+			return MZAE_ERR_BADZIP;
+		r->need += r->keylen/2 + 2;
+		if (r->have < r->need)
+			return MZAE_ERR_SUCCESS;
+	}
+
+	saltlen = r->keylen/2;
+	i = r->need - saltlen - 2;
+	memcpy(r->salt, src + i, saltlen);
+	memcpy(r->vv, src + i + saltlen, 2);
+
+	// The keys are derived while the caller supplies the data, unless
+	// a derivation was started before
+	if (!r->kdf && MZAE_kdf_start(&r->kdf, r->password, r->salt, saltlen))
+		return MZAE_ERR_KDF;
+
+	if (!(r->flags & 8))
+	{
+		if (r->compSize < saltlen + 12)
+			return MZAE_ERR_BADZIP;
+		r->compSize -= saltlen + 12;
+	}
+
+	r->state = MZAE_RS_DATA;
+
+	return MZAE_ERR_SUCCESS;
+}
+
+
+
+// Waits for the AES key, the HMAC key and the 16-bit verification value,
+// and checks the latter
+static int mzae_reader_keys(MZAE_READER* r)
+{
+	char keys[MZAE_KEYS_SIZE];
+	unsigned int saltlen = r->keylen/2;
+	int ret;
+	MZAE_TIMER tm;
+
+	if (!r->kdf)
+		return MZAE_ERR_SUCCESS;
+
+	MZAE_TIMER_START(r->stats, tm);
+	ret = MZAE_kdf_join(r->kdf, r->salt, saltlen, keys);
+	r->kdf = NULL;
+
+	// The caller's derivation was for another salt
+	if (ret == -1)
+		ret = MZAE_derive_keys_into(r->password, r->salt, saltlen, keys);
+	MZAE_TIMER_STOP(r->stats, tm, MZAE_STAGE_KDF, 0);
+	memset(r->password, 0, strlen(r->password));
+	if (ret)
+		return MZAE_ERR_KDF;
+
+	if (memcmp(r->vv, keys + 2*r->keylen, 2))
+		ret = MZAE_ERR_BADVV;
+	else if (MZAE_ctr_init(&r->ctr, keys, r->keylen))
+		ret = MZAE_ERR_AES;
+	else if (MZAE_hmac_init(&r->hmac, keys + r->keylen, r->keylen))
+		ret = MZAE_ERR_HMAC;
+	else if (r->method && (r->oneshot || r->index) && !(r->flags & 8))
+	{
+		if (!(r->comp = (char*) MZAE_malloc(r->compSize ? r->compSize : 1)))
+			ret = MZAE_ERR_NOMEM;
+	}
+	else if (r->method && MZAE_inflate_init(&r->codec))
+		ret = MZAE_ERR_CODEC;
+
+	if (!ret && r->method && r->stats)
+		r->stats->threads = 1;
+
+	memset(keys, 0, MZAE_KEYS_SIZE);
+
+	return ret;
+}
+
+
+
+// Inflates the whole decrypted data into their final place: indexed
+// segments on several threads, CRC-ing them on the way, or the stream as
+// usual if the index does not hold; then reverses them in place if asked
+static int mzae_reader_inflate(MZAE_READER* r)
+{
+	const MZAE_CODEC* codec = r->oneshot ? r->oneshot : &MZAE_codec_zlib;
+	unsigned long i, n, crc;
+	unsigned int threads = MZAE_codec_threads(r->uncompSize);
+	MZAE_TIMER tm;
+
+	MZAE_TIMER_START(r->stats, tm);
+	if (r->index && !MZAE_inflate_parallel(threads, r->points + 1, r->index, r->comp, r->compSize,
+		r->out, r->uncompSize, r->version == 1 ? &crc : NULL))
+	{
+		MZAE_TIMER_STOP(r->stats, tm, MZAE_STAGE_CODEC, r->compSize);
+		r->uncompOut = r->uncompSize;
+		if (r->version == 1)
+			r->crcOut = crc;
+		if (r->stats)
+			r->stats->threads = threads < r->points + 1 ? threads : r->points + 1;
+	}
+	else
+	{
+		if (codec->inflate(r->comp, r->compSize, r->out, r->uncompSize))
+			return MZAE_ERR_CODEC;
+		MZAE_TIMER_STOP(r->stats, tm, MZAE_STAGE_CODEC, r->compSize);
+		r->uncompOut = r->uncompSize;
+
+		for (i = 0; r->version == 1 && i < r->uncompSize; i += n)
+		{
+			n = r->uncompSize - i < MZAE_CHUNK ? r->uncompSize - i : MZAE_CHUNK;
+			MZAE_TIMER_START(r->stats, tm);
+			r->crcOut = MZAE_crc(r->crcOut, r->out + i, n);
+			MZAE_TIMER_STOP(r->stats, tm, MZAE_STAGE_CRC, n);
+		}
+	}
+
+	if (r->reverse)
+	{
+		MZAE_TIMER_START(r->stats, tm);
+		MZAE_memrev(r->out, r->out, r->uncompSize);
+		MZAE_TIMER_STOP(r->stats, tm, MZAE_STAGE_CODEC, 0);
+	}
+
+	return MZAE_ERR_SUCCESS;
+}
+
+
+
+// Decrypts, decompresses and authenticates a chunk of encrypted data
+static int mzae_reader_data(MZAE_READER* r, char* src, unsigned int srclen, unsigned int* used)
+{
+	unsigned int n, m;
+	char* p;
+	int ret;
+	MZAE_TIMER tm;
+
+	*used = 0;
+
+	// Keys are needed from now on
+	if ((ret = mzae_reader_keys(r)))
+		return ret;
+
+	if (!(r->flags & 8) && srclen > r->compSize - r->compIn)
+		srclen = r->compSize - r->compIn;
+
+	while (srclen && ret == 0)
+	{
+		n = srclen < MZAE_CHUNK ? srclen : MZAE_CHUNK;
+
+		// Deflated data in memory are collected, and inflated at the end
+		if (r->comp)
+		{
+			MZAE_TIMER_START(r->stats, tm);
+			MZAE_ctr_update(r->ctr, src, n, r->comp + r->compIn);
+			MZAE_TIMER_STOP(r->stats, tm, MZAE_STAGE_AES, n);
+			MZAE_TIMER_START(r->stats, tm);
+			if (MZAE_hmac_update(r->hmac, src, n))
+				return MZAE_ERR_HMAC;
+			MZAE_TIMER_STOP(r->stats, tm, MZAE_STAGE_HMAC, n);
+			r->compIn += n;
+			*used += n;
+			src += n;
+			srclen -= n;
+			if (r->compIn == r->compSize)
+			{
+				if ((ret = mzae_reader_inflate(r)))
+					return ret;
+				ret = 1;
+			}
+			continue;
+		}
+
+		// Stored data in memory go to their final place with one write, or
+		// through the window if reversed
+		if (r->out && !r->method)
+		{
+			// Stored entries are never streamed: the size is the checked one
+			if (n > r->uncompSize - r->uncompOut)
+				return MZAE_ERR_IO;
+			p = r->reverse ? r->window : r->out + r->uncompOut;
+			MZAE_TIMER_START(r->stats, tm);
+			MZAE_ctr_update(r->ctr, src, n, p);
+			MZAE_TIMER_STOP(r->stats, tm, MZAE_STAGE_AES, n);
+			if (r->version == 1)
+			{
+				MZAE_TIMER_START(r->stats, tm);
+				r->crcOut = MZAE_crc(r->crcOut, p, n);
+				MZAE_TIMER_STOP(r->stats, tm, MZAE_STAGE_CRC, n);
+			}
+			if (r->reverse)
+			{
+				MZAE_TIMER_START(r->stats, tm);
+				MZAE_memrev(r->out + r->uncompSize - r->uncompOut - n, p, n);
+				MZAE_TIMER_STOP(r->stats, tm, MZAE_STAGE_CODEC, 0);
+			}
+			r->uncompOut += n;
+			MZAE_TIMER_START(r->stats, tm);
+			if (MZAE_hmac_update(r->hmac, src, n))
+				return MZAE_ERR_HMAC;
+			MZAE_TIMER_STOP(r->stats, tm, MZAE_STAGE_HMAC, n);
+			r->compIn += n;
+			*used += n;
+			src += n;
+			srclen -= n;
+			continue;
+		}
+
+		MZAE_TIMER_START(r->stats, tm);
+		MZAE_ctr_update(r->ctr, src, n, r->window);
+		MZAE_TIMER_STOP(r->stats, tm, MZAE_STAGE_AES, n);
+
+		if (r->method)
+		{
+			MZAE_TIMER_START(r->stats, tm);
+			ret = MZAE_inflate_update(r->codec, r->window, n, &m, mzae_reader_sink, r);
+			if (ret == 2)
+				return MZAE_ERR_CODEC;
+			if (ret == 3)
+				return MZAE_ERR_IO;
+			MZAE_TIMER_STOP(r->stats, tm, MZAE_STAGE_CODEC, m);
+		}
+		else
+		{
+			m = n;
+			if (mzae_reader_sink(r, r->window, n))
+				return MZAE_ERR_IO;
+		}
+
+		// Authenticates only what belonged to the Deflate stream
+		MZAE_TIMER_START(r->stats, tm);
+		if (MZAE_hmac_update(r->hmac, src, m))
+			return MZAE_ERR_HMAC;
+		MZAE_TIMER_STOP(r->stats, tm, MZAE_STAGE_HMAC, m);
+
+		r->compIn += m;
+		*used += m;
+		src += m;
+		srclen -= m;
+	}
+
+	if (ret == 1 || (!(r->flags & 8) && r->compIn == r->compSize))
+	{
+		// The Deflate stream must end exactly with the encrypted data
+		if (!(r->flags & 8) && (r->compIn != r->compSize || (r->method && ret != 1)))
+			return MZAE_ERR_CODEC;
+		r->state = MZAE_RS_TRAILER;
+		r->have = 0;
+		r->need = (r->flags & 8)? 10 + 16 : 10;
+	}
+
+	return MZAE_ERR_SUCCESS;
+}
+
+
+
+// Parses HMAC and, if present, the data descriptor
+static int mzae_reader_trailer(MZAE_READER* r)
+{
+	char* src = r->buf;
+	unsigned int i;
+
+	if (r->flags & 8)
+	{
+		// The data descriptor signature is optional
+		i = (GDW(10) == 0x08074B50)? 14 : 10;
+		r->crc = GDW(i);
+		r->compSize = GDW(i+4);
+		r->uncompSize = GDW(i+8);
+		if (r->compSize != r->compIn + r->keylen/2 + 12)
+			return MZAE_ERR_BADZIP;
+	}
+
+	r->state = MZAE_RS_DONE;
+
+	return MZAE_ERR_SUCCESS;
+}
+
+
+
+int MZAE_reader_init(MZAE_READER** reader, char* password, MZAE_SINK sink, void* opaque)
+{
+	MZAE_READER* r;
+
+	if (!reader || !sink)
+		return MZAE_ERR_PARAMS;
+
+	if (!password || !password[0])
+		return MZAE_ERR_NOPW;
+
+	r = (MZAE_READER*) MZAE_calloc(1, sizeof(MZAE_READER));
+	if (!r)
+		return MZAE_ERR_NOMEM;
+
+	r->password = (char*) MZAE_malloc(strlen(password) + 1);
+	if (!r->password)
+	{
+		MZAE_free(r);
+		return MZAE_ERR_NOMEM;
+	}
+	strcpy(r->password, password);
+
+	r->sink = sink;
+	r->opaque = opaque;
+	r->state = MZAE_RS_HEADER;
+	r->need = 30;
+	*reader = r;
+
+	return MZAE_ERR_SUCCESS;
+}
+
+
+
+int MZAE_reader_update(MZAE_READER* reader, char* src, unsigned int srclen)
+{
+	MZAE_READER* r = reader;
+	unsigned int n;
+	int ret = MZAE_ERR_SUCCESS;
+
+	if (!r)
+		return MZAE_ERR_PARAMS;
+
+	while (srclen && !r->error)
+	{
+		switch (r->state)
+		{
+		case MZAE_RS_HEADER:
+		case MZAE_RS_TRAILER:
+			n = r->need - r->have;
+			if (n > srclen)
+				n = srclen;
+			memcpy(r->buf + r->have, src, n);
+			r->have += n;
+			if (r->have == r->need)
+				ret = (r->state == MZAE_RS_HEADER)? mzae_reader_header(r) : mzae_reader_trailer(r);
+			break;
+		case MZAE_RS_DATA:
+			ret = mzae_reader_data(r, src, srclen, &n);
+			break;
+		default:
+			// Central Directory and End Record are not needed
+			return MZAE_ERR_SUCCESS;
+		}
+		src += n;
+		srclen -= n;
+		r->error = ret;
+	}
+
+	return r->error;
+}
+
+
+
+int MZAE_reader_fd(MZAE_READER* reader, int fd)
+{
+	char buf[MZAE_CHUNK];
+	int n, ret;
+
+	while ((n = read(fd, buf, sizeof(buf))) > 0)
+		if ((ret = MZAE_reader_update(reader, buf, n)))
+			return ret;
+
+	return n < 0? MZAE_ERR_IO : MZAE_ERR_SUCCESS;
+}
+
+
+
+int MZAE_reader_final(MZAE_READER* reader)
+{
+	MZAE_READER* r = reader;
+	char digest[10];
+	int ret;
+	MZAE_TIMER tm;
+
+	if (!r)
+		return MZAE_ERR_PARAMS;
+
+	ret = r->error;
+	if (!ret && r->state != MZAE_RS_DONE)
+		ret = MZAE_ERR_BADZIP;
+
+	// No data at all
+	if (!ret)
+		ret = mzae_reader_keys(r);
+
+	if (!ret)
+	{
+		MZAE_TIMER_START(r->stats, tm);
+		ret = MZAE_hmac_final(r->hmac, digest);
+		r->hmac = NULL;
+		MZAE_TIMER_STOP(r->stats, tm, MZAE_STAGE_HMAC, 0);
+		if (ret)
+			ret = MZAE_ERR_HMAC;
+		else if (memcmp(digest, r->buf, 10))
+			ret = MZAE_ERR_BADHMAC;
+		else if (r->uncompOut != r->uncompSize)
+			ret = MZAE_ERR_CODEC;
+		else if (r->version == 1 && r->crcOut != r->crc)
+			ret = MZAE_ERR_BADCRC;
+	}
+
+	MZAE_reader_free(r);
+
+	return ret;
+}
+
+
+
+void MZAE_reader_free(MZAE_READER* reader)
+{
+	if (!reader)
+		return;
+
+	if (reader->kdf)
+		MZAE_kdf_join(reader->kdf, NULL, 0, NULL);
+	MZAE_inflate_free(reader->codec);
+	MZAE_free(reader->index);
+	if (reader->comp)
+	{
+		memset(reader->comp, 0, reader->compSize);
+		MZAE_free(reader->comp);
+	}
+	MZAE_ctr_free(reader->ctr);
+	if (reader->hmac)
+		MZAE_hmac_final(reader->hmac, NULL);
+	memset(reader->password, 0, strlen(reader->password));
+	MZAE_free(reader->password);
+	memset(reader->window, 0, MZAE_CHUNK);
+	MZAE_free(reader);
+}
+
+
+
+#ifdef MAIN
+#include <stdio.h>
+struct mem_sink { char buf[4096]; unsigned long len; };
+
+static int mem_sink(void* opaque, char* buf, unsigned int len)
+{
+	struct mem_sink* m = (struct mem_sink*) opaque;
+	if (m->len + len > sizeof(m->buf))
+		return 1;
+	memcpy(m->buf + m->len, buf, len);
+	m->len += len;
+	return 0;
+}
+
+void main()
+{
+#ifdef MAIN_SAVES
+	FILE *f = fopen("test.zip", "wb");
+#endif
+	char *s = "Questo testo  la sorgente da comprimere e cifrare con MiniZipAEWrite, per poi verificarne l'uguaglianza con il prodotto di MiniZipAERead!";
+	char *out1, *out2;
+	long len1=0, len2=0, r;
+	r = MiniZipAEWrite(s, strlen(s), &out1, &len1, "kazookazaa");
+	printf("MiniZipAEWrite returned %d: %s (requires %d bytes buffer)\n", r, MZAE_errmsg(r), len1);
+	out1 = (char*) malloc(len1);
+	r = MiniZipAEWrite(s, strlen(s), &out1, &len1, "kazookazaa");
+	printf("MiniZipAEWrite returned %d: %s\n", r, MZAE_errmsg(r));
+
+	r = MiniZipAERead(out1, len1, &out2, &len2, "kazookazaa");
+	printf("MiniZipAERead returned %d: %s (requires %d bytes buffer)\n", r, MZAE_errmsg(r), len2);
+	out2 = (char*) malloc(len2);
+	{
+		MZAE_STATS st;
+		MZAE_OPTIONS opts = {0};
+
+		opts.stats = &st;
+		r = MiniZipAEReadEx(out1, len1, &out2, &len2, "kazookazaa", &opts);
+		printf("MiniZipAERead returned %d: %s\n", r, MZAE_errmsg(r));
+		printf("  %llu ns (KDF %llu, CRC %llu, Inflate %llu, AES %llu, HMAC %llu), ratio %.2f, %u allocations, %lu bytes peak\n",
+			st.total_ns, st.ns[MZAE_STAGE_KDF], st.ns[MZAE_STAGE_CRC], st.ns[MZAE_STAGE_CODEC], st.ns[MZAE_STAGE_AES],
+			st.ns[MZAE_STAGE_HMAC], st.ratio, st.allocs, st.peak_scratch);
+		if (!r && (st.bytes_out != len2 || st.scratch))
+			r = 1;
+	}
+
+	if (r || len2 != strlen(s) || memcmp(s, out2, len2) != 0)
+		printf("SELF TEST FAILED!");
+	else
+		printf("SELF TEST PASSED!\n");
+
+	{
+		struct mem_sink ms;
+		MZAE_WRITER* w;
+		long i;
+
+		ms.len = 0;
+		r = MZAE_writer_init(&w, "kazookazaa", mem_sink, &ms);
+		for (i = 0; !r && i < strlen(s); i += 7)
+			r = MZAE_writer_update(w, s + i, strlen(s) - i < 7 ? strlen(s) - i : 7);
+		if (!r)
+			r = MZAE_writer_final(w);
+		printf("MZAE_writer returned %d: %s (%d bytes)\n", r, MZAE_errmsg(r), ms.len);
+
+		len2 = strlen(s);
+		r = MiniZipAERead(ms.buf, ms.len, &out2, &len2, "kazookazaa");
+		printf("MiniZipAERead returned %d: %s\n", r, MZAE_errmsg(r));
+
+		if (!r)
+		{
+			MZAE_READER* rd;
+			struct mem_sink ms2;
+
+			ms2.len = 0;
+			r = MZAE_reader_init(&rd, "kazookazaa", mem_sink, &ms2);
+			for (i = 0; !r && i < ms.len; i += 5)
+				r = MZAE_reader_update(rd, ms.buf + i, ms.len - i < 5 ? ms.len - i : 5);
+			r = r ? r : MZAE_reader_final(rd);
+			printf("MZAE_reader returned %d: %s\n", r, MZAE_errmsg(r));
+			if (!r && (ms2.len != strlen(s) || memcmp(s, ms2.buf, ms2.len)))
+				r = 1;
+		}
+		if (!r && memcmp(s, out2, len2) != 0)
+			r = 1;
+
+		// Streams under 20 bytes are AE-2, without CRC, written in two pieces
+		for (i = 5; !r && i <= 21; i += i < 19 ? 14 : 1)
+		{
+			ms.len = 0;
+			r = MZAE_writer_init(&w, "kazookazaa", mem_sink, &ms);
+			if (!r)
+				r = MZAE_writer_update(w, s, 3);
+			if (!r)
+				r = MZAE_writer_update(w, s + 3, i - 3);
+			if (!r)
+				r = MZAE_writer_final(w);
+			len2 = i;
+			if (!r)
+				r = MiniZipAERead(ms.buf, ms.len, &out2, &len2, "kazookazaa");
+			if (!r && (ms.buf[38] != (i < 20 ? 2 : 1) || len2 != i || memcmp(s, out2, i)))
+				r = 1;
+		}
+
+		if (r)
+			printf("STREAM SELF TEST FAILED!");
+		else
+			printf("STREAM SELF TEST PASSED!");
+	}
+
+	// Every profile with every key strength
+	{
+		MZAE_STATS st;
+		MZAE_OPTIONS opts = {0};
+		char buf[1024], *zip = buf;
+		long zlen;
+
+		opts.stats = &st;
+		for (r = 0, opts.profile = 0; !r && opts.profile < MZAE_PROFILES; opts.profile++)
+			for (opts.strength = 128; !r && opts.strength <= 256; opts.strength += 64)
+			{
+				zlen = sizeof(buf);
+				r = MiniZipAEWriteEx(s, strlen(s), &zip, &zlen, "kazookazaa", &opts);
+				printf("\n%s AES-%d returned %d: %s (%d bytes, AE-%d, level %d)", MZAE_profile_name(st.profile),
+					st.strength, r, MZAE_errmsg(r), zlen, st.ae, st.level);
+				if (!r && (st.strength != opts.strength || st.ae != (opts.profile == MZAE_PROFILE_FAST ? 2 : 1)))
+					r = 1;
+				len2 = strlen(s);
+				if (!r)
+					r = MiniZipAERead(zip, zlen, &out2, &len2, "kazookazaa");
+				if (!r && (len2 != strlen(s) || memcmp(s, out2, len2)))
+					r = 1;
+			}
+
+		if (r)
+			printf("\nPROFILES SELF TEST FAILED!");
+		else
+			printf("\nPROFILES SELF TEST PASSED!");
+	}
+
+	// Random data are stored up front, text is deflated
+	{
+		MZAE_STATS st;
+		MZAE_OPTIONS opts = {0};
+		static char src[65536], zip[65536 + 200];
+		char *z = zip, *o;
+		unsigned long i, x = 12345, zlen, olen;
+
+		opts.stats = &st;
+		for (i = 0, r = 0; i < sizeof(src); i++)
+			x = x * 1103515245 + 12345, src[i] = (char)(x >> 16);
+		for (opts.method = MZAE_METHOD_AUTO; !r && opts.method <= MZAE_METHOD_STORE; opts.method++)
+		{
+			zlen = sizeof(zip);
+			r = MiniZipAEWriteEx(src, sizeof(src), &z, &zlen, "kazookazaa", &opts);
+			printf("\nmethod %d on random data returned %d: %s (entropy %.3f, skipped %d)", opts.method, r, MZAE_errmsg(r), st.entropy, st.skipped);
+			if (!r && st.skipped != (opts.method != MZAE_METHOD_DEFLATE))
+				r = 1;
+		}
+		if (!r)
+		{
+			o = (char*) malloc(sizeof(src));
+			olen = sizeof(src);
+			r = o ? MiniZipAERead(zip, zlen, &o, &olen, "kazookazaa") : 1;
+			for (i = 0, x = 12345; !r && i < olen; i++)
+				if (x = x * 1103515245 + 12345, o[i] != (char)(x >> 16))
+					r = 1;
+			free(o);
+		}
+		for (i = 0; !r && i < sizeof(src); i++)
+			src[i] = s[i % strlen(s)];
+		opts.method = MZAE_METHOD_AUTO;
+		zlen = sizeof(zip);
+		if (!r)
+			r = MiniZipAEWriteEx(src, sizeof(src), &z, &zlen, "kazookazaa", &opts);
+		printf("\nmethod 0 on text returned %d: %s (entropy %.3f, skipped %d)", r, MZAE_errmsg(r), st.entropy, st.skipped);
+		if (r || st.skipped || st.level != 8)
+			printf("\nSTORE SELF TEST FAILED!");
+		else
+			printf("\nSTORE SELF TEST PASSED!");
+	}
+
+	// Archives written with each codec built in are read with each one
+	{
+		static char src[200000], zip[200000 + 200], out[200000];
+		char *z = zip, *o = out;
+		unsigned long i, zlen, olen;
+		int w, rd;
+
+		for (i = 0; i < sizeof(src); i++)
+			src[i] = s[i % strlen(s)] + (char)(i / 1000);
+		for (r = 0, w = MZAE_CODEC_ZLIB; !r && w < MZAE_CODECS; w++)
+			for (rd = MZAE_CODEC_ZLIB; MZAE_codec_name(w) && !r && rd < MZAE_CODECS; rd++)
+			{
+				if (!MZAE_codec_name(rd))
+					continue;
+				MZAE_codec(w);
+				zlen = sizeof(zip);
+				r = MiniZipAEWrite(src, sizeof(src), &z, &zlen, "kazookazaa");
+				MZAE_codec(rd);
+				olen = sizeof(out);
+				if (!r)
+					r = MiniZipAERead(zip, zlen, &o, &olen, "kazookazaa");
+				printf("\nwritten with %s (%lu bytes), read with %s: %d", MZAE_codec_name(w), zlen, MZAE_codec_name(rd), r);
+				if (!r && (olen != sizeof(src) || memcmp(src, out, olen)))
+					r = 1;
+			}
+		MZAE_codec(MZAE_CODEC_AUTO);
+
+		if (r)
+			printf("\nCODEC SELF TEST FAILED!");
+		else
+			printf("\nCODEC SELF TEST PASSED!");
+	}
+
+	// Slices deflated by four threads chain into one stream, read by any
+	// codec, barely larger than the serial one
+	{
+		MZAE_STATS st;
+		MZAE_OPTIONS opts = {0};
+		static char src[1280 << 10], zip[(1280 << 10) + 200], out[1280 << 10];
+		char *z = zip, *o = out, *d1 = NULL, *d2 = NULL;
+		unsigned long i, x = 12345, zlen, olen;
+		unsigned int n1 = 0, n2 = 0;
+		int rd;
+
+		// Text, with a random stretch across the second slice boundary
+		for (i = 0; i < sizeof(src); i++)
+			src[i] = s[i % strlen(s)] + (char)(i / 4096);
+		for (i = 600 << 10; i < 700 << 10; i++)
+			x = x * 1103515245 + 12345, src[i] = (char)(x >> 16);
+
+		opts.stats = &st;
+		MZAE_deflate_threads(1, 4);
+		zlen = sizeof(zip);
+		r = MiniZipAEWriteEx(src, sizeof(src), &z, &zlen, "kazookazaa", &opts);
+		printf("\nparallel write returned %d: %s (%lu bytes, %d threads)", r, MZAE_errmsg(r), zlen, st.threads);
+		if (!r && st.threads != 4)
+			r = 1;
+		for (rd = MZAE_CODEC_ZLIB; !r && rd < MZAE_CODECS; rd++)
+		{
+			if (!MZAE_codec_name(rd))
+				continue;
+			MZAE_codec(rd);
+			olen = sizeof(out);
+			r = MiniZipAERead(zip, zlen, &o, &olen, "kazookazaa");
+			printf("\nread with %s: %d", MZAE_codec_name(rd), r);
+			if (!r && (olen != sizeof(src) || memcmp(src, out, olen)))
+				r = 1;
+		}
+		MZAE_codec(MZAE_CODEC_AUTO);
+
+		if (!r)
+			r = MZAE_deflate(src, sizeof(src), &d1, &n1) || MZAE_inflate(d1, n1, out, sizeof(out)) || memcmp(src, out, sizeof(src));
+		MZAE_deflate_threads(1 << 20, 0);
+		MZAE_codec(MZAE_CODEC_ZLIB);
+		if (!r)
+			r = MZAE_deflate(src, sizeof(src), &d2, &n2);
+		MZAE_codec(MZAE_CODEC_AUTO);
+		printf("\nMZAE_deflate: %u bytes by slices, %u serially", n1, n2);
+		if (!r && n1 > n2 + n2 / 100)
+			r = 1;
+		free(d1);
+		free(d2);
+
+		if (r)
+			printf("\nPARALLEL SELF TEST FAILED!");
+		else
+			printf("\nPARALLEL SELF TEST PASSED!");
+	}
+
+	// Indexed segments are inflated by four threads; a broken index falls
+	// back to the whole stream
+	{
+		MZAE_STATS st;
+		MZAE_OPTIONS opts = {0};
+		static char src[1536 << 10], zip[(1536 << 10) + 400], out[1536 << 10];
+		char *z = zip, *o = out;
+		unsigned long i, x = 54321, zlen, olen, cd;
+		int rd, pass;
+
+		for (i = 0; i < sizeof(src); i++)
+			src[i] = s[i % strlen(s)] + (char)(i / 5000);
+		for (i = 300 << 10; i < 400 << 10; i++)
+			x = x * 1103515245 + 12345, src[i] = (char)(x >> 16);
+
+		opts.stats = &st;
+		opts.sync = 256 << 10;
+		MZAE_deflate_threads(1, 4);
+		for (r = 0, pass = 0; !r && pass < 4; pass++)
+		{
+			// Balanced and fast profiles, then a shifted sync point
+			opts.profile = pass & 1 ? MZAE_PROFILE_FAST : MZAE_PROFILE_BALANCED;
+			zlen = sizeof(zip);
+			r = MiniZipAEWriteEx(src, sizeof(src), &z, &zlen, "kazookazaa", &opts);
+			cd = zlen - 23 - (61 + 4 + 5*8);
+			printf("\nindexed write (%s) returned %d: %s (%lu bytes)", MZAE_profile_name(opts.profile), r, MZAE_errmsg(r), zlen);
+			if (!r && (zip[cd + 30] != 11 + 4 + 5*8 || (unsigned char) zip[cd + 61] != 0x4D))
+				r = 1;
+			if (pass > 1)
+				zip[cd + 65 + 8*(pass-2)]++;
+			for (rd = MZAE_CODEC_ZLIB; !r && rd < MZAE_CODECS; rd++)
+			{
+				if (!MZAE_codec_name(rd))
+					continue;
+				MZAE_codec(rd);
+				olen = sizeof(out);
+				r = MiniZipAEReadEx(zip, zlen, &o, &olen, "kazookazaa", &opts);
+				printf("\nread with %s: %d, %d threads", MZAE_codec_name(rd), r, st.threads);
+				if (!r && (olen != sizeof(src) || memcmp(src, out, olen) || st.threads != (pass > 1 ? 1 : 4)))
+					r = 1;
+			}
+			MZAE_codec(MZAE_CODEC_AUTO);
+		}
+		MZAE_deflate_threads(1 << 20, 0);
+
+		if (r)
+			printf("\nINDEX SELF TEST FAILED!");
+		else
+			printf("\nINDEX SELF TEST PASSED!");
+	}
+
+	// Reversed documents round-trip with every codec and path, src untouched
+	{
+		MZAE_OPTIONS opts = {0};
+		static char src[600 << 10], rev[600 << 10], zip[(600 << 10) + 400], out[600 << 10];
+		char *z = zip, *o = out;
+		unsigned long i, j, x = 777, zlen, olen;
+		int rd, pass;
+
+		for (i = 0; i < sizeof(src); i++)
+			src[i] = s[i % strlen(s)] + (char)(i / 3000);
+		for (i = 100 << 10; i < 120 << 10; i++)
+			x = x * 1103515245 + 12345, src[i] = (char)(x >> 16);
+		for (i = 0; i < sizeof(src); i++)
+			rev[i] = src[sizeof(src) - 1 - i];
+
+		// Any length and alignment, copying and in place
+		for (r = 0, i = 0; !r && i < 100; i++)
+		{
+			MZAE_memrev(out + 1, src + (i & 7), i);
+			memcpy(out + 201, src, i);
+			MZAE_memrev(out + 201, out + 201, i);
+			for (j = 0; j < i; j++)
+				if (out[1 + j] != src[(i & 7) + i - 1 - j] || out[201 + j] != src[i - 1 - j])
+					r = 1;
+		}
+		printf("\nmemrev returned %d", r);
+
+		for (pass = 0; !r && pass < 4; pass++)
+		{
+			// Deflate by blocks, in slices and indexed, then Store
+			MZAE_deflate_threads(pass == 1 || pass == 2 ? 1 : 1 << 20, pass ? 4 : 0);
+			opts.sync = pass == 2 ? MZAE_CHUNK : 0;
+			opts.method = pass == 3 ? MZAE_METHOD_STORE : MZAE_METHOD_DEFLATE;
+			for (rd = MZAE_CODEC_ZLIB; !r && rd < MZAE_CODECS; rd++)
+			{
+				if (!MZAE_codec_name(rd))
+					continue;
+				MZAE_codec(rd);
+				opts.reverse = 1;
+				zlen = sizeof(zip);
+				r = MiniZipAEWriteEx(src, sizeof(src), &z, &zlen, "kazookazaa", &opts);
+				olen = sizeof(out);
+				if (!r)
+					r = MiniZipAEReadEx(zip, zlen, &o, &olen, "kazookazaa", &opts);
+				if (!r && (olen != sizeof(src) || memcmp(src, out, olen)))
+					r = 1;
+				// The archive holds the reversed document
+				opts.reverse = 0;
+				olen = sizeof(out);
+				if (!r)
+					r = MiniZipAEReadEx(zip, zlen, &o, &olen, "kazookazaa", &opts);
+				if (!r && memcmp(rev, out, olen))
+					r = 1;
+				printf("\nreversed pass %d with %s returned %d (%lu bytes)", pass, MZAE_codec_name(rd), r, zlen);
+			}
+			MZAE_codec(MZAE_CODEC_AUTO);
+		}
+		MZAE_deflate_threads(1 << 20, 0);
+
+		// The source is left as it was
+		for (i = 0; !r && i < sizeof(src); i++)
+			if (rev[i] != src[sizeof(src) - 1 - i])
+				r = 1;
+
+		if (r)
+			printf("\nREVERSE SELF TEST FAILED!");
+		else
+			printf("\nREVERSE SELF TEST PASSED!");
+	}
+
+	// AES-CTR against the ciphertexts of the per-block AES_ecb_encrypt path
+	// (key 0, 1, 2..., little endian counter from 1), on every backend, in
+	// odd chunks and in parallel slices
+	{
+		static const char* ct[3] = {
+			"\xE4\x5A\x96\x07\x5E\xDE\x46\x40\x65\xE1\x33\x62\x1B\x7A\x25\x5A\x0C\x9C\xD6\x4F\xD6\x49\x2D\x7D"
+			"\x78\x38\x60\xCB\x49\x5E\xDA\xEE\x6B\xBE\xBC\x50\xEC\x9D\x09\x3F\x4E\xCC\xCD\xD7\x4E\xD3\xAF\x4A"
+			"\x27\x7A\x98\x30\xC0\x60\x7B\x77\xA0\x61\xAD\x7C\x33\x7D\x03\x09\xBF\x7B\xC2",
+			"\x0E\x6C\x37\x58\x69\x55\x36\x57\xCD\xFE\x66\xCC\xA8\xC1\x35\x29\x5F\xEB\x64\x39\x8F\x9B\x7A\x69"
+			"\x5C\x85\xA8\x6B\x94\xAF\x12\x2C\x14\x53\x9C\x98\xDC\x63\xB5\x1F\x8F\x32\x37\x1C\x72\x97\x29\xEB"
+			"\x0F\x27\x93\x0C\xF8\x35\x7B\xEB\xD5\xFC\x5E\xE0\xC0\x2B\xDF\xD9\x8A\xF5\x20",
+			"\xC0\x93\x5C\xE0\xE9\xB3\x80\xFC\x29\xB2\x3A\x97\x78\x62\xB8\x70\xB9\xE2\x8D\xDF\x98\x47\xF8\x83"
+			"\x2C\x71\xD7\xBA\x05\x70\x63\xB3\x67\xC5\x24\x3A\xEC\x0B\x0A\xF1\x81\x20\x2F\x8D\x45\x32\x32\xE8"
+			"\x02\x8E\x7C\x34\x60\x39\x2B\x1D\xFE\x46\x65\xE6\x77\x43\xAB\xB3\x5E\x0D\xC9"
+		};
+		static const unsigned int chunks[5] = {1, 15, 17, 3, 31}; // 67 bytes
+		static char pt[1 << 20], buf[1 << 20];
+		char key[32];
+		unsigned long i, n;
+		int be, k;
+		MZAE_CTR* ctr;
+
+		for (i = 0; i < sizeof(pt); i++)
+			pt[i] = (char)(i * 31 + 7);
+		for (i = 0; i < sizeof(key); i++)
+			key[i] = (char) i;
+
+		for (r = 0, be = MZAE_BACKEND_C; !r && be < MZAE_BACKENDS; be++)
+		{
+			if (MZAE_backend(be) != be)
+				continue;
+			for (k = 0; !r && k < 3; k++)
+			{
+				r = MZAE_ctr_crypt_into(key, 16 + 8*k, pt, 67, buf);
+				if (!r && memcmp(buf, ct[k], 67))
+					r = 1;
+				memset(buf, 0, 67);
+				if (!r && !(r = MZAE_ctr_init(&ctr, key, 16 + 8*k)))
+				{
+					for (i = 0, n = 0; n < 5; i += chunks[n++])
+						MZAE_ctr_update(ctr, pt + i, chunks[n], buf + i);
+					MZAE_ctr_free(ctr);
+					if (memcmp(buf, ct[k], 67))
+						r = 1;
+				}
+			}
+
+			// 1 MB with AES-256 after a partial block, split among threads
+			MZAE_ctr_threads(256 << 10, 4);
+			if (!r && !(r = MZAE_ctr_init(&ctr, key, 32)))
+			{
+				MZAE_ctr_update(ctr, pt, 5, buf);
+				MZAE_ctr_update(ctr, pt + 5, sizeof(pt) - 5, buf + 5);
+				MZAE_ctr_free(ctr);
+				if (MZAE_crc(0, buf, sizeof(buf)) != 0x64C13572)
+					r = 1;
+			}
+			MZAE_ctr_threads(4 << 20, 0);
+			printf("\nAES-CTR with %s returned %d", MZAE_backend_name(be), r);
+		}
+		MZAE_backend(MZAE_BACKEND_AUTO);
+
+		if (r)
+			printf("\nAES-CTR SELF TEST FAILED!");
+		else
+			printf("\nAES-CTR SELF TEST PASSED!");
+	}
+
+	// PBKDF2-HMAC-SHA1 against RFC 6070 (but the 2^24 iterations case), and
+	// a WinZip AES-256 key set of 66 bytes, on every SHA-1 kernel: outputs
+	// over 20 bytes run several lanes at once
+	{
+		static const struct {
+			char *pw, *salt;
+			unsigned int pwlen, saltlen, iterations, keylen;
+			char* key;
+		} v[] = {
+			{"password", "salt", 8, 4, 1, 20, "\x0C\x60\xC8\x0F\x96\x1F\x0E\x71\xF3\xA9\xB5\x24\xAF\x60\x12\x06\x2F\xE0\x37\xA6"},
+			{"password", "salt", 8, 4, 2, 20, "\xEA\x6C\x01\x4D\xC7\x2D\x6F\x8C\xCD\x1E\xD9\x2A\xCE\x1D\x41\xF0\xD8\xDE\x89\x57"},
+			{"password", "salt", 8, 4, 4096, 20, "\x4B\x00\x79\x01\xB7\x65\x48\x9A\xBE\xAD\x49\xD9\x26\xF7\x21\xD0\x65\xA4\x29\xC1"},
+			{"passwordPASSWORDpassword", "saltSALTsaltSALTsaltSALTsaltSALTsalt", 24, 36, 4096, 25,
+				"\x3D\x2E\xEC\x4F\xE4\x1C\x84\x9B\x80\xC8\xD8\x36\x62\xC0\xE4\x4A\x8B\x29\x1A\x96\x4C\xF2\xF0\x70\x38"},
+			{"pass\0word", "sa\0lt", 9, 5, 4096, 16, "\x56\xFA\x6A\xA7\x55\x48\x09\x9D\xCC\x37\xD7\xF0\x34\x25\xE0\xC3"},
+			{"kazookazaa", "0123456789abcdef", 10, 16, 1000, 66,
+				"\x6A\x16\x78\xEB\x98\x73\xD3\xD6\x2E\x6A\xF4\x36\x15\xBA\xE8\x7B\xBF\x23\xCD\xFE\x8F\x32\xCC\x50\xAB\x9E\xF2\xF6\x47\xD3\x95\x95\x75"
+				"\xD4\xED\x92\xAA\x8E\xB9\x1E\x02\x03\x34\x5C\x08\x05\xA0\x72\x4B\x4C\x69\x3E\x30\x07\x78\x6D\x29\x20\xEA\x47\xAA\x1E\x50\x00\x62\x52"},
+		};
+		char key[66];
+		int kernel, i;
+
+		for (r = 0, kernel = MZAE_SHA1_C; !r && kernel <= MZAE_SHA1_SHANI; kernel++)
+		{
+			if (MZAE_sha1_kernel(kernel) != kernel)
+				continue;
+			for (i = 0; !r && i < sizeof(v) / sizeof(v[0]); i++)
+			{
+				r = MZAE_pbkdf2_sha1(v[i].pw, v[i].pwlen, v[i].salt, v[i].saltlen, v[i].iterations, key, v[i].keylen);
+				if (!r && memcmp(key, v[i].key, v[i].keylen))
+					r = 1;
+			}
+			printf("\nPBKDF2 with SHA-1 kernel %d returned %d", kernel, r);
+		}
+		MZAE_sha1_kernel(MZAE_SHA1_AUTO);
+
+		if (r)
+			printf("\nPBKDF2 SELF TEST FAILED!");
+		else
+			printf("\nPBKDF2 SELF TEST PASSED!");
+	}
+
+	// HMAC-SHA1 against RFC 2202, truncated to 80 bits: keys over a block are
+	// hashed first, test 7 and the last message span several blocks. Once in
+	// one call and once in odd chunks after a reset, on every SHA-1 kernel and
+	// on OpenSSL
+	{
+		static const struct {
+			char* key;
+			int keyfill;
+			unsigned int keylen;
+			char* msg;
+			int msgfill;
+			unsigned int msglen;
+			char* hmac;
+		} v[] = {
+			{NULL, 0x0B, 20, "Hi There", 0, 8, "\xB6\x17\x31\x86\x55\x05\x72\x64\xE2\x8B"},
+			{"Jefe", 0, 4, "what do ya want for nothing?", 0, 28, "\xEF\xFC\xDF\x6A\xE5\xEB\x2F\xA2\xD2\x74"},
+			{NULL, 0xAA, 20, NULL, 0xDD, 50, "\x12\x5D\x73\x42\xB9\xAC\x11\xCD\x91\xA3"},
+			{NULL, -1, 25, NULL, 0xCD, 50, "\x4C\x90\x07\xF4\x02\x62\x50\xC6\xBC\x84"},
+			{NULL, 0x0C, 20, "Test With Truncation", 0, 20, "\x4C\x1A\x03\x42\x4B\x55\xE0\x7F\xE7\xF2"},
+			{NULL, 0xAA, 80, "Test Using Larger Than Block-Size Key - Hash Key First", 0, 54, "\xAA\x4A\xE5\xE1\x52\x72\xD0\x0E\x95\x70"},
+			{NULL, 0xAA, 80, "Test Using Larger Than Block-Size Key and Larger Than One Block-Size Data", 0, 73,
+				"\xE8\xE9\x9D\x0F\x45\x23\x7D\x78\x6D\x6B"},
+			{"Jefe", 0, 4, NULL, 'x', 1000, "\xF3\x3A\xD2\x66\xE9\xE7\x7B\x6E\xC9\xF5"},
+		};
+		static const int runs[4][2] = {
+			{MZAE_BACKEND_C, MZAE_SHA1_C}, {MZAE_BACKEND_C, MZAE_SHA1_SSSE3},
+			{MZAE_BACKEND_C, MZAE_SHA1_SHANI}, {MZAE_BACKEND_OPENSSL, MZAE_SHA1_AUTO}
+		};
+		char key[80], msg[1000], hmac[10];
+		unsigned int i, j, n;
+		int k;
+		MZAE_HMAC* ctx;
+
+		for (r = 0, k = 0; !r && k < 4; k++)
+		{
+			if (MZAE_backend(runs[k][0]) != runs[k][0])
+				continue;
+			if (runs[k][1] != MZAE_SHA1_AUTO && MZAE_sha1_kernel(runs[k][1]) != runs[k][1])
+				continue;
+			for (i = 0; !r && i < sizeof(v) / sizeof(v[0]); i++)
+			{
+				for (j = 0; j < v[i].keylen; j++)
+					key[j] = v[i].key ? v[i].key[j] : (char)(v[i].keyfill < 0 ? j + 1 : v[i].keyfill);
+				for (j = 0; j < v[i].msglen; j++)
+					msg[j] = v[i].msg ? v[i].msg[j] : (char) v[i].msgfill;
+
+				r = MZAE_hmac_sha1_80_into(key, v[i].keylen, msg, v[i].msglen, hmac);
+				if (!r && memcmp(hmac, v[i].hmac, 10))
+					r = 1;
+				memset(hmac, 0, 10);
+				if (!r && !(r = MZAE_hmac_init(&ctx, key, v[i].keylen)))
+				{
+					MZAE_hmac_update(ctx, msg, v[i].msglen);
+					MZAE_hmac_reset(ctx);
+					for (j = 0, n = 1; j < v[i].msglen; j += n, n = n * 3 + 4)
+						MZAE_hmac_update(ctx, msg + j, n < v[i].msglen - j ? n : v[i].msglen - j);
+					MZAE_hmac_final(ctx, hmac);
+					if (memcmp(hmac, v[i].hmac, 10))
+						r = 1;
+				}
+			}
+			printf("\nHMAC with %s, SHA-1 kernel %d returned %d", MZAE_backend_name(runs[k][0]), runs[k][1], r);
+		}
+		MZAE_sha1_kernel(MZAE_SHA1_AUTO);
+		MZAE_backend(MZAE_BACKEND_AUTO);
+
+		if (r)
+			printf("\nHMAC SELF TEST FAILED!");
+		else
+			printf("\nHMAC SELF TEST PASSED!");
+	}
+
+	// CRC-32 check value, agreement with zlib at every length to 300 and a
+	// long run, from unaligned starts, in two calls, and combined
+	{
+		static char buf[(64 << 10) + 16];
+		unsigned long a, b;
+		unsigned int i, len, off;
+
+		for (i = 0; i < sizeof(buf); i++)
+			buf[i] = (char)(i * 131 + (i >> 7));
+
+		r = MZAE_crc(0, "123456789", 9) != 0xCBF43926;
+		for (off = 0; !r && off < 16; off += 5)
+		{
+			for (len = 0; !r && len <= 300; len++)
+				if (MZAE_crc(0, buf + off, len) != crc32(0, (unsigned char*) buf + off, len))
+					r = 1;
+			len = 64 << 10;
+			a = MZAE_crc(0, buf + off, 1000);
+			b = MZAE_crc(0, buf + off + 1000, len - 1000);
+			if (MZAE_crc(a, buf + off + 1000, len - 1000) != crc32(0, (unsigned char*) buf + off, len))
+				r = 1;
+			if (MZAE_crc_combine(a, b, len - 1000) != crc32(0, (unsigned char*) buf + off, len))
+				r = 1;
+			for (i = 0; !r && i <= 300; i += 37)
+				if (MZAE_crc_combine(MZAE_crc(0, buf + off, i), MZAE_crc(0, buf + off + i, 300 - i), 300 - i) != MZAE_crc(0, buf + off, 300))
+					r = 1;
+		}
+		printf("\nCRC-32 returned %d", r);
+
+		if (r)
+			printf("\nCRC-32 SELF TEST FAILED!");
+		else
+			printf("\nCRC-32 SELF TEST PASSED!");
+	}
+#ifdef MAIN_SAVES
+	fwrite(out1, 1, len1, f);
+	fclose(f);
+#endif
+}
+#endif
+
+
+#ifdef MAIN_STRESS
+// Many threads writing and reading at once, each with its own objects
+#include <stdio.h>
+#include <MZAE_thread.h>
+
+#define STRESS_THREADS 8
+#define STRESS_MAX (1 << 20)
+
+struct stress {
+	int id, rounds, failed;
+};
+
+static int stress_op(struct stress* t, unsigned int* seed, char* src, MZAE_PREKEY* prekey, MZAE_ARENA* arena)
+{
+	MZAE_OPTIONS opts = {0};
+	MZAE_STATS st;
+	char *zip = NULL, *out = NULL, pw[16];
+	unsigned long len, zlen = 0, olen = 0, data, i;
+	int r;
+
+	// Sizes around the AE-2 limit, the chunk and beyond, a few long enough
+	// to be deflated in parallel; some of it random
+	*seed = *seed * 1103515245 + 12345;
+	len = 1 + (*seed >> 8) % (*seed & 1 ? 40 : (*seed & 0xE) == 0xE ? STRESS_MAX : 3*MZAE_CHUNK);
+	for (i = 0; i < len; i++)
+	{
+		*seed = *seed * 1103515245 + 12345;
+		src[i] = *seed & 0x100 ? (char)(*seed >> 16) : "abcdefgh"[(*seed >> 12) & 7];
+	}
+	sprintf(pw, "pw%d", t->id);
+
+	opts.prekey = *seed & 2 ? prekey : NULL;
+	opts.arena = *seed & 4 ? arena : NULL;
+	opts.stats = *seed & 8 ? &st : NULL;
+	opts.profile = (*seed >> 10) % MZAE_PROFILES;
+	opts.strength = 128 + (*seed >> 12) % 3 * 64;
+	opts.method = (*seed >> 14) % 3;
+	opts.sync = *seed & 0x10 ? MZAE_CHUNK : 0;
+	opts.reverse = (*seed & 0x20) != 0;
+
+	r = MiniZipAEWriteEx(src, len, &zip, &zlen, pw, &opts);
+	if (r || !(zip = (char*) malloc(zlen)))
+		return 1;
+	r = MiniZipAEWriteEx(src, len, &zip, &zlen, pw, &opts);
+	if (!r)
+		r = MiniZipAEReadEx(zip, zlen, &out, &olen, pw, &opts);
+	if (!r && !(out = (char*) malloc(olen)))
+		r = 1;
+	if (!r)
+		r = MiniZipAEReadEx(zip, zlen, &out, &olen, pw, &opts);
+	if (!r && (olen != len || memcmp(src, out, len)))
+		r = 1;
+
+	// Wrong password and tampered data or HMAC must fail, leaking nothing (a
+	// broken index would only cost the parallel inflate)
+	if (!r && MiniZipAERead(zip, zlen, &out, &olen, "wrong") == MZAE_ERR_SUCCESS)
+		r = 1;
+	data = 45 + 4 + 4*zip[42] + 2;
+	i = (unsigned char) zip[18] | (unsigned char) zip[19] << 8 | (unsigned long) (unsigned char) zip[20] << 16;
+	zip[data + (*seed >> 4) % (i - (data - 45))] ^= 0x20;
+	if (!r && MiniZipAEReadEx(zip, zlen, &out, &olen, pw, &opts) == MZAE_ERR_SUCCESS)
+		r = 1;
+
+	free(zip);
+	free(out);
+	return r;
+}
+
+static void stress_thread(void* arg)
+{
+	struct stress* t = (struct stress*) arg;
+	unsigned int seed = t->id;
+	MZAE_PREKEY* prekey = NULL;
+	MZAE_ARENA* arena = NULL;
+	char pw[16], *src;
+	int i;
+
+	src = (char*) malloc(STRESS_MAX);
+	sprintf(pw, "pw%d", t->id);
+	if (!src || MZAE_prekey_init(&prekey, pw) || MZAE_arena_init(&arena, MZAE_ARENA_SIZE, 0))
+		t->failed = t->rounds;
+	else
+		for (i = 0; i < t->rounds; i++)
+			t->failed += stress_op(t, &seed, src, prekey, arena);
+
+	MZAE_prekey_free(prekey);
+	MZAE_arena_free(arena);
+	free(src);
+}
+
+int main(int argc, char** argv)
+{
+	struct stress t[STRESS_THREADS];
+	MZAE_THREAD th[STRESS_THREADS];
+	int i, rounds = argc > 1 ? atoi(argv[1]) : 250, failed = 0;
+
+	MZAE_deflate_threads(MZAE_CHUNK, 3);
+
+	for (i = 0; i < STRESS_THREADS; i++)
+	{
+		t[i].id = i;
+		t[i].rounds = rounds;
+		t[i].failed = 0;
+		if (MZAE_thread_start(&th[i], stress_thread, &t[i]))
+			th[i] = NULL;
+	}
+
+	for (i = 0; i < STRESS_THREADS; i++)
+	{
+		if (th[i])
+			MZAE_thread_join(th[i]);
+		else
+			t[i].failed = rounds;
+		failed += t[i].failed;
+	}
+
+	printf("%d threads, %d archives each: %d failed\n", STRESS_THREADS, rounds, failed);
+	printf(failed ? "STRESS TEST FAILED!\n" : "STRESS TEST PASSED!\n");
+
+	return failed != 0;
 }
 #endif
@@ -17,33 +17,45 @@
  */
 
 /*
-	Cryptographic functions built on top of OpenSSL/LibreSSL
+	Backend built on top of OpenSSL/LibreSSL: random salt, AES and HMAC.
+
+	Ciphers and MAC are fetched once: OpenSSL 3 would otherwise look them up
+	in its providers at each initialization. Each thread keeps an idle AES
+	and HMAC context, re-keyed for the next document instead of being
+	created anew; parked contexts are re-keyed with zeros, so that no key
+	lingers, and released when the thread terminates.
 */
 
 #include <mZipAES.h>
+#include <MZAE_backend.h>
+#include <MZAE_thread.h>
 #include <string.h>
-#include <openssl/aes.h>
-#include <openssl/hmac.h>
+#include <openssl/opensslv.h>
+#include <openssl/evp.h>
 #include <openssl/rand.h>
+#include <openssl/crypto.h>
 
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L && !defined(LIBRESSL_VERSION_NUMBER)
+#define MZAE_OPENSSL3
+#include <openssl/core_names.h>
+#include <openssl/params.h>
+#else
+#include <openssl/hmac.h>
+#endif
 
-#ifdef BYTE_ORDER_1234
-void betole64(unsigned long long *x) {
-*x = (*x & 0x00000000FFFFFFFF) << 32 | (*x & 0xFFFFFFFF00000000) >> 32;
-*x = (*x & 0x0000FFFF0000FFFF) << 16 | (*x & 0xFFFF0000FFFF0000) >> 16;
-*x = (*x & 0x00FF00FF00FF00FF) << 8  | (*x & 0xFF00FF00FF00FF00) >> 8;
-}
+#ifdef MZAE_OPENSSL3
+typedef EVP_MAC_CTX MZAE_MAC_CTX;
+#define EVP_CIPHER_CTX_cipher EVP_CIPHER_CTX_get0_cipher
+#else
+typedef HMAC_CTX MZAE_MAC_CTX;
 #endif
 
 
 
-int MZAE_gen_salt(char* salt, int saltlen)
+int MZAE_openssl_salt(char* salt, int saltlen)
 {
 	RAND_poll();
 
-	if (saltlen != 8 && saltlen != 12 && saltlen != 16)
-		return 1;
-	
 	if (!RAND_bytes(salt, saltlen))
 		return 2;
 	
@@ -52,93 +64,208 @@ int MZAE_gen_salt(char* salt, int saltlen)
 
 
 
-int MZAE_derive_keys(char* password, char* salt, int saltlen, char** aes_key, char** hmac_key, char** vv)
+// AES-128, 192 and 256 in ECB mode
+static const EVP_CIPHER* mzae_ciphers[3];
+#ifdef MZAE_OPENSSL3
+static EVP_MAC* mzae_mac;
+#endif
+
+// Idle contexts of each thread
+static MZAE_KEY mzae_cipher_idle, mzae_mac_idle;
+
+static int mzae_openssl_ok;
+static MZAE_ONCE mzae_openssl_once = MZAE_ONCE_INIT;
+
+static const unsigned char mzae_zero_key[32];
+
+
+
+static void MZAE_KEY_CALLBACK mzae_cipher_ctx_free(void* ctx)
+{
+	EVP_CIPHER_CTX_free((EVP_CIPHER_CTX*) ctx);
+}
+
+static void MZAE_KEY_CALLBACK mzae_mac_ctx_free(void* ctx)
 {
-	int keylen = 0;
-	char *kdfbuf;
-
-	if (saltlen == 8)
-		keylen = 16;
-	else if (saltlen == 12)
-		keylen = 24;
-	else if (saltlen == 16)
-		keylen = 32;
+#ifdef MZAE_OPENSSL3
+	EVP_MAC_CTX_free((EVP_MAC_CTX*) ctx);
+#else
+	HMAC_CTX_free((HMAC_CTX*) ctx);
+#endif
+}
+
+static void mzae_openssl_init(void)
+{
+#ifdef MZAE_OPENSSL3
+	mzae_ciphers[0] = EVP_CIPHER_fetch(NULL, "AES-128-ECB", NULL);
+	mzae_ciphers[1] = EVP_CIPHER_fetch(NULL, "AES-192-ECB", NULL);
+	mzae_ciphers[2] = EVP_CIPHER_fetch(NULL, "AES-256-ECB", NULL);
+	mzae_mac = EVP_MAC_fetch(NULL, "HMAC", NULL);
+	if (!mzae_mac)
+		return;
+#else
+	mzae_ciphers[0] = EVP_aes_128_ecb();
+	mzae_ciphers[1] = EVP_aes_192_ecb();
+	mzae_ciphers[2] = EVP_aes_256_ecb();
+#endif
+	if (!mzae_ciphers[0] || !mzae_ciphers[1] || !mzae_ciphers[2])
+		return;
+
+	if (MZAE_key_create(&mzae_cipher_idle, mzae_cipher_ctx_free) ||
+		MZAE_key_create(&mzae_mac_idle, mzae_mac_ctx_free))
+		return;
+
+	mzae_openssl_ok = 1;
+}
+
+static int mzae_openssl_usable(void)
+{
+	MZAE_once(&mzae_openssl_once, mzae_openssl_init);
+
+	return mzae_openssl_ok;
+}
+
+
+
+struct mzae_aes_openssl {
+	EVP_CIPHER_CTX* ctx;
+};
+
+
+
+static int mzae_aes_openssl_init(void* aes, char* key, unsigned int keylen)
+{
+	struct mzae_aes_openssl* a = (struct mzae_aes_openssl*) aes;
+	const EVP_CIPHER* cipher;
+
+	if (keylen != 16 && keylen != 24 && keylen != 32)
+		return -1;
+
+	if (!mzae_openssl_usable())
+		return 1;
+	cipher = mzae_ciphers[keylen/8 - 2];
+
+	// The idle context of this thread, if any, is simply re-keyed
+	a->ctx = (EVP_CIPHER_CTX*) MZAE_key_get(mzae_cipher_idle);
+	if (a->ctx)
+		MZAE_key_set(mzae_cipher_idle, NULL);
 	else
+		a->ctx = EVP_CIPHER_CTX_new();
+
+	if (!a->ctx || !EVP_EncryptInit_ex(a->ctx, EVP_CIPHER_CTX_cipher(a->ctx) == cipher ? NULL : cipher, 0, key, 0))
+	{
+		EVP_CIPHER_CTX_free(a->ctx);
+		a->ctx = NULL;
 		return 1;
-	
-	kdfbuf = (char*) malloc(2*keylen+2);
-	if (! kdfbuf)
-		return 2;
-	
-	if (!PKCS5_PBKDF2_HMAC_SHA1(password, strlen(password), salt, saltlen, 1000, 2*keylen+2, kdfbuf))
-		return 3;
-	
-	*aes_key = kdfbuf;
-	*hmac_key = kdfbuf+keylen;
-	*vv = kdfbuf+2*keylen;
+	}
+	EVP_CIPHER_CTX_set_padding(a->ctx, 0);
 
 	return 0;
 }
 
 
 
-int MZAE_ctr_crypt(char* key, unsigned int keylen, char* src, unsigned int srclen, char** dst)
+static int mzae_aes_openssl_copy(void* dst, void* src)
 {
-	AES_KEY aes_key;
-	char ctr_counter_le[16];
-	char ctr_encrypted_counter[16];
-#ifdef BYTE_ORDER_1234
-	char ctr_counter_be[16];
-#endif
-	const char* p = ctr_encrypted_counter;
-	const char* q = p+8;
-	char *pbuf;
-	unsigned int i;
+	struct mzae_aes_openssl* d = (struct mzae_aes_openssl*) dst;
+	struct mzae_aes_openssl* s = (struct mzae_aes_openssl*) src;
 
-	if (!keylen || !srclen)
-		return -1;
-
-	if (AES_set_encrypt_key(key, keylen*8, &aes_key))
+	d->ctx = EVP_CIPHER_CTX_new();
+	if (!d->ctx || !EVP_CIPHER_CTX_copy(d->ctx, s->ctx))
+	{
+		EVP_CIPHER_CTX_free(d->ctx);
+		d->ctx = NULL;
 		return 1;
+	}
+
+	return 0;
+}
+
 
-#ifdef BYTE_ORDER_1234
-	memset(ctr_counter_be, 0, 16);
+
+static void mzae_aes_openssl_blocks(void* aes, const unsigned char* src, unsigned char* dst, unsigned int blocks)
+{
+	struct mzae_aes_openssl* a = (struct mzae_aes_openssl*) aes;
+	int len;
+
+	EVP_EncryptUpdate(a->ctx, dst, &len, src, 16*blocks);
+}
+
+
+
+static void mzae_aes_openssl_clear(void* aes)
+{
+	struct mzae_aes_openssl* a = (struct mzae_aes_openssl*) aes;
+
+	// Parks the context for the next document, if the thread has none
+	if (a->ctx && !MZAE_key_get(mzae_cipher_idle) &&
+		EVP_EncryptInit_ex(a->ctx, NULL, 0, mzae_zero_key, 0))
+		MZAE_key_set(mzae_cipher_idle, a->ctx);
+	else
+		EVP_CIPHER_CTX_free(a->ctx);
+	a->ctx = NULL;
+}
+
+
+
+const MZAE_AES_OPS MZAE_aes_openssl = {
+	sizeof(struct mzae_aes_openssl), mzae_openssl_usable, mzae_aes_openssl_init, mzae_aes_openssl_copy,
+	mzae_aes_openssl_blocks, mzae_aes_openssl_clear
+};
+
+
+
+struct mzae_hmac_openssl {
+	MZAE_MAC_CTX* ctx;
+};
+
+
+
+// Keys a MAC context, or keeps its key if NULL
+static int mzae_mac_key(MZAE_MAC_CTX* ctx, const unsigned char* key, unsigned int keylen)
+{
+#ifdef MZAE_OPENSSL3
+	return EVP_MAC_init(ctx, key, keylen, NULL);
 #else
-	memset(ctr_counter_le, 0, 16);
+	return HMAC_Init_ex(ctx, key, keylen, key ? EVP_sha1() : NULL, NULL);
 #endif
-	
-	*dst = pbuf = (char*) malloc(srclen);
-	if (!pbuf)
-		return 2;
+}
+
+
+
+static int mzae_hmac_openssl_init(void* hmac, char* key, unsigned int keylen)
+{
+	struct mzae_hmac_openssl* h = (struct mzae_hmac_openssl*) hmac;
+
+	if (!mzae_openssl_usable())
+		return 1;
+
+	h->ctx = (MZAE_MAC_CTX*) MZAE_key_get(mzae_mac_idle);
+	if (h->ctx)
+		MZAE_key_set(mzae_mac_idle, NULL);
+	else
+	{
+#ifdef MZAE_OPENSSL3
+		OSSL_PARAM params[2];
 
-	for (i=0; i < srclen/16; i++) {
-#ifndef BYTE_ORDER_1234
-		(*((unsigned long long*) ctr_counter_le))++;
-#else	
-		(*((unsigned long long*) ctr_counter_be))++;
-		*((unsigned long long*) ctr_counter_le) = *((unsigned long long*) ctr_counter_be);
-		betole64((unsigned long long*)ctr_counter_le);
+		params[0] = OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, "SHA1", 0);
+		params[1] = OSSL_PARAM_construct_end();
+		h->ctx = EVP_MAC_CTX_new(mzae_mac);
+		if (h->ctx && !EVP_MAC_CTX_set_params(h->ctx, params))
+		{
+			EVP_MAC_CTX_free(h->ctx);
+			h->ctx = NULL;
+		}
+#else
+		h->ctx = HMAC_CTX_new();
 #endif
-		AES_ecb_encrypt(ctr_counter_le, ctr_encrypted_counter, &aes_key, 1);
-		*((unsigned long long*) pbuf) = *((unsigned long long*) src) ^ *((unsigned long long*) p);
-		pbuf+=sizeof(long long);
-		src+=sizeof(long long);
-		*((unsigned long long*) pbuf) = *((unsigned long long*) src) ^ *((unsigned long long*) q);
-		pbuf+=sizeof(long long);
-		src+=sizeof(long long);
 	}
 
-	if ((i = srclen%16)) {
-#ifndef BYTE_ORDER_1234
-		(*((unsigned long long*) ctr_counter_le))++;
-#else	
-		(*((unsigned long long*) ctr_counter_be))++;
-		*((unsigned long long*) ctr_counter_le) = *((unsigned long long*) ctr_counter_be);
-		betole64((unsigned long long*)ctr_counter_le);
-#endif
-		AES_ecb_encrypt(ctr_counter_le, ctr_encrypted_counter, &aes_key, 1);
-		while (i--)
-			*pbuf++ = *src++ ^ *p++;
+	if (!h->ctx || !mzae_mac_key(h->ctx, (unsigned char*) key, keylen))
+	{
+		mzae_mac_ctx_free(h->ctx);
+		h->ctx = NULL;
+		return 1;
 	}
 
 	return 0;
@@ -146,12 +273,56 @@ int MZAE_ctr_crypt(char* key, unsigned int keylen, char* src, unsigned int srcle
 
 
 
-int MZAE_hmac_sha1_80(char* key, unsigned int keylen, char* src, unsigned int srclen, char** hmac)
+static void mzae_hmac_openssl_update(void* hmac, char* src, unsigned int srclen)
 {
-	if (!keylen || !srclen)
-		return -1;
+	struct mzae_hmac_openssl* h = (struct mzae_hmac_openssl*) hmac;
 
-	*hmac = HMAC(EVP_sha1(), key, keylen, src, srclen, 0, 0);
+#ifdef MZAE_OPENSSL3
+	EVP_MAC_update(h->ctx, (unsigned char*) src, srclen);
+#else
+	HMAC_Update(h->ctx, (unsigned char*) src, srclen);
+#endif
+}
 
-	return 0;
+
+
+static void mzae_hmac_openssl_reset(void* hmac)
+{
+	struct mzae_hmac_openssl* h = (struct mzae_hmac_openssl*) hmac;
+
+	mzae_mac_key(h->ctx, NULL, 0);
 }
+
+
+
+static void mzae_hmac_openssl_final(void* hmac, char* digest10)
+{
+	struct mzae_hmac_openssl* h = (struct mzae_hmac_openssl*) hmac;
+	unsigned char digest[20];
+
+	if (digest10)
+	{
+#ifdef MZAE_OPENSSL3
+		size_t len;
+		EVP_MAC_final(h->ctx, digest, &len, sizeof(digest));
+#else
+		unsigned int len;
+		HMAC_Final(h->ctx, digest, &len);
+#endif
+		memcpy(digest10, digest, 10);
+		OPENSSL_cleanse(digest, sizeof(digest));
+	}
+
+	if (!MZAE_key_get(mzae_mac_idle) && mzae_mac_key(h->ctx, mzae_zero_key, 20))
+		MZAE_key_set(mzae_mac_idle, h->ctx);
+	else
+		mzae_mac_ctx_free(h->ctx);
+	h->ctx = NULL;
+}
+
+
+
+const MZAE_HMAC_OPS MZAE_hmac_openssl = {
+	sizeof(struct mzae_hmac_openssl), mzae_hmac_openssl_init, mzae_hmac_openssl_update,
+	mzae_hmac_openssl_reset, mzae_hmac_openssl_final
+};
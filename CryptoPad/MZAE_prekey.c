@@ -0,0 +1,209 @@
+/*
+ *  Copyright (C) 2016-2023  maxpat78 <https://github.com/maxpat78>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+	Keys derived in a background thread, while the caller does I/O or
+	compression, or ahead of time for the next save
+*/
+#include <mZipAES.h>
+#include <MZAE_thread.h>
+#include <MZAE_alloc.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+
+struct mzae_kdf {
+	char* password;
+	char salt[16];
+	int saltlen;
+	MZAE_THREAD thread; // NULL if derived synchronously
+	int error;
+	char keys[MZAE_KEYS_SIZE];
+};
+
+
+
+static void mzae_kdf_derive(void* arg)
+{
+	MZAE_KDF* k = (MZAE_KDF*) arg;
+
+	k->error = MZAE_derive_keys_into(k->password, k->salt, k->saltlen, k->keys);
+}
+
+
+
+int MZAE_kdf_start(MZAE_KDF** job, char* password, char* salt, int saltlen)
+{
+	MZAE_KDF* k;
+
+	if (!job || !password || saltlen < 0 || saltlen > 16)
+		return 1;
+
+	k = (MZAE_KDF*) MZAE_calloc(1, sizeof(MZAE_KDF));
+	if (!k)
+		return 2;
+
+	k->password = (char*) MZAE_malloc(strlen(password) + 1);
+	if (!k->password)
+	{
+		MZAE_free(k);
+		return 2;
+	}
+	strcpy(k->password, password);
+	memcpy(k->salt, salt, saltlen);
+	k->saltlen = saltlen;
+
+	// Without a thread, derives now
+	if (MZAE_thread_start(&k->thread, mzae_kdf_derive, k))
+	{
+		k->thread = NULL;
+		mzae_kdf_derive(k);
+	}
+
+	*job = k;
+
+	return 0;
+}
+
+
+
+int MZAE_kdf_join(MZAE_KDF* job, char* salt, int saltlen, char* keys)
+{
+	MZAE_KDF* k = job;
+	int ret;
+
+	if (!k)
+		return 1;
+
+	if (k->thread)
+		MZAE_thread_join(k->thread);
+
+	ret = k->error;
+	if (!ret && (saltlen != k->saltlen || memcmp(salt, k->salt, saltlen)))
+		ret = -1;
+
+	if (!ret && keys)
+		memcpy(keys, k->keys, 4*k->saltlen+2);
+
+	memset(k->password, 0, strlen(k->password));
+	MZAE_free(k->password);
+	memset(k, 0, sizeof(MZAE_KDF));
+	MZAE_free(k);
+
+	return ret;
+}
+
+
+
+struct mzae_prekey {
+	char* password;
+	char salt[16];
+	MZAE_KDF* job; // derivation of the next set
+};
+
+
+
+// Starts preparing the next set
+static void mzae_prekey_start(MZAE_PREKEY* pk)
+{
+	pk->job = NULL;
+	if (!MZAE_gen_salt(pk->salt, 16))
+		MZAE_kdf_start(&pk->job, pk->password, pk->salt, 16);
+}
+
+
+
+int MZAE_prekey_init(MZAE_PREKEY** prekey, char* password)
+{
+	MZAE_PREKEY* pk;
+
+	if (!prekey)
+		return MZAE_ERR_PARAMS;
+
+	if (!password || !password[0])
+		return MZAE_ERR_NOPW;
+
+	pk = (MZAE_PREKEY*) MZAE_calloc(1, sizeof(MZAE_PREKEY));
+	if (!pk)
+		return MZAE_ERR_NOMEM;
+
+	pk->password = (char*) MZAE_malloc(strlen(password) + 1);
+	if (!pk->password)
+	{
+		MZAE_free(pk);
+		return MZAE_ERR_NOMEM;
+	}
+	strcpy(pk->password, password);
+
+	mzae_prekey_start(pk);
+	*prekey = pk;
+
+	return MZAE_ERR_SUCCESS;
+}
+
+
+
+int MZAE_prekey_take(MZAE_PREKEY* prekey, char* password, char* salt, char* keys)
+{
+	MZAE_PREKEY* pk = prekey;
+	MZAE_SCOPE scope;
+	int ret = MZAE_ERR_SUCCESS;
+
+	if (!pk || !password)
+		return MZAE_ERR_PARAMS;
+
+	// Keys for a former password are useless
+	if (strcmp(password, pk->password))
+		return MZAE_ERR_NOPW;
+
+	// Hands the set over: it is never given twice
+	if (!pk->job)
+		ret = MZAE_ERR_SALT;
+	else if (MZAE_kdf_join(pk->job, pk->salt, 16, keys))
+		ret = MZAE_ERR_KDF;
+	else
+		memcpy(salt, pk->salt, 16);
+	memset(pk->salt, 0, 16);
+
+	// The next set is derived while the caller works: it outlives the call
+	// and is not scratch memory
+	MZAE_scope_enter(NULL, NULL, &scope);
+	mzae_prekey_start(pk);
+	MZAE_scope_leave(&scope);
+
+	return ret;
+}
+
+
+
+void MZAE_prekey_free(MZAE_PREKEY* prekey)
+{
+	MZAE_PREKEY* pk = prekey;
+
+	if (!pk)
+		return;
+
+	if (pk->job)
+		MZAE_kdf_join(pk->job, pk->salt, 16, NULL);
+
+	memset(pk->password, 0, strlen(pk->password));
+	MZAE_free(pk->password);
+	memset(pk, 0, sizeof(MZAE_PREKEY));
+	MZAE_free(pk);
+}
@@ -0,0 +1,694 @@
+/*
+ *  Copyright (C) 2016-2023  maxpat78 <https://github.com/maxpat78>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+	SHA-1, HMAC-SHA1 and PBKDF2-HMAC-SHA1.
+
+	The compression function uses the x86 SHA extensions when available, or
+	SSSE3 to expand the message schedule, or portable C: the kernel is picked
+	at run time. PBKDF2 computes its output blocks in parallel SIMD lanes.
+*/
+#include <mZipAES.h>
+#include <MZAE_backend.h>
+#include <MZAE_cpu.h>
+#include <MZAE_thread.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The lanes stand in for the SSSE3 kernel, which only x86 builds have
+#if defined(MZAE_X86) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#include <emmintrin.h>
+#define MZAE_SHA1_SSE2
+#endif
+
+// Output blocks computed together
+#define MZAE_SHA1_LANES 4
+
+#define ROL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+#define VROL(x, n) _mm_or_si128(_mm_slli_epi32(x, n), _mm_srli_epi32(x, 32 - (n)))
+
+// SHA-1 words are big endian, whatever the host
+#define GETBE32(p) ((unsigned int)(p)[0] << 24 | (unsigned int)(p)[1] << 16 | (unsigned int)(p)[2] << 8 | (p)[3])
+#define PUTBE32(p, v) ((p)[0] = (unsigned char)((v) >> 24), (p)[1] = (unsigned char)((v) >> 16), \
+	(p)[2] = (unsigned char)((v) >> 8), (p)[3] = (unsigned char)(v))
+
+static const unsigned int mzae_sha1_iv[5] = {
+	0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0
+};
+
+// Compresses n consecutive blocks of 64 bytes
+typedef void (*mzae_sha1_fn)(unsigned int st[5], const unsigned char* p, size_t n);
+
+// Kernel requested with MZAE_sha1_kernel
+static int mzae_sha1_pref = MZAE_SHA1_AUTO;
+
+
+
+// Round functions of the four phases
+#define F1(b, c, d) ((d) ^ ((b) & ((c) ^ (d))))
+#define F2(b, c, d) ((b) ^ (c) ^ (d))
+#define F3(b, c, d) (((b) & (c)) | ((d) & ((b) | (c))))
+
+// One round, where w is the schedule word plus the phase constant: instead
+// of moving the registers, the caller rotates their names
+#define R(a, b, c, d, e, f, w) \
+	e += ROL(a, 5) + f(b, c, d) + (w); \
+	b = ROL(b, 30);
+
+#define R5(f, w, t) \
+	R(a, b, c, d, e, f, w(t)); \
+	R(e, a, b, c, d, f, w((t)+1)); \
+	R(d, e, a, b, c, f, w((t)+2)); \
+	R(c, d, e, a, b, f, w((t)+3)); \
+	R(b, c, d, e, a, f, w((t)+4));
+
+#define R20(f, w, t) R5(f, w, t) R5(f, w, (t)+5) R5(f, w, (t)+10) R5(f, w, (t)+15)
+
+// Schedule computed on the fly in a 16 words ring
+#define WC(t) ((t) < 16 ? w[t] : (w[(t) & 15] = ROL(w[((t)-3) & 15] ^ w[((t)-8) & 15] ^ w[((t)-14) & 15] ^ w[(t) & 15], 1)))
+#define WC1(t) (WC(t) + 0x5A827999)
+#define WC2(t) (WC(t) + 0x6ED9EBA1)
+#define WC3(t) (WC(t) + 0x8F1BBCDC)
+#define WC4(t) (WC(t) + 0xCA62C1D6)
+
+// Compresses one block given as 16 words
+static void mzae_sha1_words(unsigned int st[5], const unsigned int m[16])
+{
+	unsigned int w[16], a, b, c, d, e;
+
+	memcpy(w, m, sizeof(w));
+	a = st[0]; b = st[1]; c = st[2]; d = st[3]; e = st[4];
+
+	R20(F1, WC1, 0)
+	R20(F2, WC2, 20)
+	R20(F3, WC3, 40)
+	R20(F2, WC4, 60)
+
+	st[0] += a; st[1] += b; st[2] += c; st[3] += d; st[4] += e;
+}
+
+
+
+static void mzae_sha1_blocks_c(unsigned int st[5], const unsigned char* p, size_t n)
+{
+	unsigned int m[16];
+	int i;
+
+	for (; n; n--, p += 64)
+	{
+		for (i = 0; i < 16; i++)
+			m[i] = GETBE32(p + 4*i);
+		mzae_sha1_words(st, m);
+	}
+}
+
+
+
+#ifdef MZAE_X86
+#define WK(t) wk[t]
+
+// The schedule is expanded 4 words at a time: W[t+3] depends on W[t], which
+// is computed in the same vector, and is fixed afterwards
+MZAE_TARGET("ssse3")
+static void mzae_sha1_blocks_ssse3(unsigned int st[5], const unsigned char* p, size_t n)
+{
+	static const unsigned int k[4] = {0x5A827999, 0x6ED9EBA1, 0x8F1BBCDC, 0xCA62C1D6};
+	const __m128i bswap = _mm_set_epi8(12,13,14,15, 8,9,10,11, 4,5,6,7, 0,1,2,3);
+	__m128i w[20], v;
+	unsigned int wk[80], a, b, c, d, e;
+	int i;
+
+	for (; n; n--, p += 64)
+	{
+		for (i = 0; i < 4; i++)
+			w[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(p + 16*i)), bswap);
+
+		for (i = 4; i < 20; i++)
+		{
+			v = _mm_xor_si128(_mm_xor_si128(w[i-4], _mm_alignr_epi8(w[i-3], w[i-4], 8)),
+				_mm_xor_si128(w[i-2], _mm_srli_si128(w[i-1], 4)));
+			v = VROL(v, 1);
+			w[i] = _mm_xor_si128(v, VROL(_mm_slli_si128(v, 12), 1));
+		}
+
+		for (i = 0; i < 20; i++)
+			_mm_storeu_si128((__m128i*)(wk + 4*i), _mm_add_epi32(w[i], _mm_set1_epi32((int) k[i/5])));
+
+		a = st[0]; b = st[1]; c = st[2]; d = st[3]; e = st[4];
+		R20(F1, WK, 0)
+		R20(F2, WK, 20)
+		R20(F3, WK, 40)
+		R20(F2, WK, 60)
+		st[0] += a; st[1] += b; st[2] += c; st[3] += d; st[4] += e;
+	}
+}
+
+
+
+// Four rounds with the SHA extensions, computing 4 more schedule words; E
+// alternates between e0 and e1
+#define NIROUNDS(ea, eb, m0, m1, m2, m3, f) \
+	ea = _mm_sha1nexte_epu32(ea, m0); \
+	eb = abcd; \
+	m1 = _mm_sha1msg2_epu32(m1, m0); \
+	abcd = _mm_sha1rnds4_epu32(abcd, ea, f); \
+	m3 = _mm_sha1msg1_epu32(m3, m0); \
+	m2 = _mm_xor_si128(m2, m0);
+
+MZAE_TARGET("sha,sse4.1")
+static void mzae_sha1_blocks_shani(unsigned int st[5], const unsigned char* p, size_t n)
+{
+	const __m128i bswap = _mm_set_epi64x(0x0001020304050607ULL, 0x08090A0B0C0D0E0FULL);
+	__m128i abcd, abcd0, e0, e00, e1, m0, m1, m2, m3;
+
+	abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*) st), 0x1B);
+	e0 = _mm_set_epi32((int) st[4], 0, 0, 0);
+
+	for (; n; n--, p += 64)
+	{
+		abcd0 = abcd;
+		e00 = e0;
+
+		// Rounds 0-15 load the message
+		m0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) p), bswap);
+		e0 = _mm_add_epi32(e0, m0);
+		e1 = abcd;
+		abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+
+		m1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(p + 16)), bswap);
+		e1 = _mm_sha1nexte_epu32(e1, m1);
+		e0 = abcd;
+		abcd = _mm_sha1rnds4_epu32(abcd, e1, 0);
+		m0 = _mm_sha1msg1_epu32(m0, m1);
+
+		m2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(p + 32)), bswap);
+		e0 = _mm_sha1nexte_epu32(e0, m2);
+		e1 = abcd;
+		abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+		m1 = _mm_sha1msg1_epu32(m1, m2);
+		m0 = _mm_xor_si128(m0, m2);
+
+		m3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(p + 48)), bswap);
+		NIROUNDS(e1, e0, m3, m0, m1, m2, 0);
+
+		// Rounds 16-67
+		NIROUNDS(e0, e1, m0, m1, m2, m3, 0);
+		NIROUNDS(e1, e0, m1, m2, m3, m0, 1);
+		NIROUNDS(e0, e1, m2, m3, m0, m1, 1);
+		NIROUNDS(e1, e0, m3, m0, m1, m2, 1);
+		NIROUNDS(e0, e1, m0, m1, m2, m3, 1);
+		NIROUNDS(e1, e0, m1, m2, m3, m0, 1);
+		NIROUNDS(e0, e1, m2, m3, m0, m1, 2);
+		NIROUNDS(e1, e0, m3, m0, m1, m2, 2);
+		NIROUNDS(e0, e1, m0, m1, m2, m3, 2);
+		NIROUNDS(e1, e0, m1, m2, m3, m0, 2);
+		NIROUNDS(e0, e1, m2, m3, m0, m1, 2);
+		NIROUNDS(e1, e0, m3, m0, m1, m2, 3);
+		NIROUNDS(e0, e1, m0, m1, m2, m3, 3);
+
+		// Rounds 68-79 need no more schedule words
+		e1 = _mm_sha1nexte_epu32(e1, m1);
+		e0 = abcd;
+		m2 = _mm_sha1msg2_epu32(m2, m1);
+		abcd = _mm_sha1rnds4_epu32(abcd, e1, 3);
+		m3 = _mm_xor_si128(m3, m1);
+
+		e0 = _mm_sha1nexte_epu32(e0, m2);
+		e1 = abcd;
+		m3 = _mm_sha1msg2_epu32(m3, m2);
+		abcd = _mm_sha1rnds4_epu32(abcd, e0, 3);
+
+		e1 = _mm_sha1nexte_epu32(e1, m3);
+		e0 = abcd;
+		abcd = _mm_sha1rnds4_epu32(abcd, e1, 3);
+
+		e0 = _mm_sha1nexte_epu32(e0, e00);
+		abcd = _mm_add_epi32(abcd, abcd0);
+	}
+
+	_mm_storeu_si128((__m128i*) st, _mm_shuffle_epi32(abcd, 0x1B));
+	st[4] = (unsigned int) _mm_extract_epi32(e0, 3);
+}
+
+
+
+// Tells whether the processor supports a kernel: SSSE3, and SSE4.1 with the
+// SHA extensions for the SHA kernel
+static int mzae_sha1_cpu(int kernel)
+{
+	unsigned int need = MZAE_CPU_SSSE3;
+
+	if (kernel == MZAE_SHA1_SHANI)
+		need |= MZAE_CPU_SSE41 | MZAE_CPU_SHA;
+
+	return kernel == MZAE_SHA1_C || (MZAE_cpu_features() & need) == need;
+}
+#endif
+
+
+
+int MZAE_sha1_kernel(int kernel)
+{
+	if (kernel >= MZAE_SHA1_AUTO && kernel <= MZAE_SHA1_SHANI)
+		mzae_sha1_pref = kernel;
+
+	kernel = mzae_sha1_pref;
+
+#ifdef MZAE_X86
+	if (kernel == MZAE_SHA1_AUTO)
+		kernel = mzae_sha1_cpu(MZAE_SHA1_SHANI)? MZAE_SHA1_SHANI : MZAE_SHA1_SSSE3;
+	if (kernel == MZAE_SHA1_SHANI && !mzae_sha1_cpu(MZAE_SHA1_SHANI))
+		kernel = MZAE_SHA1_SSSE3;
+	if (kernel == MZAE_SHA1_SSSE3 && !mzae_sha1_cpu(MZAE_SHA1_SSSE3))
+		kernel = MZAE_SHA1_C;
+#else
+	kernel = MZAE_SHA1_C;
+#endif
+
+	return kernel;
+}
+
+
+
+// Returns the compression function for the kernel in use
+static mzae_sha1_fn mzae_sha1_select(void)
+{
+	switch (MZAE_sha1_kernel(-1))
+	{
+#ifdef MZAE_X86
+	case MZAE_SHA1_SHANI:
+		return mzae_sha1_blocks_shani;
+	case MZAE_SHA1_SSSE3:
+		return mzae_sha1_blocks_ssse3;
+#endif
+	default:
+		return mzae_sha1_blocks_c;
+	}
+}
+
+
+
+// Streaming SHA-1, possibly resuming from a precomputed state
+struct mzae_sha1 {
+	mzae_sha1_fn blocks;
+	unsigned int st[5];
+	unsigned char buf[64];
+	unsigned long long len; // bytes hashed so far
+};
+
+static void mzae_sha1_update(struct mzae_sha1* h, const unsigned char* p, size_t n)
+{
+	unsigned int used = (unsigned int)(h->len & 63);
+	size_t k;
+
+	h->len += n;
+	if (used)
+	{
+		k = 64 - used < n ? 64 - used : n;
+		memcpy(h->buf + used, p, k);
+		p += k;
+		n -= k;
+		if (used + k < 64)
+			return;
+		h->blocks(h->st, h->buf, 1);
+	}
+	if (n >= 64)
+		h->blocks(h->st, p, n / 64);
+	p += n & ~(size_t)63;
+	memcpy(h->buf, p, n & 63);
+}
+
+static void mzae_sha1_final(struct mzae_sha1* h, unsigned char digest[20])
+{
+	unsigned long long bits = h->len * 8;
+	unsigned int used = (unsigned int)(h->len & 63), i;
+
+	h->buf[used++] = 0x80;
+	if (used > 56)
+	{
+		memset(h->buf + used, 0, 64 - used);
+		h->blocks(h->st, h->buf, 1);
+		used = 0;
+	}
+	memset(h->buf + used, 0, 56 - used);
+	PUTBE32(h->buf + 56, (unsigned int)(bits >> 32));
+	PUTBE32(h->buf + 60, (unsigned int) bits);
+	h->blocks(h->st, h->buf, 1);
+
+	for (i = 0; i < 5; i++)
+		PUTBE32(digest + 4*i, h->st[i]);
+}
+
+
+
+// Computes the states after the inner and outer pad blocks of an HMAC key
+static void mzae_hmac_pads(mzae_sha1_fn blocks, const unsigned char* key, size_t keylen,
+	unsigned int istate[5], unsigned int ostate[5])
+{
+	unsigned char pad[64];
+	struct mzae_sha1 h;
+	int i;
+
+	// Long keys are hashed first
+	memset(pad, 0, 64);
+	if (keylen > 64)
+	{
+		h.blocks = blocks;
+		memcpy(h.st, mzae_sha1_iv, sizeof(h.st));
+		h.len = 0;
+		mzae_sha1_update(&h, key, keylen);
+		mzae_sha1_final(&h, pad);
+		memset(&h, 0, sizeof(h));
+	}
+	else if (keylen)
+		memcpy(pad, key, keylen);
+
+	for (i = 0; i < 64; i++)
+		pad[i] ^= 0x36;
+	memcpy(istate, mzae_sha1_iv, 20);
+	blocks(istate, pad, 1);
+
+	for (i = 0; i < 64; i++)
+		pad[i] ^= 0x36 ^ 0x5C;
+	memcpy(ostate, mzae_sha1_iv, 20);
+	blocks(ostate, pad, 1);
+
+	memset(pad, 0, 64);
+}
+
+
+
+struct mzae_hmac_sha1 {
+	struct mzae_sha1 inner;
+	unsigned int istate[5], ostate[5];
+};
+
+
+
+static void mzae_hmac_sha1_reset(void* hmac)
+{
+	struct mzae_hmac_sha1* h = (struct mzae_hmac_sha1*) hmac;
+
+	memcpy(h->inner.st, h->istate, 20);
+	h->inner.len = 64;
+}
+
+
+
+static int mzae_hmac_sha1_init(void* hmac, char* key, unsigned int keylen)
+{
+	struct mzae_hmac_sha1* h = (struct mzae_hmac_sha1*) hmac;
+
+	h->inner.blocks = mzae_sha1_select();
+	mzae_hmac_pads(h->inner.blocks, (unsigned char*) key, keylen, h->istate, h->ostate);
+	mzae_hmac_sha1_reset(h);
+
+	return 0;
+}
+
+
+
+static void mzae_hmac_sha1_update(void* hmac, char* src, unsigned int srclen)
+{
+	struct mzae_hmac_sha1* h = (struct mzae_hmac_sha1*) hmac;
+
+	mzae_sha1_update(&h->inner, (unsigned char*) src, srclen);
+}
+
+
+
+static void mzae_hmac_sha1_final(void* hmac, char* digest10)
+{
+	struct mzae_hmac_sha1* ctx = (struct mzae_hmac_sha1*) hmac;
+	unsigned char digest[20];
+	struct mzae_sha1* h = &ctx->inner;
+
+	if (digest10)
+	{
+		mzae_sha1_final(h, digest);
+		memcpy(h->st, ctx->ostate, 20);
+		h->len = 64;
+		mzae_sha1_update(h, digest, 20);
+		mzae_sha1_final(h, digest);
+		memcpy(digest10, digest, 10);
+		memset(digest, 0, 20);
+	}
+
+	memset(ctx, 0, sizeof(struct mzae_hmac_sha1));
+}
+
+
+
+const MZAE_HMAC_OPS MZAE_hmac_builtin = {
+	sizeof(struct mzae_hmac_sha1), mzae_hmac_sha1_init, mzae_hmac_sha1_update,
+	mzae_hmac_sha1_reset, mzae_hmac_sha1_final
+};
+
+
+
+int MZAE_hmac_sha1_80_into(char* key, unsigned int keylen, char* src, unsigned int srclen, char* hmac)
+{
+	MZAE_HMAC* ctx;
+
+	if (!keylen || !srclen)
+		return -1;
+
+	if (MZAE_hmac_init(&ctx, key, keylen))
+		return 1;
+	MZAE_hmac_update(ctx, src, srclen);
+	MZAE_hmac_final(ctx, hmac);
+
+	return 0;
+}
+
+
+
+int MZAE_hmac_sha1_80(char* key, unsigned int keylen, char* src, unsigned int srclen, char** hmac)
+{
+	// One buffer per thread, valid until its next call
+	static MZAE_TLS char digest[10];
+	int ret;
+
+	if ((ret = MZAE_hmac_sha1_80_into(key, keylen, src, srclen, digest)))
+		return ret;
+	*hmac = digest;
+
+	return 0;
+}
+
+
+
+#ifdef MZAE_SHA1_SSE2
+// Four phases of 20 rounds, each with its own function and constant. The
+// message schedule is expanded in place from round 16
+#define VROUND(i, f) \
+	if ((i) >= 16) { \
+		t = _mm_xor_si128(_mm_xor_si128(w[((i)-3) & 15], w[((i)-8) & 15]), _mm_xor_si128(w[((i)-14) & 15], w[(i) & 15])); \
+		w[(i) & 15] = VROL(t, 1); \
+	} \
+	t = _mm_add_epi32(_mm_add_epi32(VROL(a, 5), f), _mm_add_epi32(_mm_add_epi32(e, k), w[(i) & 15])); \
+	e = d; d = c; c = VROL(b, 30); b = a; a = t;
+
+// Compresses 4 independent blocks, word i of lane j being in m[i] element j
+static void mzae_sha1_x4(__m128i st[5], const __m128i m[16])
+{
+	__m128i w[16], a, b, c, d, e, k, t;
+	int i;
+
+	memcpy(w, m, sizeof(w));
+	a = st[0]; b = st[1]; c = st[2]; d = st[3]; e = st[4];
+
+	k = _mm_set1_epi32(0x5A827999);
+	for (i = 0; i < 20; i++)
+	{
+		VROUND(i, _mm_xor_si128(d, _mm_and_si128(b, _mm_xor_si128(c, d))));
+	}
+	k = _mm_set1_epi32(0x6ED9EBA1);
+	for (; i < 40; i++)
+	{
+		VROUND(i, _mm_xor_si128(_mm_xor_si128(b, c), d));
+	}
+	k = _mm_set1_epi32((int) 0x8F1BBCDC);
+	for (; i < 60; i++)
+	{
+		VROUND(i, _mm_or_si128(_mm_and_si128(b, c), _mm_and_si128(d, _mm_or_si128(b, c))));
+	}
+	k = _mm_set1_epi32((int) 0xCA62C1D6);
+	for (; i < 80; i++)
+	{
+		VROUND(i, _mm_xor_si128(_mm_xor_si128(b, c), d));
+	}
+
+	st[0] = _mm_add_epi32(st[0], a);
+	st[1] = _mm_add_epi32(st[1], b);
+	st[2] = _mm_add_epi32(st[2], c);
+	st[3] = _mm_add_epi32(st[3], d);
+	st[4] = _mm_add_epi32(st[4], e);
+}
+
+// Iterates U = HMAC(U) in 4 lanes, xoring each U into T
+static void mzae_pbkdf2_x4(const unsigned int istate[5], const unsigned int ostate[5],
+	unsigned int u[MZAE_SHA1_LANES][5], unsigned int t[MZAE_SHA1_LANES][5], unsigned int iterations)
+{
+	__m128i vi[5], vo[5], vu[5], vt[5], st[5], m[16];
+	unsigned int i, j, n;
+
+	for (i = 0; i < 5; i++)
+	{
+		vi[i] = _mm_set1_epi32((int) istate[i]);
+		vo[i] = _mm_set1_epi32((int) ostate[i]);
+		vu[i] = _mm_setr_epi32((int) u[0][i], (int) u[1][i], (int) u[2][i], (int) u[3][i]);
+		vt[i] = _mm_setr_epi32((int) t[0][i], (int) t[1][i], (int) t[2][i], (int) t[3][i]);
+	}
+
+	// A 20 bytes message after the 64 bytes pad block: the padding is fixed
+	m[5] = _mm_set1_epi32((int) 0x80000000);
+	for (i = 6; i < 15; i++)
+		m[i] = _mm_setzero_si128();
+	m[15] = _mm_set1_epi32((64 + 20) * 8);
+
+	for (n = 1; n < iterations; n++)
+	{
+		memcpy(st, vi, sizeof(st));
+		memcpy(m, vu, sizeof(vu));
+		mzae_sha1_x4(st, m);
+
+		memcpy(vu, vo, sizeof(vu));
+		memcpy(m, st, sizeof(st));
+		mzae_sha1_x4(vu, m);
+
+		for (i = 0; i < 5; i++)
+			vt[i] = _mm_xor_si128(vt[i], vu[i]);
+	}
+
+	for (i = 0; i < 5; i++)
+	{
+		unsigned int lane[4];
+		_mm_storeu_si128((__m128i*) lane, vt[i]);
+		for (j = 0; j < MZAE_SHA1_LANES; j++)
+			t[j][i] = lane[j];
+	}
+}
+#endif
+
+// Iterates U = HMAC(U) one lane after another with the given kernel
+static void mzae_pbkdf2_serial(mzae_sha1_fn blocks, const unsigned int istate[5], const unsigned int ostate[5],
+	unsigned int u[MZAE_SHA1_LANES][5], unsigned int t[MZAE_SHA1_LANES][5], unsigned int lanes, unsigned int iterations)
+{
+	unsigned char m[64];
+	unsigned int st[5], i, j, n;
+
+	memset(m, 0, 64);
+	m[20] = 0x80;
+	PUTBE32(m + 60, (64 + 20) * 8);
+
+	for (j = 0; j < lanes; j++)
+		for (n = 1; n < iterations; n++)
+		{
+			for (i = 0; i < 5; i++)
+				PUTBE32(m + 4*i, u[j][i]);
+			memcpy(st, istate, sizeof(st));
+			blocks(st, m, 1);
+
+			for (i = 0; i < 5; i++)
+				PUTBE32(m + 4*i, st[i]);
+			memcpy(u[j], ostate, 20);
+			blocks(u[j], m, 1);
+
+			for (i = 0; i < 5; i++)
+				t[j][i] ^= u[j][i];
+		}
+
+	memset(m, 0, 64);
+	memset(st, 0, sizeof(st));
+}
+
+
+
+int MZAE_pbkdf2_sha1(char* password, unsigned int pwlen, char* salt, unsigned int saltlen, unsigned int iterations, char* key, unsigned int keylen)
+{
+	unsigned int istate[5], ostate[5];
+	unsigned int u[MZAE_SHA1_LANES][5], t[MZAE_SHA1_LANES][5];
+	unsigned char digest[20], index[4];
+	struct mzae_sha1 h;
+	mzae_sha1_fn blocks = mzae_sha1_select();
+	unsigned int block, lane, lanes, i, n;
+
+	if (!iterations || !keylen)
+		return 1;
+
+	// Inner and outer pad states are computed once for all the iterations
+	mzae_hmac_pads(blocks, (unsigned char*) password, pwlen, istate, ostate);
+	h.blocks = blocks;
+
+	for (block = 1; keylen; block += lanes)
+	{
+		lanes = (keylen + 19) / 20;
+		if (lanes > MZAE_SHA1_LANES)
+			lanes = MZAE_SHA1_LANES;
+
+		// U1 = HMAC(salt || INT(block)), then T = U1
+		memset(u, 0, sizeof(u));
+		for (lane = 0; lane < lanes; lane++)
+		{
+			PUTBE32(index, block + lane);
+			memcpy(h.st, istate, sizeof(h.st));
+			h.len = 64;
+			mzae_sha1_update(&h, (unsigned char*) salt, saltlen);
+			mzae_sha1_update(&h, index, 4);
+			mzae_sha1_final(&h, digest);
+
+			memcpy(h.st, ostate, sizeof(h.st));
+			h.len = 64;
+			mzae_sha1_update(&h, digest, 20);
+			mzae_sha1_final(&h, digest);
+
+			for (i = 0; i < 5; i++)
+				u[lane][i] = GETBE32(digest + 4*i);
+		}
+		memcpy(t, u, sizeof(t));
+
+		// The SHA extensions beat 4 SSE2 lanes even one block at a time;
+		// unused SSE2 lanes compute garbage, which is discarded
+#ifdef MZAE_SHA1_SSE2
+		if (blocks == mzae_sha1_blocks_c || blocks == mzae_sha1_blocks_ssse3)
+			mzae_pbkdf2_x4(istate, ostate, u, t, iterations);
+		else
+#endif
+			mzae_pbkdf2_serial(blocks, istate, ostate, u, t, lanes, iterations);
+
+		for (lane = 0; lane < lanes; lane++)
+		{
+			for (i = 0; i < 5; i++)
+				PUTBE32(digest + 4*i, t[lane][i]);
+			n = keylen < 20 ? keylen : 20;
+			memcpy(key, digest, n);
+			key += n;
+			keylen -= n;
+		}
+	}
+
+	memset(&h, 0, sizeof(h));
+	memset(digest, 0, sizeof(digest));
+	memset(istate, 0, sizeof(istate));
+	memset(ostate, 0, sizeof(ostate));
+	memset(u, 0, sizeof(u));
+	memset(t, 0, sizeof(t));
+
+	return 0;
+}
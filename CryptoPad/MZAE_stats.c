@@ -0,0 +1,97 @@
+/*
+ *  Copyright (C) 2016-2023  maxpat78 <https://github.com/maxpat78>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+	Statistics of the MZAE functions: stage timers
+*/
+#include <MZAE_stats.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+
+
+unsigned long long MZAE_now(void)
+{
+#ifdef _WIN32
+	static LARGE_INTEGER freq;
+	LARGE_INTEGER t;
+
+	if (!freq.QuadPart)
+		QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&t);
+	return (unsigned long long)(t.QuadPart / freq.QuadPart) * 1000000000ULL +
+		(unsigned long long)(t.QuadPart % freq.QuadPart) * 1000000000ULL / freq.QuadPart;
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+
+
+void MZAE_stats_begin(MZAE_STATS* stats)
+{
+	memset(stats, 0, sizeof(MZAE_STATS));
+	stats->total_ns = MZAE_now();
+}
+
+
+
+void MZAE_stats_end(MZAE_STATS* stats)
+{
+	stats->total_ns = MZAE_now() - stats->total_ns;
+}
+
+
+
+static unsigned long long mzae_stats_sum(MZAE_STATS* stats)
+{
+	unsigned long long sum = 0;
+	int i;
+
+	for (i = 0; i < MZAE_STAGES; i++)
+		sum += stats->ns[i];
+
+	return sum;
+}
+
+
+
+void MZAE_timer_start(MZAE_STATS* stats, MZAE_TIMER* timer)
+{
+	timer->nested = mzae_stats_sum(stats);
+	timer->start = MZAE_now();
+}
+
+
+
+void MZAE_timer_stop(MZAE_STATS* stats, MZAE_TIMER* timer, int stage, unsigned long len)
+{
+	unsigned long long t = MZAE_now() - timer->start;
+	unsigned long long nested = mzae_stats_sum(stats) - timer->nested;
+
+	stats->ns[stage] += t > nested ? t - nested : 0;
+	stats->bytes[stage] += len;
+}
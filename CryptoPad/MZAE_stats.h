@@ -0,0 +1,69 @@
+/*
+ *  Copyright (C) 2016-2023  maxpat78 <https://github.com/maxpat78>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+   MZAE_stats.h
+
+   Stage timers used internally by the MZAE functions to fill in MZAE_STATS
+   (scratch memory is accounted by MZAE_alloc.c). Every stage is timed only when the caller passed a
+   statistics structure, so the cost is a pointer test otherwise.
+*/
+
+#if !defined(__MZAE_STATS__)
+#define __MZAE_STATS__
+
+#include <mZipAES.h>
+
+# ifdef  __cplusplus
+extern "C" {
+# endif
+
+// A stage being timed, and the time spent meanwhile in the stages it calls
+typedef struct {
+	unsigned long long start, nested;
+} MZAE_TIMER;
+
+#define MZAE_TIMER_START(s, tm) ((s) ? MZAE_timer_start(s, &(tm)) : (void) 0)
+#define MZAE_TIMER_STOP(s, tm, stage, len) ((s) ? MZAE_timer_stop(s, &(tm), stage, len) : (void) 0)
+
+
+/*
+	Returns a monotonic time in nanoseconds.
+*/
+unsigned long long MZAE_now(void);
+
+
+/*
+	Clears stats and starts timing a call, until MZAE_stats_end.
+*/
+void MZAE_stats_begin(MZAE_STATS* stats);
+void MZAE_stats_end(MZAE_STATS* stats);
+
+
+/*
+	Accounts to stage the time elapsed since MZAE_timer_start, less the time
+	accounted to other stages in the meantime, and len processed bytes.
+*/
+void MZAE_timer_start(MZAE_STATS* stats, MZAE_TIMER* timer);
+void MZAE_timer_stop(MZAE_STATS* stats, MZAE_TIMER* timer, int stage, unsigned long len);
+
+# ifdef  __cplusplus
+}
+# endif
+
+#endif // __MZAE_STATS__
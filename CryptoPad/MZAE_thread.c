@@ -0,0 +1,169 @@
+/*
+ *  Copyright (C) 2016-2023  maxpat78 <https://github.com/maxpat78>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+	Threads on top of Win32 or POSIX
+*/
+#include <MZAE_thread.h>
+#include <MZAE_alloc.h>
+#include <stdlib.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+
+
+struct mzae_thread {
+#ifdef _WIN32
+	HANDLE handle;
+#else
+	pthread_t handle;
+#endif
+	void (*proc)(void*);
+	void* arg;
+};
+
+
+
+#ifdef _WIN32
+static DWORD WINAPI mzae_thread_proc(LPVOID arg)
+{
+	MZAE_THREAD t = (MZAE_THREAD) arg;
+	t->proc(t->arg);
+	return 0;
+}
+#else
+static void* mzae_thread_proc(void* arg)
+{
+	MZAE_THREAD t = (MZAE_THREAD) arg;
+	t->proc(t->arg);
+	return NULL;
+}
+#endif
+
+
+
+int MZAE_thread_start(MZAE_THREAD* thread, void (*proc)(void*), void* arg)
+{
+	MZAE_THREAD t = (MZAE_THREAD) MZAE_malloc(sizeof(struct mzae_thread));
+
+	if (!t)
+		return 1;
+
+	t->proc = proc;
+	t->arg = arg;
+
+#ifdef _WIN32
+	t->handle = CreateThread(NULL, 0, mzae_thread_proc, t, 0, NULL);
+	if (!t->handle)
+#else
+	if (pthread_create(&t->handle, NULL, mzae_thread_proc, t))
+#endif
+	{
+		MZAE_free(t);
+		return 2;
+	}
+
+	*thread = t;
+
+	return 0;
+}
+
+
+
+void MZAE_thread_join(MZAE_THREAD thread)
+{
+#ifdef _WIN32
+	WaitForSingleObject(thread->handle, INFINITE);
+	CloseHandle(thread->handle);
+#else
+	pthread_join(thread->handle, NULL);
+#endif
+	MZAE_free(thread);
+}
+
+
+
+#ifdef _WIN32
+static BOOL CALLBACK mzae_once_proc(PINIT_ONCE once, PVOID proc, PVOID* ctx)
+{
+	((void (*)(void)) proc)();
+	return TRUE;
+}
+#endif
+
+void MZAE_once(MZAE_ONCE* once, void (*proc)(void))
+{
+#ifdef _WIN32
+	InitOnceExecuteOnce((PINIT_ONCE) once, mzae_once_proc, (PVOID) proc, NULL);
+#else
+	pthread_once(once, proc);
+#endif
+}
+
+
+
+int MZAE_key_create(MZAE_KEY* key, void (MZAE_KEY_CALLBACK *destructor)(void*))
+{
+#ifdef _WIN32
+	*key = FlsAlloc((PFLS_CALLBACK_FUNCTION) destructor);
+	return *key == FLS_OUT_OF_INDEXES;
+#else
+	return pthread_key_create(key, destructor) != 0;
+#endif
+}
+
+
+
+void* MZAE_key_get(MZAE_KEY key)
+{
+#ifdef _WIN32
+	return FlsGetValue(key);
+#else
+	return pthread_getspecific(key);
+#endif
+}
+
+
+
+void MZAE_key_set(MZAE_KEY key, void* value)
+{
+#ifdef _WIN32
+	FlsSetValue(key, value);
+#else
+	pthread_setspecific(key, value);
+#endif
+}
+
+
+
+unsigned int MZAE_ncpu(void)
+{
+#ifdef _WIN32
+	SYSTEM_INFO si;
+	GetSystemInfo(&si);
+	return si.dwNumberOfProcessors;
+#else
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return n > 0 ? (unsigned int) n : 1;
+#endif
+}
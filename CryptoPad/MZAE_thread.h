@@ -0,0 +1,116 @@
+/*
+ *  Copyright (C) 2016-2023  maxpat78 <https://github.com/maxpat78>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+   MZAE_thread.h
+
+   Minimal threading layer used internally by the MZAE functions, on top of
+   Win32 threads or POSIX threads.
+*/
+
+#if !defined(__MZAE_THREAD__)
+#define __MZAE_THREAD__
+
+# ifdef  __cplusplus
+extern "C" {
+# endif
+
+typedef struct mzae_thread* MZAE_THREAD;
+
+// Thread local storage class
+#ifdef _WIN32
+#define MZAE_TLS __declspec(thread)
+#else
+#define MZAE_TLS __thread
+#endif
+
+#ifdef _WIN32
+typedef void* MZAE_ONCE; // same layout as INIT_ONCE
+#define MZAE_ONCE_INIT NULL
+#else
+#include <pthread.h>
+typedef pthread_once_t MZAE_ONCE;
+#define MZAE_ONCE_INIT PTHREAD_ONCE_INIT
+#endif
+
+#ifdef _WIN32
+typedef unsigned long MZAE_KEY; // same as a FLS index
+#define MZAE_KEY_CALLBACK __stdcall
+#else
+typedef pthread_key_t MZAE_KEY;
+#define MZAE_KEY_CALLBACK
+#endif
+
+
+/*
+	Runs proc(arg) in a new thread.
+
+	thread		pointer receiving the thread handle
+	proc		thread function
+	arg		its argument
+
+	Returns zero for success.
+*/
+int MZAE_thread_start(MZAE_THREAD* thread, void (*proc)(void*), void* arg);
+
+
+/*
+	Waits for a thread to terminate and releases its handle.
+*/
+void MZAE_thread_join(MZAE_THREAD thread);
+
+
+/*
+	Runs proc() once, the first time it is called with a given flag: other
+	threads calling in the meantime wait for it to complete.
+
+	once		flag statically initialized with MZAE_ONCE_INIT
+	proc		initialization function
+*/
+void MZAE_once(MZAE_ONCE* once, void (*proc)(void));
+
+
+/*
+	Creates a thread specific slot, initially NULL in every thread.
+
+	key			pointer receiving the new slot
+	destructor	called with the value left by a thread when it terminates,
+				if not NULL (declared MZAE_KEY_CALLBACK)
+
+	Returns zero for success.
+*/
+int MZAE_key_create(MZAE_KEY* key, void (MZAE_KEY_CALLBACK *destructor)(void*));
+
+
+/*
+	Get and set the value of a thread specific slot for the calling thread.
+*/
+void* MZAE_key_get(MZAE_KEY key);
+void MZAE_key_set(MZAE_KEY key, void* value);
+
+
+/*
+	Returns the number of processors available.
+*/
+unsigned int MZAE_ncpu(void);
+
+# ifdef  __cplusplus
+}
+# endif
+
+#endif // __MZAE_THREAD__
@@ -17,51 +17,522 @@
  */
 
 /*
-Provides functions to calculate ZIP crc32 and to deflate and inflate an archive
-in a single pass.
+Provides functions to deflate and inflate an archive in a single pass or
+in chunks, and selects the codec of single pass ones. Long inputs are
+deflated in slices on several threads.
 
 Requires Zlib.
 */
 #include <mZipAES.h>
+#include <MZAE_alloc.h>
+#include <MZAE_codec.h>
+#include <MZAE_thread.h>
 #include <stdlib.h>
+#include <string.h>
 #include <zlib.h>
 
 
 
-unsigned long MZAE_crc(unsigned long crc, char* src, unsigned int srclen)
+// zlib state of the codecs is scratch memory (zlib does not need it zeroed)
+static voidpf mzae_zalloc(voidpf opaque, uInt items, uInt size)
 {
-	return crc32(crc, src, srclen);
+	if (size && items > (size_t) -1 / size)
+		return Z_NULL;
+	return MZAE_malloc((size_t) items * size);
 }
 
+static void mzae_zfree(voidpf opaque, voidpf p)
+{
+	MZAE_free(p);
+}
 
 
-int MZAE_deflate(char* src, unsigned int srclen, char** dst, unsigned int* dstlen)
+
+static size_t mzae_zlib_bound(int level, size_t srclen)
 {
-	z_stream zstream;
-	*dst = (char*) malloc(srclen+64);
+	// Raw Deflate takes 6 bytes less than this
+	return compressBound((uLong) srclen);
+}
 
-	if (! *dst)
+static int mzae_zlib_deflate(int level, char* src, size_t srclen, char* dst, size_t* dstlen)
+{
+	z_stream zs;
+	int ret;
+
+	memset(&zs, 0, sizeof(zs));
+	zs.zalloc = mzae_zalloc;
+	zs.zfree = mzae_zfree;
+
+	if (deflateInit2(&zs, level, Z_DEFLATED, -15, 9, Z_DEFAULT_STRATEGY) != Z_OK)
+		return 2;
+
+	zs.next_in = (Bytef*) src;
+	zs.avail_in = (uInt) srclen;
+	zs.next_out = (Bytef*) dst;
+	zs.avail_out = (uInt) *dstlen;
+
+	ret = deflate(&zs, Z_FINISH);
+	*dstlen = zs.total_out;
+	deflateEnd(&zs);
+
+	return ret != Z_STREAM_END;
+}
+
+static int mzae_zlib_inflate(char* src, size_t srclen, char* dst, size_t dstlen)
+{
+	z_stream zs;
+	int ret;
+
+	memset(&zs, 0, sizeof(zs));
+	zs.zalloc = mzae_zalloc;
+	zs.zfree = mzae_zfree;
+
+	if (inflateInit2(&zs, -15) != Z_OK)
+		return 1;
+
+	zs.next_in = (Bytef*) src;
+	zs.avail_in = (uInt) srclen;
+	zs.next_out = (Bytef*) dst;
+	zs.avail_out = (uInt) dstlen;
+
+	ret = inflate(&zs, Z_FINISH);
+	inflateEnd(&zs);
+
+	if (ret != Z_STREAM_END)
+		return 2;
+
+	if (zs.avail_in || zs.total_out != dstlen)
+		return 3;
+
+	return 0;
+}
+
+const MZAE_CODEC MZAE_codec_zlib = {
+	"zlib", mzae_zlib_bound, mzae_zlib_deflate, mzae_zlib_inflate
+};
+
+
+
+// Codecs built in, by MZAE_CODEC_*
+static const MZAE_CODEC* mzae_codecs[MZAE_CODECS] = {
+	NULL,
+	&MZAE_codec_zlib,
+#ifdef MZAE_LIBDEFLATE
+	&MZAE_codec_libdeflate,
+#else
+	NULL,
+#endif
+};
+
+static int mzae_codec_pref;
+
+
+
+int MZAE_codec(int codec)
+{
+	if (codec >= MZAE_CODEC_AUTO && codec < MZAE_CODECS)
+		mzae_codec_pref = codec;
+
+	codec = mzae_codec_pref;
+
+	// The last built in is the fastest
+	if (codec == MZAE_CODEC_AUTO || !mzae_codecs[codec])
+		for (codec = MZAE_CODECS - 1; !mzae_codecs[codec]; codec--)
+			;
+
+	return codec;
+}
+
+
+
+const char* MZAE_codec_name(int codec)
+{
+	if (codec == MZAE_CODEC_AUTO)
+		return "auto";
+	if (codec < 0 || codec >= MZAE_CODECS || !mzae_codecs[codec])
+		return NULL;
+
+	return mzae_codecs[codec]->name;
+}
+
+
+
+const MZAE_CODEC* MZAE_codec_get(void)
+{
+	return mzae_codecs[MZAE_codec(-1)];
+}
+
+
+
+// Parallel Deflate settings, see MZAE_deflate_threads
+static unsigned long mzae_deflate_threshold = 1 << 20;
+static unsigned int mzae_deflate_maxthreads = 0;
+
+// Smallest slice worth a thread
+#define MZAE_DEFLATE_SLICE (256 << 10)
+
+// Preceding data primed as dictionary of a slice
+#define MZAE_DEFLATE_DICT 32768
+
+// Sync flush marker and block headers added by each slice
+#define MZAE_DEFLATE_SLACK 32
+
+void MZAE_deflate_threads(unsigned long threshold, unsigned int threads)
+{
+	mzae_deflate_threshold = threshold;
+	mzae_deflate_maxthreads = threads;
+}
+
+
+
+unsigned int MZAE_codec_threads(size_t len)
+{
+	unsigned int n;
+
+	if (!mzae_deflate_threshold || len < mzae_deflate_threshold)
 		return 1;
 
-	memset(&zstream, 0, sizeof(zstream));
-	zstream.zalloc = Z_NULL;
-	zstream.zfree = Z_NULL;
-	zstream.opaque = Z_NULL;
+	n = mzae_deflate_maxthreads ? mzae_deflate_maxthreads : MZAE_ncpu();
+	if (n > len / MZAE_DEFLATE_SLICE)
+		n = (unsigned int) (len / MZAE_DEFLATE_SLICE);
+
+	return n < 2 ? 1 : n;
+}
+
+
+
+// A slice of uncompressed data (with the data preceding it, if primed) and
+// of compressed ones
+struct mzae_slice {
+	char *src, *dict, *out;
+	size_t len, dictlen, outlen;
+	int level, strategy, last, crcpass, ret;
+	unsigned long crc;
+};
+
+// The slices a thread takes: first, first+step, first+2*step...
+struct mzae_lane {
+	struct mzae_slice* slices;
+	unsigned int first, step, n;
+	void (*proc)(struct mzae_slice*);
+	MZAE_THREAD thread;
+	int started;
+};
+
+static void mzae_lane_worker(void* arg)
+{
+	struct mzae_lane* l = (struct mzae_lane*) arg;
+	unsigned int i;
+
+	for (i = l->first; i < l->n; i += l->step)
+		l->proc(&l->slices[i]);
+}
+
+// Runs proc on n slices with up to threads threads, the calling one
+// included: lanes without a thread run on this one
+static int mzae_lanes(struct mzae_slice* slices, unsigned int n, unsigned int threads, void (*proc)(struct mzae_slice*))
+{
+	struct mzae_lane* lanes;
+	unsigned int i;
+
+	if (threads > n)
+		threads = n;
+	if (threads < 1)
+		threads = 1;
 
-	if (deflateInit2(&zstream, 8, Z_DEFLATED, -15, 9, Z_DEFAULT_STRATEGY) != Z_OK)
+	lanes = (struct mzae_lane*) MZAE_calloc(threads, sizeof(struct mzae_lane));
+	if (!lanes)
 		return 2;
 
-	zstream.next_in = src;
-	zstream.avail_in = srclen;
-	zstream.next_out = *dst;
-	zstream.avail_out = srclen+64;
+	for (i = 0; i < threads; i++)
+	{
+		lanes[i].slices = slices;
+		lanes[i].first = i;
+		lanes[i].step = threads;
+		lanes[i].n = n;
+		lanes[i].proc = proc;
+	}
+
+	for (i = 1; i < threads; i++)
+		lanes[i].started = !MZAE_thread_start(&lanes[i].thread, mzae_lane_worker, &lanes[i]);
+	mzae_lane_worker(&lanes[0]);
+	for (i = 1; i < threads; i++)
+	{
+		if (lanes[i].started)
+			MZAE_thread_join(lanes[i].thread);
+		else
+			mzae_lane_worker(&lanes[i]);
+	}
+
+	MZAE_free(lanes);
+
+	return 0;
+}
+
+
+
+// Deflates a slice, CRC-ing each chunk before it: all but the last end with
+// a sync flush, which leaves them on a byte boundary and not final, so that
+// their outputs chain into one stream
+static void mzae_deflate_slice(struct mzae_slice* s)
+{
+	size_t i, n;
+	z_stream zs;
+	int ret;
+
+	memset(&zs, 0, sizeof(zs));
+	zs.zalloc = mzae_zalloc;
+	zs.zfree = mzae_zfree;
+
+	s->ret = 2;
+	if (deflateInit2(&zs, s->level, Z_DEFLATED, -15, 9, s->strategy) != Z_OK)
+		return;
+
+	if (s->dictlen && deflateSetDictionary(&zs, (Bytef*) s->dict, (uInt) s->dictlen) != Z_OK)
+	{
+		deflateEnd(&zs);
+		return;
+	}
+
+	zs.next_out = (Bytef*) s->out;
+	zs.avail_out = (uInt) s->outlen;
+
+	for (i = 0, ret = Z_OK; ret == Z_OK && i < s->len; i += n)
+	{
+		n = s->len - i < MZAE_CHUNK ? s->len - i : MZAE_CHUNK;
+		if (s->crcpass)
+			s->crc = MZAE_crc(s->crc, s->src + i, (unsigned int) n);
+		zs.next_in = (Bytef*) s->src + i;
+		zs.avail_in = (uInt) n;
+		ret = deflate(&zs, Z_NO_FLUSH);
+		if (zs.avail_in)
+			ret = Z_BUF_ERROR;
+	}
+
+	if (ret == Z_OK)
+		ret = deflate(&zs, s->last ? Z_FINISH : Z_SYNC_FLUSH);
+
+	// An exhausted output may hide an unfinished flush
+	if (s->last)
+		s->ret = ret != Z_STREAM_END;
+	else
+		s->ret = ret != Z_OK || !zs.avail_out;
+
+	s->outlen = zs.total_out;
+	deflateEnd(&zs);
+}
+
+
+
+int MZAE_deflate_parallel(int level, int strategy, unsigned int threads, size_t span, char* src, size_t srclen, char* dst, size_t* dstlen, unsigned long* crc, unsigned long* index)
+{
+	struct mzae_slice* slices;
+	size_t done, used;
+	unsigned int i, n;
+	int ret = 0, primed = !span;
+
+	// One slice per thread, primed; or independent slices of span bytes
+	n = span ? (unsigned int) ((srclen + span - 1) / span) : threads;
+	if (primed)
+		span = n ? srclen / n : 0;
+	if (!n || !span)
+		return 2;
+
+	slices = (struct mzae_slice*) MZAE_calloc(n, sizeof(struct mzae_slice));
+	if (!slices)
+		return 2;
+
+	for (i = 0, done = 0; i < n; i++, done += span)
+	{
+		struct mzae_slice* s = &slices[i];
+
+		s->src = src + done;
+		s->len = i < n - 1 ? span : srclen - done;
+		if (primed)
+			s->dictlen = done < MZAE_DEFLATE_DICT ? done : MZAE_DEFLATE_DICT;
+		s->dict = s->src - s->dictlen;
+		s->level = level;
+		s->strategy = strategy;
+		s->last = i == n - 1;
+		s->crcpass = crc != NULL;
+	}
+
+	// The first slice goes straight into dst, the others into buffers of
+	// their own, whose sizes are unknown in advance
+	slices[0].out = dst;
+	slices[0].outlen = *dstlen;
+
+	for (i = 1; i < n; i++)
+	{
+		struct mzae_slice* s = &slices[i];
 
-	if (deflate(&zstream, Z_FINISH) != Z_STREAM_END)
+		s->outlen = compressBound((uLong) s->len) + MZAE_DEFLATE_SLACK;
+		s->out = (char*) MZAE_malloc(s->outlen);
+		if (!s->out)
+			break;
+	}
+
+	ret = i < n ? 2 : mzae_lanes(slices, n, threads, mzae_deflate_slice);
+
+	// Chains the outputs, and merges the CRCs
+	used = slices[0].outlen;
+	ret = ret ? ret : slices[0].ret;
+	if (crc && !ret)
+		*crc = MZAE_crc_combine(*crc, slices[0].crc, (unsigned long) slices[0].len);
+
+	for (i = 1; i < n; i++)
+	{
+		struct mzae_slice* s = &slices[i];
+
+		if (!ret)
+			ret = s->ret;
+		if (!ret && s->outlen > *dstlen - used)
+			ret = 1;
+		if (!ret)
+		{
+			if (index)
+				index[i - 1] = (unsigned long) used;
+			memcpy(dst + used, s->out, s->outlen);
+			used += s->outlen;
+			if (crc)
+				*crc = MZAE_crc_combine(*crc, s->crc, (unsigned long) s->len);
+		}
+		if (s->out)
+			memset(s->out, 0, s->outlen);
+		MZAE_free(s->out);
+	}
+
+	MZAE_free(slices);
+
+	if (!ret)
+		*dstlen = used;
+
+	return ret;
+}
+
+
+
+// Inflates a slice on its own, then CRCs its output: all but the last must
+// end on a byte boundary between blocks, without the final one, where the
+// next slice starts; a back reference before the slice makes it fail
+static void mzae_inflate_slice(struct mzae_slice* s)
+{
+	size_t i, n;
+	z_stream zs;
+	int ret;
+
+	memset(&zs, 0, sizeof(zs));
+	zs.zalloc = mzae_zalloc;
+	zs.zfree = mzae_zfree;
+
+	s->ret = 2;
+	if (inflateInit2(&zs, -15) != Z_OK)
+		return;
+
+	zs.next_in = (Bytef*) s->src;
+	zs.avail_in = (uInt) s->len;
+	zs.next_out = (Bytef*) s->out;
+	zs.avail_out = (uInt) s->outlen;
+
+	// data_type tells the unused bits, the final block and a block boundary
+	ret = inflate(&zs, s->last ? Z_FINISH : Z_NO_FLUSH);
+	if (!s->last)
+		ret = (ret == Z_OK || ret == Z_BUF_ERROR) && (zs.data_type & 0xFF) == 128 ? Z_STREAM_END : Z_DATA_ERROR;
+	if (zs.avail_in || zs.total_out != s->outlen)
+		ret = Z_DATA_ERROR;
+	inflateEnd(&zs);
+
+	if (ret != Z_STREAM_END)
+		return;
+
+	for (i = 0; s->crcpass && i < s->outlen; i += n)
+	{
+		n = s->outlen - i < MZAE_CHUNK ? s->outlen - i : MZAE_CHUNK;
+		s->crc = MZAE_crc(s->crc, s->out + i, (unsigned int) n);
+	}
+
+	s->ret = 0;
+}
+
+
+
+int MZAE_inflate_parallel(unsigned int threads, unsigned int n, unsigned long* index, char* src, size_t srclen, char* dst, size_t dstlen, unsigned long* crc)
+{
+	struct mzae_slice* slices;
+	size_t c0, c1, u0, u1;
+	unsigned long sum = 0;
+	unsigned int i;
+	int ret = 0;
+
+	if (!n)
+		return 2;
+
+	slices = (struct mzae_slice*) MZAE_calloc(n, sizeof(struct mzae_slice));
+	if (!slices)
+		return 2;
+
+	// Offsets must grow strictly, within the buffers
+	for (i = 0, c0 = u0 = 0; !ret && i < n; i++, c0 = c1, u0 = u1)
+	{
+		struct mzae_slice* s = &slices[i];
+
+		c1 = i < n - 1 ? index[2*i] : srclen;
+		u1 = i < n - 1 ? index[2*i + 1] : dstlen;
+		if (c1 <= c0 || u1 <= u0 || c1 > srclen || u1 > dstlen)
+			ret = 3;
+		s->src = src + c0;
+		s->len = c1 - c0;
+		s->out = dst + u0;
+		s->outlen = u1 - u0;
+		s->last = i == n - 1;
+		s->crcpass = crc != NULL;
+	}
+
+	if (!ret)
+		ret = mzae_lanes(slices, n, threads, mzae_inflate_slice);
+
+	for (i = 0; !ret && i < n; i++)
+	{
+		ret = slices[i].ret;
+		sum = MZAE_crc_combine(sum, slices[i].crc, (unsigned long) slices[i].outlen);
+	}
+
+	MZAE_free(slices);
+
+	if (!ret && crc)
+		*crc = sum;
+
+	return ret;
+}
+
+
+
+int MZAE_deflate(char* src, unsigned int srclen, char** dst, unsigned int* dstlen)
+{
+	const MZAE_CODEC* codec = MZAE_codec_get();
+	unsigned int threads = MZAE_codec_threads(srclen);
+	size_t bound, n;
+
+	// Incompressible data grow by some bytes every Stored block
+	if (threads > 1)
+		bound = compressBound(srclen) + threads * MZAE_DEFLATE_SLACK;
+	else
+		bound = codec->bound(8, srclen);
+	n = bound;
+
+	*dst = (char*) malloc(bound);
+
+	if (! *dst)
+		return 1;
+
+	if (threads > 1 ? MZAE_deflate_parallel(8, Z_DEFAULT_STRATEGY, threads, 0, src, srclen, *dst, &n, NULL, NULL)
+		: codec->deflate(8, src, srclen, *dst, &n))
+	{
+		free(*dst);
 		return 3;
+	}
 
-	deflateEnd(&zstream);
-	
-	*dstlen = zstream.total_out;
+	*dstlen = (unsigned int) n;
 
 	return 0;
 }
@@ -70,28 +541,153 @@ int MZAE_deflate(char* src, unsigned int srclen, char** dst, unsigned int* dstle
 
 int MZAE_inflate(char* src, unsigned int srclen, char* dst, unsigned int dstlen)
 {
+	return MZAE_codec_get()->inflate(src, srclen, dst, dstlen) ? 2 : 0;
+}
+
+
+
+struct mzae_deflate {
 	z_stream zstream;
+	char window[MZAE_CHUNK];
+};
+
 
-	memset(&zstream, 0, sizeof(zstream));
-	zstream.zalloc = Z_NULL;
-	zstream.zfree = Z_NULL;
-	zstream.opaque = Z_NULL;
 
-	if (inflateInit2(&zstream, -15) != Z_OK)
+int MZAE_deflate_init(MZAE_DEFLATE** ctx)
+{
+	return MZAE_deflate_init2(ctx, 8, Z_DEFAULT_STRATEGY);
+}
+
+
+
+int MZAE_deflate_init2(MZAE_DEFLATE** ctx, int level, int strategy)
+{
+	MZAE_DEFLATE* d = (MZAE_DEFLATE*) MZAE_malloc(sizeof(MZAE_DEFLATE));
+
+	if (!d)
 		return 1;
 
-	zstream.next_in = src;
-	zstream.avail_in = srclen;
-	zstream.next_out = dst;
-	zstream.avail_out = dstlen;
+	memset(&d->zstream, 0, sizeof(d->zstream));
+	d->zstream.zalloc = mzae_zalloc;
+	d->zstream.zfree = mzae_zfree;
+	d->zstream.opaque = Z_NULL;
 
-	if (inflate(&zstream, Z_NO_FLUSH) != Z_STREAM_END)
+	if (deflateInit2(&d->zstream, level, Z_DEFLATED, -15, 9, strategy) != Z_OK)
+	{
+		MZAE_free(d);
 		return 2;
+	}
 
-	if (zstream.total_out != dstlen)
-		return 3;
+	*ctx = d;
+
+	return 0;
+}
+
+
+
+int MZAE_deflate_update(MZAE_DEFLATE* ctx, char* src, unsigned int srclen, int finish, MZAE_SINK sink, void* opaque)
+{
+	z_stream* zs = &ctx->zstream;
+	unsigned int n;
+	int ret;
+
+	zs->next_in = src;
+	zs->avail_in = srclen;
+
+	do {
+		zs->next_out = ctx->window;
+		zs->avail_out = MZAE_CHUNK;
+
+		ret = deflate(zs, finish? Z_FINISH : Z_NO_FLUSH);
+		if (ret == Z_STREAM_ERROR)
+			return 1;
+
+		n = MZAE_CHUNK - zs->avail_out;
+		if (n && sink(opaque, ctx->window, n))
+			return 2;
+	} while (zs->avail_out == 0 || (finish && ret != Z_STREAM_END));
+
+	return 0;
+}
+
+
+
+void MZAE_deflate_free(MZAE_DEFLATE* ctx)
+{
+	if (!ctx)
+		return;
+	deflateEnd(&ctx->zstream);
+	MZAE_free(ctx);
+}
+
+
+
+struct mzae_inflate {
+	z_stream zstream;
+	char window[MZAE_CHUNK];
+};
+
+
+
+int MZAE_inflate_init(MZAE_INFLATE** ctx)
+{
+	MZAE_INFLATE* d = (MZAE_INFLATE*) MZAE_malloc(sizeof(MZAE_INFLATE));
+
+	if (!d)
+		return 1;
+
+	memset(&d->zstream, 0, sizeof(d->zstream));
+	d->zstream.zalloc = mzae_zalloc;
+	d->zstream.zfree = mzae_zfree;
+	d->zstream.opaque = Z_NULL;
+
+	if (inflateInit2(&d->zstream, -15) != Z_OK)
+	{
+		MZAE_free(d);
+		return 2;
+	}
+
+	*ctx = d;
 
-	inflateEnd(&zstream);
-	
 	return 0;
 }
+
+
+
+int MZAE_inflate_update(MZAE_INFLATE* ctx, char* src, unsigned int srclen, unsigned int* used, MZAE_SINK sink, void* opaque)
+{
+	z_stream* zs = &ctx->zstream;
+	unsigned int n;
+	int ret;
+
+	zs->next_in = src;
+	zs->avail_in = srclen;
+
+	// inflate stops only at the end of the stream, or when input or output are exhausted
+	do {
+		zs->next_out = ctx->window;
+		zs->avail_out = MZAE_CHUNK;
+
+		ret = inflate(zs, Z_NO_FLUSH);
+		if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR)
+			return 2;
+
+		n = MZAE_CHUNK - zs->avail_out;
+		if (n && sink(opaque, ctx->window, n))
+			return 3;
+	} while (ret != Z_STREAM_END && zs->avail_out == 0);
+
+	*used = srclen - zs->avail_in;
+
+	return ret == Z_STREAM_END;
+}
+
+
+
+void MZAE_inflate_free(MZAE_INFLATE* ctx)
+{
+	if (!ctx)
+		return;
+	inflateEnd(&ctx->zstream);
+	MZAE_free(ctx);
+}
@@ -23,6 +23,7 @@
 
 extern HWND hwndMain;
 extern char* document_password;
+extern void PrepareKeys();
 
 HWND hWndDialog;
 WNDPROC wpOrigEditProc;
@@ -75,6 +76,7 @@ PasswordWndProc(HWND hWnd,UINT msg,WPARAM wParam,LPARAM lParam)
 				  {
 					  WideCharToMultiByte(CP_ACP, WC_COMPOSITECHECK | WC_NO_BEST_FIT_CHARS,
 						  password, -1, document_password, 80, NULL, NULL);
+					  PrepareKeys();
 					  PostMessage(hwndMain, WM_COMMAND, IDM_FILE_OPEN, TRUE);
 					  DestroyWindow(hWnd);
 				  }
@@ -98,6 +100,7 @@ PasswordWndProc(HWND hWnd,UINT msg,WPARAM wParam,LPARAM lParam)
 				  else
 				  {
 					  WideCharToMultiByte(CP_ACP, WC_COMPOSITECHECK|WC_NO_BEST_FIT_CHARS, password, -1, document_password, 80, NULL, NULL);
+					  PrepareKeys();
 				  }
 				  SetFocus(GetParent(hWnd));
 				  DestroyWindow(hWnd);
@@ -0,0 +1,140 @@
+/*
+*  Copyright (C) 2016-2023 maxpat78 <https://github.com/maxpat78>
+*
+*  This program is free software; you can redistribute it and/or modify
+*  it under the terms of the GNU General Public License as published by
+*  the Free Software Foundation; either version 2 of the License, or
+*  (at your option) any later version.
+*
+*  This program is distributed in the hope that it will be useful,
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*  GNU General Public License for more details.
+*
+*  You should have received a copy of the GNU General Public License along
+*  with this program; if not, write to the Free Software Foundation, Inc.,
+*  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+//
+//	TextUtils - text buffer helpers of CryptoPad
+//
+#include "TextUtils.h"
+
+// Scans a NULL terminated TCHAR buffer and determines the line ending 
+int DetectEOL(TCHAR* Buf, UINT* cCR, UINT* cLF, UINT* cCRLF)
+{
+	TCHAR* p = Buf;
+	TCHAR* q = NULL;
+	UINT cr = 0, lf = 0, crlf = 0;
+
+	while (*p)
+	{
+		if (*p == _T('\r'))
+		{
+			cr++;
+			q = p;
+		}
+		else if (*p == _T('\n'))
+		{
+			lf++;
+			if (q + 1 == p)
+			{
+				crlf++;
+				cr--;
+				lf--;
+			}
+		}
+		p++;
+	}
+
+	*cCR = cr;
+	*cLF = lf;
+	*cCRLF = crlf;
+
+	if (!cr && !lf && !crlf)
+		return EOL_NONE;
+	else if (!cr && !lf)
+		return EOL_CRLF;
+	else if (!lf && !crlf)
+		return EOL_CR;
+	else if (!cr && !crlf)
+		return EOL_LF;
+	else
+		return EOL_MIXED;
+}
+
+// Converts EOL characters in a NULL-terminated TCHAR buffer,
+// copying the result in a user allocated buffer. If uiDstSize
+// or DstBuf is NULL, returns the required buffer size.
+int ConvertEOL(
+	TCHAR* SrcBuf, UINT uiSrcSize, UINT uiSrcEol,
+	TCHAR* DstBuf, UINT uiDstSize, UINT uiDstEol,
+	UINT cCR, UINT cLF, UINT cCRLF)
+{
+	UINT uiSize = uiSrcSize;
+	TCHAR *p, *q=NULL;
+
+	if (uiSrcEol == uiDstEol)
+		return -1;
+
+	if (uiDstEol != EOL_CR && uiDstEol != EOL_LF && uiDstEol != EOL_CRLF)
+		return -1;
+
+	if (uiDstEol == EOL_CRLF)
+		if (uiSrcEol == EOL_LF)
+			uiSize += (cLF * sizeof(TCHAR));
+		else if (uiSrcEol == EOL_CR)
+			uiSize += (cCR * sizeof(TCHAR));
+		else
+			uiSize += (sizeof(TCHAR) * (cCR+cLF));
+	else
+		uiSize -= ((cCRLF/2) * sizeof(TCHAR));
+
+	if (!uiDstSize || !DstBuf)
+		return uiSize;
+
+	if (uiDstSize < uiSize)
+		return -1;
+
+	p = DstBuf;
+
+	while (*SrcBuf)
+	{
+		if (*SrcBuf == _T('\r'))
+			if (uiDstEol == EOL_CRLF)
+			{
+				*p++ = _T('\r');
+				*p++ = _T('\n');
+				q = SrcBuf;
+			}
+			else // EOL_LF
+			{
+				if (uiDstEol == EOL_LF)
+					*p++ = _T('\n');
+				else
+					*p++ = *SrcBuf;
+			}
+		else if (*SrcBuf == _T('\n'))
+			if (uiDstEol == EOL_CRLF)
+			{
+				if (q + 1 != SrcBuf)
+				{
+					*p++ = _T('\r');
+					*p++ = _T('\n');
+				}
+			}
+			else // EOL_CR
+			{
+				if (uiSrcEol != EOL_CRLF)
+					*p++ = _T('\r');
+			}
+		else // copy normal TCHAR
+			*p++ = *SrcBuf;
+		SrcBuf++;
+	}
+
+	*p = _T('\0');
+
+	return 0;
+}
@@ -0,0 +1,57 @@
+/*
+*  Copyright (C) 2016-2023 maxpat78 <https://github.com/maxpat78>
+*
+*  This program is free software; you can redistribute it and/or modify
+*  it under the terms of the GNU General Public License as published by
+*  the Free Software Foundation; either version 2 of the License, or
+*  (at your option) any later version.
+*
+*  This program is distributed in the hope that it will be useful,
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*  GNU General Public License for more details.
+*
+*  You should have received a copy of the GNU General Public License along
+*  with this program; if not, write to the Free Software Foundation, Inc.,
+*  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+//
+//	TextUtils - text buffer helpers of CryptoPad, kept apart from the UI so
+//	that they can be built and benchmarked on any system
+//
+#if !defined(__TEXTUTILS__)
+#define __TEXTUTILS__
+
+#ifdef _WIN32
+#include <tchar.h>
+#include <windows.h>
+#else
+// UTF-16 code units, as in the UNICODE build of CryptoPad
+#include <stddef.h>
+typedef unsigned short TCHAR;
+typedef unsigned int UINT;
+#define _T(x) x
+#endif
+
+enum Eol_Markers
+{
+	EOL_NONE,   // None
+	EOL_CR,		// Mac
+	EOL_LF,		// Unix
+	EOL_CRLF,	// DOS
+	EOL_MIXED	// Unbalanced (to be fixed)
+};
+
+// Scans a NULL terminated TCHAR buffer and determines the line ending 
+int DetectEOL(TCHAR* Buf, UINT* cCR, UINT* cLF, UINT* cCRLF);
+
+// Converts EOL characters in a NULL-terminated TCHAR buffer,
+// copying the result in a user allocated buffer. If uiDstSize
+// or DstBuf is NULL, returns the required buffer size.
+int ConvertEOL(
+	TCHAR* SrcBuf, UINT uiSrcSize, UINT uiSrcEol,
+	TCHAR* DstBuf, UINT uiDstSize, UINT uiDstEol,
+	UINT cCR, UINT cLF, UINT cCRLF);
+
+#endif // __TEXTUTILS__
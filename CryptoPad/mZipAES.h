@@ -26,14 +26,23 @@
 
    Zlib is required to support Deflate algorithm.
    
-   Cryptographic functions (i.e. PBKDF2 keys derivation, SHA-1 HMAC, AES 
-   encryption) require one of these kits: OpenSSL or LibreSSL, Botan,
-   GNU libgcrypt or Mozilla NSS.
+   SHA-1 HMAC, PBKDF2 keys derivation and AES are built in, and random salts
+   come from the operating system; OpenSSL or LibreSSL may be linked as an
+   alternative backend (see MZAE_backend).
+
+   All functions are reentrant: state lives in the objects and buffers the
+   caller passes, and distinct objects may be used from distinct threads at
+   the same time. A single object (reader, writer, prekey pipeline, arena...)
+   must not be shared by concurrent calls. Process wide settings (backend,
+   codec, SHA-1 kernel, parallel CTR and Deflate, salt hook, allocator) are
+   not synchronized: make them before other threads use the library.
 */
 
 #if !defined(__MZIPAES__)
 #define __MZIPAES__
 
+#include <stddef.h>
+
 # ifdef  __cplusplus
 extern "C" {
 # endif
@@ -52,6 +61,10 @@ extern "C" {
 #define MZAE_ERR_BADHMAC			11
 #define MZAE_ERR_BADCRC				12
 #define MZAE_ERR_NOPW				13
+#define MZAE_ERR_IO					14
+
+// Size of the working window of the streaming functions
+#define MZAE_CHUNK					65536
 
 
 
@@ -71,16 +84,156 @@ char* MZAE_errmsg(int code);
 	src		uncompressed data to archive
 	srcLen		length of src buffer
 	dst		pre allocated buffer receiving the resulting ZIP archive
-	dstLen		length of dst buffer
+	dstLen		length of dst buffer, receives the length of the archive
 	password	ASCII password used to encrypt
 
 	Returns zero for success.
-	If called with dstLen set to zero, fills it with the required number of bytes.
+	If called with dstLen set to zero, fills it with the required number of
+	bytes: this is an upper bound computed without compressing, the input is
+	deflated only once by the second call, which sets the exact length.
+	Inputs of 4 GiB or close to it, which need ZIP64, fail with
+	MZAE_ERR_PARAMS.
 */
 int MiniZipAEWrite(char* src, unsigned long srcLen, char** dst, unsigned long *dstLen, char* password);
 
 
 
+typedef struct mzae_prekey MZAE_PREKEY;
+typedef struct mzae_kdf MZAE_KDF;
+typedef struct mzae_arena MZAE_ARENA;
+
+// Stages timed by MZAE_STATS
+enum {
+	MZAE_STAGE_KDF,		// waiting for the keys
+	MZAE_STAGE_CRC,
+	MZAE_STAGE_CODEC,	// Deflate when writing, Inflate when reading
+	MZAE_STAGE_AES,
+	MZAE_STAGE_HMAC,
+	MZAE_STAGES
+};
+
+/*
+	Statistics of a MiniZipAEWriteEx or MiniZipAEReadEx call, filled in when
+	the options point to one: otherwise nothing is timed nor counted.
+
+	Times are in nanoseconds. Each stage is timed alone, i.e. the Deflate
+	time does not include encrypting its output. Keys are derived in
+	background while the first blocks are deflated (or read), so the KDF
+	time is only what the call had to wait for them.
+	Scratch memory is that of the library objects (codecs with their zlib
+	state, AES and HMAC contexts, key derivation job, reader) allocated by
+	the calling thread: neither the caller's buffers nor OpenSSL internals.
+*/
+typedef struct {
+	unsigned long long ns[MZAE_STAGES];		// time spent in each stage
+	unsigned long long bytes[MZAE_STAGES];	// bytes fed to each stage
+	unsigned long long total_ns;			// whole call
+	unsigned long bytes_in, bytes_out;		// document and archive, or vice versa
+	double ratio;							// compressed data / document size
+	unsigned long scratch;					// scratch memory still allocated at return
+	unsigned long peak_scratch;				// highest scratch memory allocated
+	unsigned int allocs;					// scratch allocations
+	int profile;							// write profile (MZAE_PROFILE_*)
+	int level;								// its Deflate level, 0 if Stored
+	int ae;									// AE version written: 1 or 2
+	int strength;							// AES key bits written
+	double entropy;							// estimated bits per byte, 0 if not sampled
+	int skipped;							// stored without trying Deflate
+	int threads;							// threads which deflated or inflated, 0 if Stored
+} MZAE_STATS;
+
+/*
+	Write profiles, trading compression ratio for speed. All of them write
+	archives that WinZip and 7-Zip open.
+
+	BALANCED	Deflate level 8, AE-1 (CRC-32 stored): the default
+	FAST		Deflate level 1, AE-2: no CRC pass, integrity rests on the
+				HMAC alone. Meant for autosaves, where latency matters more
+				than the last percent of ratio
+	MAX			Deflate level 9, AE-1
+*/
+#define MZAE_PROFILE_BALANCED	0
+#define MZAE_PROFILE_FAST		1
+#define MZAE_PROFILE_MAX		2
+#define MZAE_PROFILES			3
+
+/*
+	Returns the name of a write profile ("balanced", "fast", "max"), or NULL.
+*/
+const char* MZAE_profile_name(int profile);
+
+/*
+	How MiniZipAEWriteEx chooses the compression method.
+
+	AUTO		samples the input and stores it without trying Deflate when
+				it looks incompressible (pasted binaries, already compressed
+				or random data): the default
+	DEFLATE		always tries Deflate, storing only if it does not win
+	STORE		never compresses
+*/
+#define MZAE_METHOD_AUTO		0
+#define MZAE_METHOD_DEFLATE		1
+#define MZAE_METHOD_STORE		2
+
+// Inputs sampled by MZAE_METHOD_AUTO, and the entropy that stores them
+#define MZAE_PROBE_MIN			4096
+#define MZAE_PROBE_BITS			7.9
+
+// Most segments indexed by MZAE_OPTIONS.sync: longer inputs get longer ones
+#define MZAE_SYNC_POINTS		4096
+
+/*
+	Estimates the entropy of a buffer, in bits per byte, from the byte
+	histogram of a few blocks sampled across it (of all of it, if short).
+
+	Near 8 bits per byte, Huffman coding cannot gain and Deflate can only
+	win on repeated strings, which are rare in such data; the histogram
+	does not see them.
+*/
+double MZAE_entropy(char* src, unsigned long len);
+
+/*
+	Options for MiniZipAEWriteEx and MiniZipAEReadEx. A zeroed structure
+	selects the behaviour of MiniZipAEWrite and MiniZipAERead.
+*/
+typedef struct {
+	MZAE_PREKEY* prekey;	// key material derived in advance, or NULL (write)
+	MZAE_KDF* kdf;			// keys being derived from the archive salt, or NULL (read)
+	MZAE_STATS* stats;		// receives the statistics of the call, or NULL
+	MZAE_ARENA* arena;		// serves the scratch memory of the call, or NULL
+	int profile;			// MZAE_PROFILE_* (write)
+	int strength;			// AES key bits: 128, 192 or 256; 0 for 256 (write)
+	int method;				// MZAE_METHOD_* (write)
+	unsigned long sync;		// bytes between indexed sync points, 0 for none (write)
+	int reverse;			// the document is stored byte reversed, as in V2 (read, write)
+} MZAE_OPTIONS;
+
+
+/*
+	Like MiniZipAEWrite, with options (which may be NULL).
+
+	If a prekey set up for the same password is given, its salt and keys
+	are used in place of deriving new ones, and the next set is started in
+	background (AES-256 only: other strengths always derive new keys).
+	Otherwise, keys are derived in background while the input is deflated,
+	and joined when the first compressed block is ready.
+
+	If options->sync is set, documents longer than that are deflated in
+	independent segments of sync bytes (at least 64 KB, and no more than
+	MZAE_SYNC_POINTS segments), whose offsets are recorded in a private
+	extra field of the Central Directory: MiniZipAEReadEx then inflates
+	them on several threads, while other readers ignore the index and
+	inflate the stream as usual. The ratio drops a little, since a segment
+	can't refer to the data before it.
+
+	If options->reverse is set, the archive holds src byte reversed: blocks
+	are reversed from its tail as they are compressed (or, with a whole
+	buffer codec, into a copy), and src is left untouched.
+*/
+int MiniZipAEWriteEx(char* src, unsigned long srcLen, char** dst, unsigned long *dstLen, char* password, MZAE_OPTIONS* options);
+
+
+
 /*
 	Extracts in memory the single file from a Deflated and AES encrypted ZIP
 	archive created with MiniZipAEWrite function (accepts any key strength).
@@ -97,6 +250,96 @@ int MiniZipAEWrite(char* src, unsigned long srcLen, char** dst, unsigned long *d
 int MiniZipAERead(char* src, unsigned long srcLen, char** dst, unsigned long *dstLen, char* password);
 
 
+/*
+	Like MiniZipAERead, with options (which may be NULL).
+
+	A kdf job started with MZAE_kdf_start on the archive salt, while the
+	rest of the archive was being loaded, replaces the keys derivation. It
+	is consumed by any call but a size query, even if the salt differs.
+
+	If options->reverse is set, the extracted data are reversed into dst
+	as they are produced (in a pass more, with a whole buffer codec or a
+	sync point index).
+*/
+int MiniZipAEReadEx(char* src, unsigned long srcLen, char** dst, unsigned long *dstLen, char* password, MZAE_OPTIONS* options);
+
+
+
+/*
+	Replaces malloc and free for the scratch memory of the MZAE functions,
+	i.e. the objects they allocate internally (codecs, AES and HMAC contexts,
+	keys derivation jobs, streaming reader and writer). It must be called
+	before any other MZAE function; NULL functions restore malloc and free.
+	Buffers returned to the caller (i.e. by MZAE_deflate) still come from
+	malloc, and are released with free.
+*/
+void MZAE_allocator(void* (*alloc)(void* opaque, size_t size), void (*release)(void* opaque, void* p), void* opaque);
+
+
+
+#define MZAE_ARENA_LOCK		1	// locked in memory, never paged out
+#define MZAE_ARENA_HUGE		2	// backed by huge (large) pages, if available
+
+// Default arena size, enough for a MiniZipAEWriteEx or MiniZipAEReadEx call
+#define MZAE_ARENA_SIZE		(1 << 20)
+
+/*
+	Creates an arena, a region serving all the scratch memory of the
+	MiniZipAEWriteEx or MiniZipAEReadEx calls it is given to. Blocks are
+	handed out in sequence, aligned on cache lines, and are never released
+	one by one: the used part is wiped once when the call returns, and the
+	region is reused by the next call. When it is full, the allocator takes
+	over. An arena must not serve two calls at the same time: give one to
+	each thread.
+
+	arena		pointer receiving the address of the new arena
+	size		its size in bytes, or zero for MZAE_ARENA_SIZE
+	flags		MZAE_ARENA_LOCK and/or MZAE_ARENA_HUGE
+
+	Returns zero for success, or MZAE_ERR_NOMEM (also if the region could
+	not be locked). Huge pages are used if the system has them to spare.
+*/
+int MZAE_arena_init(MZAE_ARENA** arena, unsigned long size, int flags);
+
+
+/*
+	Wipes and releases an arena.
+*/
+void MZAE_arena_free(MZAE_ARENA* arena);
+
+
+
+/*
+	Starts deriving in background a random salt with its AES-256 and HMAC
+	keys for password, so that a subsequent MiniZipAEWriteEx does not wait
+	for the PBKDF2. Each set is handed out once, and a fresh one is prepared
+	as soon as the previous is taken: salts are never reused.
+
+	prekey		pointer receiving the address of the new pipeline
+	password	ASCII password the keys are derived from (copied)
+
+	Returns zero for success.
+*/
+int MZAE_prekey_init(MZAE_PREKEY** prekey, char* password);
+
+
+/*
+	Takes the next set of key material, waiting for its derivation if still
+	in progress, and starts preparing another one. Keys are stored like
+	MZAE_derive_keys_into does; salt must have room for 16 bytes.
+
+	Returns zero for success, MZAE_ERR_NOPW if password is not the one
+	given to MZAE_prekey_init.
+*/
+int MZAE_prekey_take(MZAE_PREKEY* prekey, char* password, char* salt, char* keys);
+
+
+/*
+	Stops the pipeline, wiping password and unused keys.
+*/
+void MZAE_prekey_free(MZAE_PREKEY* prekey);
+
+
 
 /*
 	Generates a random salt for the keys derivation function.
@@ -109,6 +352,14 @@ int MiniZipAERead(char* src, unsigned long srcLen, char** dst, unsigned long *ds
 int MZAE_gen_salt(char* salt, int saltlen);
 
 
+/*
+	Makes MZAE_gen_salt call hook instead of the random number generator.
+	Archives become reproducible, but are no more secure: meant for
+	benchmarks and regression tests only. A NULL hook restores the default.
+*/
+void MZAE_salt_hook(int (*hook)(char* salt, int saltlen));
+
+
 /*
 	Generates keys for AES encryption and HMAC-SHA1, plus a 16-bit verification
 	value, from a password and a random salt.
@@ -125,6 +376,143 @@ int MZAE_gen_salt(char* salt, int saltlen);
 int MZAE_derive_keys(char* password, char* salt, int saltlen, char** aes_key, char** hmac_key, char** vv);
 
 
+// Room for the keys and verification value of AES-256
+#define MZAE_KEYS_SIZE				66
+
+/*
+	Like MZAE_derive_keys, but stores into a caller provided buffer of
+	2*(saltlen*2)+2 bytes (MZAE_KEYS_SIZE at most): the AES key first, then
+	the HMAC key, then the verification value. Nothing is allocated.
+
+	Returns zero for success.
+*/
+int MZAE_derive_keys_into(char* password, char* salt, int saltlen, char* keys);
+
+
+/*
+	PBKDF2 with HMAC-SHA1 (RFC 2898), as used by MZAE_derive_keys. The inner
+	and outer pad states are computed once, and up to four output blocks are
+	iterated together in SIMD lanes (one after another with the x86 SHA
+	extensions, which are faster still). The result is identical to OpenSSL's
+	PKCS5_PBKDF2_HMAC_SHA1.
+
+	password	password and its length
+	salt		salt and its length
+	iterations	iteration count (1000 for WinZip AE)
+	key			buffer receiving keylen bytes of derived key
+
+	Returns zero for success.
+*/
+int MZAE_pbkdf2_sha1(char* password, unsigned int pwlen, char* salt, unsigned int saltlen, unsigned int iterations, char* key, unsigned int keylen);
+
+
+#define MZAE_SHA1_AUTO		0
+#define MZAE_SHA1_C			1
+#define MZAE_SHA1_SSSE3		2
+#define MZAE_SHA1_SHANI		3
+
+/*
+	Selects the SHA-1 compression kernel used by HMAC and PBKDF2: by default,
+	the x86 SHA extensions if the processor has them, else SSSE3, else
+	portable C. A kernel the processor lacks falls back to the next one.
+	Should be called before any hashing takes place.
+
+	kernel		one of MZAE_SHA1_*, or -1 to query
+
+	Returns the kernel actually in use.
+*/
+int MZAE_sha1_kernel(int kernel);
+
+
+#define MZAE_BACKEND_AUTO		0
+#define MZAE_BACKEND_C			1
+#define MZAE_BACKEND_AESNI		2
+#define MZAE_BACKEND_OPENSSL	3
+#define MZAE_BACKENDS			4
+
+/*
+	Selects the cryptographic backend of salts, keys derivation, AES-CTR and
+	HMAC: portable C, AES-NI instructions, or OpenSSL (if built in). By
+	default, the first use times the available ones on a short sample and
+	keeps the fastest; a backend that can't run here is replaced the same
+	way. The portable C one, whose table lookups are open to cache timing
+	attacks, is left out of the race and only used if no other can run or
+	if selected here. Should be called before any encryption takes place.
+
+	backend		one of MZAE_BACKEND_*, or -1 to query
+
+	Returns the backend actually in use.
+*/
+int MZAE_backend(int backend);
+
+
+/*
+	Returns the name of a backend, or NULL if it is not built in.
+*/
+const char* MZAE_backend_name(int backend);
+
+
+#define MZAE_CODEC_AUTO			0
+#define MZAE_CODEC_ZLIB			1
+#define MZAE_CODEC_LIBDEFLATE	2
+#define MZAE_CODECS				3
+
+/*
+	Selects the codec of MZAE_deflate, MZAE_inflate, MiniZipAEWrite and
+	MiniZipAERead: Zlib, or libdeflate if built in (with MZAE_LIBDEFLATE
+	defined, linking libdeflate), which works on whole buffers and is
+	faster. By default, libdeflate if built in. The streaming writer and
+	reader always use Zlib.
+
+	codec		one of MZAE_CODEC_*, or -1 to query
+
+	Returns the codec actually in use.
+*/
+int MZAE_codec(int codec);
+
+
+/*
+	Returns the name of a codec, or NULL if it is not built in.
+*/
+const char* MZAE_codec_name(int codec);
+
+
+/*
+	Tunes the parallel Deflate: MZAE_deflate and MiniZipAEWrite split inputs
+	of threshold bytes or more in slices, deflated by as many threads with
+	Zlib (whatever the codec) into a single standard stream. Each slice is
+	primed with the 32 KB preceding it, so the ratio barely changes. The
+	same threads inflate the segments of archives with a sync point index
+	(see MiniZipAEWriteEx). Should be called before any compression takes
+	place.
+
+	threshold	minimum length to go parallel (default 1 MB, zero disables)
+	threads		maximum number of threads (default zero, one per processor)
+*/
+void MZAE_deflate_threads(unsigned long threshold, unsigned int threads);
+
+
+/*
+	Starts MZAE_derive_keys in background (or runs it at once, if a thread
+	can't be created). Password and salt are copied.
+
+	job			pointer receiving the address of the new job
+
+	Returns zero for success.
+*/
+int MZAE_kdf_start(MZAE_KDF** job, char* password, char* salt, int saltlen);
+
+
+/*
+	Waits for a job started with MZAE_kdf_start and releases it. The keys
+	are stored like MZAE_derive_keys_into does, if salt and saltlen match
+	the ones of the job; pass a NULL keys to discard them.
+
+	Returns zero for success, -1 if the salt does not match.
+*/
+int MZAE_kdf_join(MZAE_KDF* job, char* salt, int saltlen, char* keys);
+
+
 /*
 	Encrypts data into a newly allocated buffer, using AES in CTR mode with a
 	little endian counter.
@@ -140,6 +528,27 @@ int MZAE_derive_keys(char* password, char* salt, int saltlen, char** aes_key, ch
 int MZAE_ctr_crypt(char* key, unsigned int keylen, char* src, unsigned int srclen, char** dst);
 
 
+/*
+	Like MZAE_ctr_crypt, but stores the result into a caller provided buffer
+	of at least srclen bytes, which may coincide with src to work in place.
+	No data buffer is allocated.
+
+	Returns zero for success.
+*/
+int MZAE_ctr_crypt_into(char* key, unsigned int keylen, char* src, unsigned int srclen, char* dst);
+
+
+/*
+	Tunes the parallel CTR mode: MZAE_ctr_crypt and MZAE_ctr_update split
+	buffers of threshold bytes or more among threads, at 16-byte boundaries.
+	Should be called before any encryption takes place.
+
+	threshold	minimum length to go parallel (default 4 MB, zero disables)
+	threads		maximum number of threads (default zero, one per processor)
+*/
+void MZAE_ctr_threads(unsigned int threshold, unsigned int threads);
+
+
 /*
 	Computates the HMAC-SHA1 for a given buffer.
 	
@@ -147,7 +556,8 @@ int MZAE_ctr_crypt(char* key, unsigned int keylen, char* src, unsigned int srcle
 	keylen		its length in bytes
 	src			points to the data to calculate the HMAC for
 	srclen		length of such data
-	dst			pointer receiving the address of the HMAC string
+	dst			pointer receiving the address of the HMAC string, valid
+				until the next call from the same thread
 
 	Returns zero for success.
 */
@@ -155,7 +565,17 @@ int MZAE_hmac_sha1_80(char* key, unsigned int keylen, char* src, unsigned int sr
 
 
 /*
-	Computates the ZIP crc32 (AE-1).
+	Like MZAE_hmac_sha1_80, but stores the 10 bytes of HMAC into a caller
+	provided buffer.
+
+	Returns zero for success.
+*/
+int MZAE_hmac_sha1_80_into(char* key, unsigned int keylen, char* src, unsigned int srclen, char* hmac);
+
+
+/*
+	Computates the ZIP crc32 (AE-1), like zlib's crc32. Uses PCLMULQDQ if
+	available.
 	
 	crc			initial crc value to update
 	src			source buffer
@@ -166,6 +586,30 @@ int MZAE_hmac_sha1_80(char* key, unsigned int keylen, char* src, unsigned int sr
 unsigned long MZAE_crc(unsigned long crc, char* src, unsigned int srclen);
 
 
+/*
+	Combines the crc32 of two consecutive blocks, so that they can be
+	computated apart (i.e. by different threads).
+
+	crc1		crc32 of the first block
+	crc2		crc32 of the second block
+	len2		length of the second block
+
+	Returns the crc32 of both blocks.
+*/
+unsigned long MZAE_crc_combine(unsigned long crc1, unsigned long crc2, unsigned long len2);
+
+
+/*
+	Copies a buffer with its bytes in reverse order, 16 at a time with
+	SSSE3 if available.
+
+	dst			destination buffer, or src itself to reverse in place
+	src			source buffer, not overlapping dst otherwise
+	len			its length
+*/
+void MZAE_memrev(char* dst, char* src, unsigned long len);
+
+
 /*
 	One pass deflate.
 	
@@ -193,6 +637,299 @@ int MZAE_deflate(char* src, unsigned int srclen, char** dst, unsigned int* dstle
 */
 int MZAE_inflate(char* src, unsigned int srclen, char* dst, unsigned int dstlen);
 
+
+
+/*
+	Receives a chunk of output from the streaming functions.
+
+	opaque		user pointer given at initialization time
+	buf		data to consume (it may be modified by the callee)
+	len		its length
+
+	Returns zero for success, any other value aborts the operation.
+*/
+typedef int (*MZAE_SINK)(void* opaque, char* buf, unsigned int len);
+
+
+/*
+	A sink writing to a file descriptor, passed as opaque pointer with
+	(void*)(intptr_t) fd.
+
+	Returns zero for success.
+*/
+int MZAE_fd_sink(void* opaque, char* buf, unsigned int len);
+
+
+typedef struct mzae_writer MZAE_WRITER;
+
+/*
+	Starts a streaming Deflated and AES-256 encrypted ZIP archive: generates
+	the salt and derives the keys.
+
+	Since sizes and CRC are unknown in advance, the archive stores them in a
+	data descriptor after the data (general purpose bit 3) and has no comment
+	(V1 document format). Memory use is bounded by the Deflate state and by a
+	fixed size window, whatever the input length.
+
+	The first 20 bytes are held back, and the local header is emitted with
+	them: a stream ending sooner is written as AE-2, without the CRC which
+	could give such a short text away, like MiniZipAEWrite does. Longer ones
+	are AE-1, so the sink sees nothing before the 20th byte or the final call.
+
+	writer		pointer receiving the address of the new writer
+	password	ASCII password used to encrypt
+	sink		callback receiving the archive bytes, in order
+	opaque		user pointer passed to sink
+
+	Returns zero for success.
+*/
+int MZAE_writer_init(MZAE_WRITER** writer, char* password, MZAE_SINK sink, void* opaque);
+
+
+/*
+	Compresses, encrypts and authenticates a chunk of uncompressed data.
+
+	writer		writer returned by MZAE_writer_init
+	src		uncompressed data
+	srclen		its length
+
+	Returns zero for success, MZAE_ERR_PARAMS if the data or the archive
+	would outgrow 4 GiB, which needs ZIP64.
+*/
+int MZAE_writer_update(MZAE_WRITER* writer, char* src, unsigned int srclen);
+
+
+/*
+	Flushes the compressor and emits HMAC, data descriptor, central directory
+	and end of central directory record. The writer is always released.
+
+	Returns zero for success.
+*/
+int MZAE_writer_final(MZAE_WRITER* writer);
+
+
+/*
+	Releases a writer without completing the archive.
+*/
+void MZAE_writer_free(MZAE_WRITER* writer);
+
+
+
+typedef struct mzae_reader MZAE_READER;
+
+/*
+	Starts the streaming extraction of the single file from an AES encrypted
+	ZIP archive (Stored or Deflated, any key strength, with or without data
+	descriptor).
+
+	Ciphertext is decrypted, inflated and checked in windows of MZAE_CHUNK
+	bytes, so memory use does not depend on the archive size. Plaintext
+	reaching the sink is not authenticated until MZAE_reader_final succeeds.
+
+	reader		pointer receiving the address of the new reader
+	password	ASCII password required to decrypt
+	sink		callback receiving the extracted data, in order
+	opaque		user pointer passed to sink
+
+	Returns zero for success.
+*/
+int MZAE_reader_init(MZAE_READER** reader, char* password, MZAE_SINK sink, void* opaque);
+
+
+/*
+	Consumes the next chunk of the archive. Keys are derived as soon as the
+	local header and salt are complete, so a wrong password is reported
+	before any data is processed. Bytes following the encrypted data (data
+	descriptor excluded) are ignored.
+
+	reader		reader returned by MZAE_reader_init
+	src		archive bytes
+	srclen		their length
+
+	Returns zero for success.
+*/
+int MZAE_reader_update(MZAE_READER* reader, char* src, unsigned int srclen);
+
+
+/*
+	Feeds the reader with the whole contents of a file descriptor.
+
+	Returns zero for success.
+*/
+int MZAE_reader_fd(MZAE_READER* reader, int fd);
+
+
+/*
+	Checks HMAC, size and CRC (AE-1) of the extracted data. The reader is
+	always released.
+
+	Returns zero for success.
+*/
+int MZAE_reader_final(MZAE_READER* reader);
+
+
+/*
+	Releases a reader without checking the extracted data.
+*/
+void MZAE_reader_free(MZAE_READER* reader);
+
+
+
+/*
+	Incremental primitives used by the streaming functions.
+*/
+typedef struct mzae_ctr MZAE_CTR;
+typedef struct mzae_hmac MZAE_HMAC;
+typedef struct mzae_deflate MZAE_DEFLATE;
+typedef struct mzae_inflate MZAE_INFLATE;
+
+
+/*
+	Prepares AES encryption in CTR mode with a little endian counter.
+	
+	ctx			pointer receiving the address of the new context
+	key			the AES key computated with AE_derive_keys
+	keylen		its length in bytes
+
+	Returns zero for success.
+*/
+int MZAE_ctr_init(MZAE_CTR** ctx, char* key, unsigned int keylen);
+
+
+/*
+	Encrypts (or decrypts) the next srclen bytes of the stream into dst,
+	which may coincide with src.
+
+	Returns zero for success.
+*/
+int MZAE_ctr_update(MZAE_CTR* ctx, char* src, unsigned int srclen, char* dst);
+
+
+/*
+	Rewinds the CTR context to the start of the keystream.
+*/
+void MZAE_ctr_reset(MZAE_CTR* ctx);
+
+
+/*
+	Releases the CTR context, wiping the key schedule.
+*/
+void MZAE_ctr_free(MZAE_CTR* ctx);
+
+
+/*
+	Prepares an HMAC-SHA1 calculation.
+
+	ctx			pointer receiving the address of the new context
+	key			the HMAC key computated with AE_derive_keys
+	keylen		its length in bytes
+
+	Returns zero for success.
+*/
+int MZAE_hmac_init(MZAE_HMAC** ctx, char* key, unsigned int keylen);
+
+
+/*
+	Adds srclen bytes to the HMAC calculation.
+
+	Returns zero for success.
+*/
+int MZAE_hmac_update(MZAE_HMAC* ctx, char* src, unsigned int srclen);
+
+
+/*
+	Restarts the HMAC calculation with the same key, discarding the data
+	added so far.
+
+	Returns zero for success.
+*/
+int MZAE_hmac_reset(MZAE_HMAC* ctx);
+
+
+/*
+	Stores the first 80 bits of the HMAC into a 10 bytes buffer and releases
+	the context. Pass a NULL hmac to release the context only.
+
+	Returns zero for success.
+*/
+int MZAE_hmac_final(MZAE_HMAC* ctx, char* hmac);
+
+
+/*
+	Prepares a streaming deflate.
+
+	ctx			pointer receiving the address of the new context
+
+	Returns zero for success.
+*/
+int MZAE_deflate_init(MZAE_DEFLATE** ctx);
+
+
+/*
+	Like MZAE_deflate_init, with a compression level (0-9, or -1 for the
+	Zlib default) and a Zlib strategy (i.e. Z_DEFAULT_STRATEGY, Z_FILTERED)
+	in place of level 8 and the default strategy.
+
+	Returns zero for success.
+*/
+int MZAE_deflate_init2(MZAE_DEFLATE** ctx, int level, int strategy);
+
+
+/*
+	Compresses a chunk of data, passing the compressed output to sink in
+	pieces of bounded size.
+
+	ctx			context returned by MZAE_deflate_init
+	src			uncompressed data
+	srclen		its length
+	finish		non zero with the last chunk, to terminate the stream
+	sink		callback receiving the compressed data
+	opaque		user pointer passed to sink
+
+	Returns zero for success.
+*/
+int MZAE_deflate_update(MZAE_DEFLATE* ctx, char* src, unsigned int srclen, int finish, MZAE_SINK sink, void* opaque);
+
+
+/*
+	Releases the deflate context.
+*/
+void MZAE_deflate_free(MZAE_DEFLATE* ctx);
+
+
+/*
+	Prepares a streaming inflate.
+
+	ctx			pointer receiving the address of the new context
+
+	Returns zero for success.
+*/
+int MZAE_inflate_init(MZAE_INFLATE** ctx);
+
+
+/*
+	Decompresses a chunk of data, passing the output to sink in pieces of
+	bounded size.
+
+	ctx			context returned by MZAE_inflate_init
+	src			compressed data
+	srclen		its length
+	used		receives the number of bytes consumed (less than srclen
+				only if the stream ended)
+	sink		callback receiving the uncompressed data
+	opaque		user pointer passed to sink
+
+	Returns zero if more input is expected, 1 at the end of the stream,
+	2 for bad data and 3 if the sink failed.
+*/
+int MZAE_inflate_update(MZAE_INFLATE* ctx, char* src, unsigned int srclen, unsigned int* used, MZAE_SINK sink, void* opaque);
+
+
+/*
+	Releases the inflate context.
+*/
+void MZAE_inflate_free(MZAE_INFLATE* ctx);
+
 # ifdef  __cplusplus
 }
 # endif